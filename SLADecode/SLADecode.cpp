@@ -7,6 +7,8 @@
 #include "SLADecodeFFMpeg.h"
 #include "SLAImage.h"
 #include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLAKlvExtract.h"
 #include "SLAHal.h"
 
 typedef struct {
@@ -19,18 +21,103 @@ typedef struct {
   int frameCount;
   int klvCount;
   int haveKLV;
+  bool rgba;          // output type requested in Create
+  bool poolable;      // plain udp:// source, can be parked and rebound
 } SLADecodeData;
 
+// Decoders parked by Destroy for reuse by the next Create, see SLADecode::SetPoolSize
+#define SLA_DECODE_POOL_MAX 16
+// Created at static initialisation, before any thread can reach the pool
+static SLA_Sem decoderPoolLock = SLASemCreate(1, "SLADecode pool");
+static SLADecodeData *decoderPool[SLA_DECODE_POOL_MAX];
+static int decoderPoolCount;
+static int decoderPoolSize;
+
+static bool isPoolableAddress(const char *UDPAddress)
+{
+  return UDPAddress && strncmp(UDPAddress, "udp://", 6)==0;
+}
+
+// Take a parked decoder with the same output type
+static SLADecodeData *poolTake(bool rgba)
+{
+  SLADecodeData *data = NULL;
+  if(!decoderPoolLock)
+    return NULL;
+  SLASemPend(decoderPoolLock, SEM_FOREVER);
+  for(int i=0; i<decoderPoolCount; i++) {
+    if(decoderPool[i]->rgba == rgba) {
+      data = decoderPool[i];
+      decoderPool[i] = decoderPool[--decoderPoolCount];
+      break;
+    }
+  }
+  SLASemPost(decoderPoolLock);
+  return data;
+}
+
+// Back to what Initialize sets up, so a rebound decoder does not keep the
+// settings of the stream it was parked from
+static void resetSettings(SLADecodeFFMPEG *ffcam)
+{
+  ffcam->SetDecodeMode(SLA_DECODE_ALL);
+  ffcam->SetPreviewSize(0, 0);
+  ffcam->SetDeinterlace(SLA_DEINTERLACE_OFF);
+  ffcam->SetConvertQuality(SLA_CONVERT_FAST);
+  ffcam->SetCorruptPolicy(SLA_CORRUPT_DELIVER);
+  ffcam->SetAsyncCallBack(false);
+  ffcam->SetFastOpen(false);
+  ffcam->SetPALResample(false);
+  ffcam->SetUpSample(1);
+  ffcam->SetPlaybackSpeed(1.0);
+  ffcam->Pause(false);
+}
+
+// Park the decoder and keep it if there is room in the pool
+static bool poolPut(SLADecodeData *data)
+{
+  if(!decoderPoolLock || !data->poolable)
+    return false;
+
+  SLASemPend(decoderPoolLock, SEM_FOREVER);
+  bool room = decoderPoolCount < decoderPoolSize;
+  SLASemPost(decoderPoolLock);
+  if(!room || data->ffcam.Park(true) != SLA_SUCCESS)
+    return false;
+
+  // No callbacks arrive once parked
+  data->userCb = NULL;
+  data->userStatsCb = NULL;
+  data->userContext = NULL;
+  if(data->yuvIm)
+    data->ffcam.Release(&data->image);
+  data->yuvIm = 0;
+  resetSettings(&data->ffcam);
+
+  SLASemPend(decoderPoolLock, SEM_FOREVER);
+  room = decoderPoolCount < decoderPoolSize;
+  if(room)
+    decoderPool[decoderPoolCount++] = data;
+  SLASemPost(decoderPoolLock);
+  return room;
+}
+
 bool slaCB(SLAImage *image, void *context, u32 capFlags)
 {
   SLADecodeData *pData = (SLADecodeData *)context;
 
   if(!image){
     // indicates a timeout
-    pData->userCb(pData->userContext, 0, 0, 0);
+    if(pData->userCb)
+      pData->userCb(pData->userContext, 0, 0, 0);
     return true;
   }
 
+  // Keep the frame until slaKLVCb has handed it to the user
+  if(pData->yuvIm)
+    pData->ffcam.Release(&pData->image);
+  pData->ffcam.AddRef(image);
+
   pData->image.type = image->type;
   pData->image.yhigh = image->yhigh;
   pData->image.ywide = image->ywide;
@@ -40,7 +127,7 @@ bool slaCB(SLAImage *image, void *context, u32 capFlags)
 //  pData->image.timestamp = image->timestamp;
 
   // if there isn't any klv, use the image-only callback form
-  if(pData->haveKLV==0){
+  if(pData->haveKLV==0 && pData->userCb){
 	  pData->userCb(pData->userContext, &pData->image, 0, 0);
   }
   pData->frameCount++;
@@ -93,6 +180,18 @@ void slaStatsCb(CapStats *stats, void *context)
   myStats.PFrames = stats->PFrames;
   myStats.BFrames = stats->BFrames;
   myStats.OtherFrames = stats->OtherFrames;
+  myStats.DispatchOverwrites = stats->DispatchOverwrites;
+  myStats.DiscardedFrames = stats->DiscardedFrames;
+  myStats.DecodeLoad = stats->DecodeLoad;
+  myStats.DecodeScale = stats->DecodeScale;
+  myStats.LatenessAvg = stats->LatenessAvg;
+  myStats.LatenessMax = stats->LatenessMax;
+  myStats.LateDrops = stats->LateDrops;
+  myStats.CCErrors = stats->CCErrors;
+  myStats.DecodeErrors = stats->DecodeErrors;
+  myStats.CorruptFrames = stats->CorruptFrames;
+  myStats.CorruptDrops = stats->CorruptDrops;
+  myStats.ConvertSkips = stats->ConvertSkips;
 
   if( pData->userStatsCb )
     pData->userStatsCb( &myStats, pData->userContext );
@@ -113,10 +212,13 @@ void slaKLVCb(KLVData *klv, KLVData *klvRecent, void *context)
   SLAImage *cbImg = 0;
   if(pData->frameCount && pData->yuvIm)
     cbImg = &pData->image;
-  pData->userCb(pData->userContext, cbImg, klv, klvRecent);
+  if(pData->userCb)
+    pData->userCb(pData->userContext, cbImg, klv, klvRecent);
 
   // Indicate that the image was passed to user application
   pData->klvCount++;
+  if(pData->yuvIm)
+    pData->ffcam.Release(&pData->image);
   pData->yuvIm = 0;
 }
 
@@ -127,7 +229,23 @@ int __cdecl SLADecode::Create(const char *UDPAddress, SLADecodeCB cb)
 }
 int  __cdecl SLADecode::Create(const char *UDPAddress, SLADecodeCB cb, SLAStatsCB statsCB, void *cbContext, bool rgba)
 {
-  SLADecodeData *data = new SLADecodeData;
+  SLA_IMAGE_TYPE type = rgba ? SLA_IMAGE_C32_PACKED : SLA_IMAGE_C24_PACKED;
+
+  // Rebind a parked decoder: no thread, buffer or codec setup
+  SLADecodeData *data = isPoolableAddress(UDPAddress) ? poolTake(rgba) : NULL;
+  if(data) {
+    data->userContext = cbContext;
+    data->userCb = cb;
+    data->userStatsCb = statsCB;
+    data->klvCount = 0;
+    data->frameCount = data->haveKLV = 0;
+    data->ffcam.Initialize(UDPAddress, type, slaCB, data, 1, 0, 1);
+    data->ffcam.Park(false);
+    Data = (void*)data;
+    return 0;
+  }
+
+  data = new SLADecodeData;
 
   data->userContext = cbContext;
   data->userCb = cb;
@@ -135,9 +253,10 @@ int  __cdecl SLADecode::Create(const char *UDPAddress, SLADecodeCB cb, SLAStatsC
   data->klvCount = 0;
   data->yuvIm = 0;
   data->frameCount = data->haveKLV = 0;
+  data->rgba = rgba;
+  data->poolable = isPoolableAddress(UDPAddress);
 
   // Last parameters are doRGB and noRelease
-  SLA_IMAGE_TYPE type = rgba ? SLA_IMAGE_C32_PACKED : SLA_IMAGE_C24_PACKED;
   if (data->ffcam.Initialize(UDPAddress, type, slaCB, data, 1, 0, 1) != SLA_SUCCESS) {
     delete data;
     return -1;
@@ -160,20 +279,44 @@ int SLADecode::Destroy()
   SLADecodeData *data = (SLADecodeData*)Data;
   if( data ) {
     StopSaving();
+    Data = 0;
+    if(poolPut(data))
+      return 0;
     data->ffcam.Cleanup();
     delete data;
-    Data = 0;
     return 0;
   }
   return -1;
 }
 
+int SLADecode::SetPoolSize(int size)
+{
+  if(!decoderPoolLock)
+    return -1;
+
+  SLADecodeData *evicted[SLA_DECODE_POOL_MAX];
+  int nEvicted = 0;
+
+  SLASemPend(decoderPoolLock, SEM_FOREVER);
+  decoderPoolSize = SLLIMIT(size, 0, SLA_DECODE_POOL_MAX);
+  while(decoderPoolCount > decoderPoolSize)
+    evicted[nEvicted++] = decoderPool[--decoderPoolCount];
+  SLASemPost(decoderPoolLock);
+
+  for(int i=0; i<nEvicted; i++) {
+    evicted[i]->ffcam.Cleanup();
+    delete evicted[i];
+  }
+  return 0;
+}
+
 int SLADecode::SetAddress(const char *UDPAddress)
 {
   SLADecodeData *data = (SLADecodeData*)Data;
   //data->ffcam.Cleanup();
 
   data->frameCount = data->haveKLV = 0;
+  data->poolable = isPoolableAddress(UDPAddress);
 
   if(data->ffcam.Initialize(UDPAddress, SLA_IMAGE_C24_PACKED, slaCB, data, 1, 0, 1)!=SLA_SUCCESS)
     return -1;
@@ -187,6 +330,30 @@ int SLADecode::SetPALResampling(bool resample)
   return 0;
 }
 
+int SLADecode::SetDeinterlace(SLA_DEINTERLACE_MODE mode)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  s32 ffMode;
+  switch(mode) {
+  case DEINTERLACE_OFF:
+    ffMode = SLA_DEINTERLACE_OFF;
+    break;
+  case DEINTERLACE_BOB:
+    ffMode = SLA_DEINTERLACE_BOB;
+    break;
+  case DEINTERLACE_MOTION:
+    ffMode = SLA_DEINTERLACE_MOTION;
+    break;
+  default:
+    return -1;
+  }
+  if(data->ffcam.SetDeinterlace(ffMode) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
 int SLADecode::SetUpSample(int upSample)
 {
   SLADecodeData *data = (SLADecodeData*)Data;
@@ -195,6 +362,15 @@ int SLADecode::SetUpSample(int upSample)
   return 0;
 }
 
+int SLADecode::SetFastOpen(bool enable)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  data->ffcam.SetFastOpen(enable);
+  return 0;
+}
+
 int SLADecode::GetUpSample()
 {
   SLADecodeData *data = (SLADecodeData*)Data;
@@ -203,6 +379,156 @@ int SLADecode::GetUpSample()
   return data->ffcam.GetUpSample();
 }
 
+int SLADecode::SetDecodeMode(SLA_DECODE_MODE mode)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  s32 ffMode;
+  switch(mode) {
+  case DECODE_ALL:
+    ffMode = SLA_DECODE_ALL;
+    break;
+  case DECODE_REFERENCE_ONLY:
+    ffMode = SLA_DECODE_REFERENCE_ONLY;
+    break;
+  case DECODE_KEYFRAMES_ONLY:
+    ffMode = SLA_DECODE_KEYFRAMES_ONLY;
+    break;
+  default:
+    return -1;
+  }
+  if(data->ffcam.SetDecodeMode(ffMode) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+SLA_DECODE_MODE SLADecode::GetDecodeMode()
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return DECODE_ALL;
+  switch(data->ffcam.GetDecodeMode()) {
+  case SLA_DECODE_REFERENCE_ONLY:
+    return DECODE_REFERENCE_ONLY;
+  case SLA_DECODE_KEYFRAMES_ONLY:
+    return DECODE_KEYFRAMES_ONLY;
+  default:
+    return DECODE_ALL;
+  }
+}
+
+int SLADecode::SetCorruptPolicy(SLA_CORRUPT_POLICY policy)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  s32 ffPolicy;
+  switch(policy) {
+  case CORRUPT_DELIVER:
+    ffPolicy = SLA_CORRUPT_DELIVER;
+    break;
+  case CORRUPT_FREEZE:
+    ffPolicy = SLA_CORRUPT_FREEZE;
+    break;
+  case CORRUPT_WAIT_KEYFRAME:
+    ffPolicy = SLA_CORRUPT_WAIT_KEYFRAME;
+    break;
+  default:
+    return -1;
+  }
+  if(data->ffcam.SetCorruptPolicy(ffPolicy) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::SetConvertQuality(SLA_CONVERT_QUALITY quality)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  s32 ffQuality;
+  switch(quality) {
+  case CONVERT_FAST:
+    ffQuality = SLA_CONVERT_FAST;
+    break;
+  case CONVERT_POINT:
+    ffQuality = SLA_CONVERT_POINT;
+    break;
+  case CONVERT_BILINEAR:
+    ffQuality = SLA_CONVERT_BILINEAR;
+    break;
+  case CONVERT_BICUBIC:
+    ffQuality = SLA_CONVERT_BICUBIC;
+    break;
+  case CONVERT_ADAPTIVE:
+    ffQuality = SLA_CONVERT_ADAPTIVE;
+    break;
+  default:
+    return -1;
+  }
+  if(data->ffcam.SetConvertQuality(ffQuality) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::GetLatency(SLA_LATENCY_STAGE stage, SLLatencyStats *stats)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data || !stats)
+    return -1;
+  // SLA_LATENCY_STAGE follows the SLA_LATENCY_ stage order
+  SLALatencySummary summary;
+  if(data->ffcam.GetLatency((s32)stage, &summary) != SLA_SUCCESS)
+    return -1;
+  stats->Count = summary.count;
+  stats->P50 = summary.p50/1000.0f;
+  stats->P99 = summary.p99/1000.0f;
+  stats->P999 = summary.p999/1000.0f;
+  stats->Max = summary.max/1000.0f;
+  return 0;
+}
+
+void SLADecode::ResetLatency()
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(data)
+    data->ffcam.ResetLatency();
+}
+
+int SLADecode::GetPts(const SLAImage *image, s64 *pts)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  if(data->ffcam.GetPts(image, pts) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::GetKlvAt(s64 pts, KLVGeoAt *at)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  if(data->ffcam.GetKlvAt(pts, at) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::SetPreviewSize(int high, int wide)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if(!data)
+    return -1;
+  // Checked before the cast, so a size out of s16 range can't wrap into a valid one
+  if(high<0 || wide<0 || high>0x7FFF || wide>0x7FFF)
+    return -1;
+  if(data->ffcam.SetPreviewSize((s16)high, (s16)wide) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
 int SLADecode::StartSaving(const char *filename)
 {
   SLADecodeData *data = (SLADecodeData*)Data;
@@ -250,6 +576,44 @@ int SLADecode::Seek(double timeStamp)
   return -1;
 }
 
+int SLADecode::SeekFrame(int frame)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if (data == NULL)
+    return -1;
+  if(data->ffcam.SeekFrame(frame) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::GetFrameNumber()
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if (data == NULL)
+    return -1;
+  return data->ffcam.GetFrameNumber();
+}
+
+int SLADecode::SetPlaybackSpeed(double speed)
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if (data == NULL)
+    return -1;
+  if(data->ffcam.SetPlaybackSpeed(speed) == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
+int SLADecode::StepFrame()
+{
+  SLADecodeData *data = (SLADecodeData*)Data;
+  if (data == NULL)
+    return -1;
+  if(data->ffcam.StepFrame() == SLA_SUCCESS)
+    return 0;
+  return -1;
+}
+
 double SLADecode::GetDuration()
 {
 	SLADecodeData *data = (SLADecodeData*)Data;
@@ -257,12 +621,40 @@ double SLADecode::GetDuration()
 }
 
 
-s32 SLADecode::BufferToKLVData(KLVData *klv, const u8* buf, u16 len, s32 bufStartOffset)
+void SLADecode::InitKLVData(KLVData *klv, KLVStore *store)
+{
+   SLInitKLV(klv, store);
+}
+
+s32 SLADecode::BufferToKLVData(KLVData *klv, KLVStore *store, const u8* buf, u16 len, s32 bufStartOffset)
 {
    s32 retVal = -1;
+   SLBindKLV(klv, store);
    //returns 1 for success, 0 for failure
    s32 ret =  ReadKlvFrame(klv, buf, len, bufStartOffset);
    if(ret == 1) retVal = 0; // this routine returns 0 for success, -1 for failure
    return retVal;
 }
 
+void SLADecode::CopyKLVData(KLVData *dst, KLVStore *store, const KLVData *src)
+{
+   SLCopyKLV(dst, store, src);
+}
+
+s32 SLADecode::KLVDataToBuffer(const KLVData *klv, u8* buf, u16 maxLen)
+{
+   u32 len = WriteKlvFrame(klv, NULL, buf, maxLen);
+   return len ? (s32)len : -1;
+}
+
+s32 SLADecode::ExtractKLV(const char *tsFile, const char *outFile, bool json)
+{
+   FILE *out = fopen(outFile, "wb");
+   if(!out)
+     return -1;
+   SLAKlvExtractStats stats;
+   SLStatus rv = SLAKlvExtract(tsFile, out, json ? SLA_KLV_TEXT_JSON : SLA_KLV_TEXT_CSV, 0, &stats);
+   fclose(out);
+   return rv == SLA_SUCCESS ? (s32)stats.sets : -1;
+}
+
@@ -10,6 +10,9 @@
 #include "SLAImage.h"
 #include "SLAHal.h"
 #include "SLAKlvDecode.h"
+#include "SLAKlvHistory.h"
+#include "SLAKeyIndex.h"
+#include "SLADeinterlace.h"
 #include "SLAUdpReceive.h"
 #include "SLARtspClient.h"
 
@@ -27,18 +30,32 @@ extern "C" {
 #include <libswscale/swscale.h>
 #include <libavdevice/avdevice.h>
 #include <libavutil/avutil.h>
+#include <libavutil/pixdesc.h>
 }
 
 #define MAX_KLV_BUFFER_LENGTH (2048)          //!< H264 only. KLV data size.
-#define FFMPEG_MAX_HEIGHT 1080
-#define FFMPEG_MAX_WIDTH  1920
+#define FFMPEG_MAX_HEIGHT 2160 // Limit for upsampled frames (4K)
+#define FFMPEG_MAX_WIDTH  4096
 
 typedef enum {
   IMAGE_NOT_IN_USE = 0,
   IMAGE_IN_USE     = 1
 } IMAGE_USE;
 
-#define N_IMAGE_BUFS 1 // NOTE:  Has to be 1 currently for stabtrack to work on PC
+#define N_IMAGE_BUFS 4 // Output frames in flight: 1 being converted, 1 latest, the rest held by the application
+
+// One decoded/converted output frame.  refCount counts the decoder's hold on the
+// latest frame plus every outstanding Get/AddRef; the buffer is only reused at 0.
+typedef struct {
+  u8 *buffer;
+  s32 bufferSize;      // bytes allocated, grown to fit the decoded frame size
+  AVFrame *pFrameOut;
+  SLAImage image;
+  s32 refCount;
+  u64 arrivalTime;     // usec the first packet of the frame was received
+  u64 readyTime;       // usec the conversion finished
+  s64 pts;             // usec presentation time, AV_NOPTS_VALUE if unknown
+} FFImageBuf;
 
 typedef enum {
   INPUT_FILE,             //!< From a file/directory source
@@ -51,6 +68,7 @@ typedef struct {
   SLA_Sem camSemaphore;
   bool isInit;
   bool skipOpen;
+  volatile bool fastOpen; // known MPEG-TS input: no format probe, codec from the PMT
   char fName[100];
   INPUT_TYPE inputType;
   s32 nLoop;
@@ -74,7 +92,40 @@ typedef struct {
   SLAUdpVideoProtocol lastStreamType;
   u8 cFrameData[MAX_COMPRESSED_BUFFER_SIZE];
   int skippedFrame;       // frame decode skip due to packet loss error
+  bool draining;          // flushing frames held by the decoder, see TASK_drain
+  int drainNext;          // FFSTATE to continue with once drained
   int skipDisplay;        // Should skip display of frame to save processing time
+  volatile s32 decodeMode;  // SLA_DECODE_ALL, SLA_DECODE_REFERENCE_ONLY, SLA_DECODE_KEYFRAMES_ONLY
+  volatile u32 previewSize;  // Preview tile height<<16 | width, one store so the two always match, 0 for full resolution
+  u64 decodeTime;         // usec spent in decode and conversion since last stats update
+  volatile s32 corruptPolicy;  // SLA_CORRUPT_DELIVER, SLA_CORRUPT_FREEZE, SLA_CORRUPT_WAIT_KEYFRAME
+  bool streamDamaged;     // data was lost since the last clean key frame
+  bool frameCorrupt;      // the decoder reported errors in the current frame
+
+  // Per-frame latency, see SLA_LATENCY_STAGES
+  SLALatencyHist latency[SLA_LATENCY_STAGES];
+  u64 pktArrival;         // usec the current compressed frame started arriving
+  u64 pktDemux;           // usec the current compressed frame was demuxed
+  u64 frameArrival;       // pktArrival of the decoded frame, carried through reordering
+  u64 decodeEnd;          // usec the decoded frame came out of the decoder
+
+  // Conversion quality, see FFConvertFlags
+  volatile s32 convertQuality;  // SLA_CONVERT_FAST ... SLA_CONVERT_ADAPTIVE
+  s32 convertLevel;       // adaptive: index into convertLevels
+  s32 pressureCount, reliefCount, convertSkipRun;
+  u64 frameDecode;        // usec the decode call for the current frame took
+  u64 convertCost;        // usec of the last conversion
+  u64 framePeriod;        // usec between input frames, 0 until known
+  u64 lastPktArrival;
+  s64 frameLate;          // file: usec the current frame is past its due time
+
+  // Deinterlacing, see FFDeinterlaceScale
+  volatile s32 deinterlace;   // SLA_DEINTERLACE_OFF, _BOB, _MOTION
+  u8 *diBuf;              // one band of deinterlaced lines for each plane, then the previous frame
+  u8 *diBand[3], *diPrev[3];
+  int diStride[3];
+  s32 diHigh, diWide, diFormat;
+  bool diPrevValid;
 
   // Timeout management
   u32 timeExpired;
@@ -83,11 +134,44 @@ typedef struct {
   FILE *dumpFile;
   
   //file support
-  int isPaused;
-
-  AVFrame *pFrame, *pFrameOut;
+  volatile int isPaused;
+  volatile s32 stepFrames;  // frames still to show while paused (StepFrame)
+  u64 paceTime;           // usec time the decoded frame is due, 0 for now
+
+  // Presentation clock: frame with pts clockPts (usec) is due at clockTime
+  volatile double playSpeed;  // 1.0 for real time, 0 for as fast as possible
+  volatile bool clockValid;   // false to re-anchor on the next frame
+  s64 clockPts, lastPts;
+  u64 clockTime;
+  bool frameScheduled;    // the decoded frame's pts is in lastPts, it is held until due
+  bool lastDropped;       // previous frame was dropped for lateness
+  bool dropFrame;         // drop the current frame: too late, or before the seek target
+  s64 latenessSum;
+  u32 latenessCount;
+
+  // Key frame index of the file for seeking, built by ffIndexTask or read from the sidecar
+  SLAKeyIndex *keyIndex;               // owned by ffmpegTask
+  SLAKeyIndex * volatile newKeyIndex;  // handed over by ffIndexTask
+  volatile bool indexing;              // ffIndexTask is running
+  bool indexStarted;                   // indexDoneSem will be (or was) posted
+  SLA_Sem indexDoneSem;
+  char indexName[100];
+  s64 seekTarget;         // usec pts to decode forward to after a seek, AV_NOPTS_VALUE if none
+  s32 seekSkipFrames;     // frames to decode forward after a frame number seek
+  s32 playFrame;          // frame number of the next decoded frame
+  volatile s32 shownFrame;  // frame number of the last frame shown
+  SLA_Sem wakeSem;        // posted with every control command to wake the task loop
+  volatile bool parked;   // idle in a decoder pool, see Park
+  bool parkAcked;         // parkSem posted for the current Park
+  SLA_Sem parkSem;
+
+  AVFrame *pFrame;
   SwsContext *img_convert_ctx;
-  u8 *buffer, *bufferOut;
+
+  // Output frame pool
+  FFImageBuf imageBufs[N_IMAGE_BUFS];
+  s32 latestImage;     // index of most recently published frame, -1 if none
+  SLA_Sem poolSem;     // protects refCount/latestImage
 
   u32 done;
   u32 taskDone;
@@ -98,10 +182,19 @@ typedef struct {
 
   s32 noRelease;       // passed in flag -- not using release to indicate that image has been consumed.
   PixelFormat inputFormat;
-  SLAImage imageOut;
   void *callBackContext;
   SLCaptureCallback callBack;
 
+  // Optional capture callback thread with a one-frame "latest frame wins" mailbox
+  bool asyncCallBack;       // changed with poolSem held, see SetAsyncCallBack
+  SLA_Task dispatchTask;
+  volatile bool dispatchStop;  // ends the dispatch task without ending the decoder
+  SLA_Sem dispatchSem;      // posted when the mailbox is filled
+  SLA_Sem dispatchDoneSem;  // posted when dispatch task exits
+  bool dispatchPending;     // mailbox holds a frame, protected by poolSem
+  s32 dispatchImage;        // imageBufs index, -1 for a blank (timeout/EOF) callback
+  u32 dispatchFlags;        // capFlags for the callback
+
   SLKLVCallback klvCallBack;
 
   // All KLV data ever received
@@ -110,6 +203,18 @@ typedef struct {
   // KLV data received this frame (non-received data elements marked invalid)
   KLVData klvRecent;
 
+  // Strings and VMTI targets of klv and klvRecent
+  KLVStore klvStore;
+  KLVStore klvRecentStore;
+
+  // Local sets of the KLV stream, which may be split across packets or several to a packet
+  KLVParser klvParser;
+
+  // Geo items of klv after every KLV packet, for GetKlvAt
+  SLAKlvHistory klvHistory;
+  KLVGeoCache klvGeo;     // converted once per change of klv's geo items
+  s64 framePts;           // usec pts of the newest decoded frame, AV_NOPTS_VALUE if none
+
   SLStatsCallback statsCallBack;
   void *statsContext;
   CapStats stats;
@@ -145,6 +250,7 @@ typedef enum {
   TASK_READ_FRAME_FINISHED,
   TASK_TIMEOUT,
   TASK_LOOP,
+  TASK_DRAIN,
   TASK_EOF
 } FFSTATE;
 
@@ -160,13 +266,41 @@ static char ffstateName[][80] = {
   "TASK_REOPEN2",
   "TASK_READ_FRAME_FINISHED",
   "TASK_TIMEOUT",
+  "TASK_LOOP",
+  "TASK_DRAIN",
   "TASK_EOF"
 };
 
 enum {
-  READ_FRAME_TIMEOUT = 500000   // 1/2 second timeout
+  READ_FRAME_TIMEOUT = 500000,  // 1/2 second timeout
+  FILE_FRAME_PERIOD = 25000,    // usec between frames when the file has no timestamps
+  PTS_JUMP_MAX = 5000000,       // usec timestamp jump treated as a discontinuity
+  LATE_DROP = 40000,            // usec late before a frame is dropped instead of shown
+  LATE_RESYNC = 1000000,        // usec late before the clock gives up and re-anchors
+
+  // Adaptive conversion quality
+  ADAPT_LATE = 10000,           // usec late counted as a missed deadline
+  ADAPT_SKIP_BACKLOG = 2,       // queued frames before conversion is skipped
+  ADAPT_SKIP_MAX = 3,           // consecutive skipped conversions, so the display keeps moving
+  ADAPT_DOWN_FRAMES = 3,        // frames under pressure before stepping down
+  ADAPT_UP_FRAMES = 60,         // frames with headroom before stepping up
+
+  DEINTERLACE_BAND = 16,        // luma lines deinterlaced per conversion slice
+  DEINTERLACE_THRESHOLD = 12    // largest pixel change since the previous frame treated as still
 };
 
+// Adaptive conversion levels, cheapest first
+static const struct {
+  s32 quality;
+  int swsFlags;
+} convertLevels[] = {
+  { SLA_CONVERT_POINT,    SWS_POINT },
+  { SLA_CONVERT_FAST,     SWS_FAST_BILINEAR },
+  { SLA_CONVERT_BILINEAR, SWS_BILINEAR },
+  { SLA_CONVERT_BICUBIC,  SWS_BICUBIC }
+};
+#define N_CONVERT_LEVELS (sizeof(convertLevels)/sizeof(convertLevels[0]))
+
 // Command Types
 typedef enum {
   FF_CONTROL_NAME,
@@ -287,7 +421,14 @@ static FFSTATE TASK_find_input_format(FFCameraData *cam)
     av_dict_set(&cam->ioptions, "fflags", "igndts", 0);
 
     cam->fmt = NULL;
-    if(cam->inputType == INPUT_DEVICE)
+    if(cam->fastOpen && cam->inputType != INPUT_DEVICE) {
+      // SLA streams and recordings are MPEG-TS: skip format probing, and only
+      // read far enough for the PAT/PMT.  The PMT stream types give the codecs.
+      cam->fmt = av_find_input_format("mpegts");
+      av_dict_set(&cam->ioptions, "probesize", "500000", 0);
+      av_dict_set(&cam->ioptions, "analyzeduration", "0", 0);
+    }
+    else if(cam->inputType == INPUT_DEVICE)
     {
       // To get a list of devices, run from dos:  "ffmpeg -list_devices true -f dshow -i dummy"
       // Add the name of your video input device to the list here
@@ -346,13 +487,86 @@ static FFSTATE TASK_open_input(FFCameraData *cam)
   return TASK_FIND_STREAM_INFO;
 }
 
+static int ffIndexTask(void *pCamera)
+{
+  FFCameraData *cam = (FFCameraData*)pCamera;
+
+  SLAKeyIndex *index = SLAKeyIndexBuild(cam->indexName, &cam->done);
+  cam->newKeyIndex = index;
+  cam->indexing = false;
+
+  SLASemPost(cam->indexDoneSem);
+  return 0;
+}
+
+// Take over an index finished by ffIndexTask
+static void FFAdoptKeyIndex(FFCameraData *cam)
+{
+  SLAKeyIndex *index = cam->newKeyIndex;
+  if(index) {
+    cam->newKeyIndex = NULL;
+    SLAKeyIndexFree(cam->keyIndex);
+    cam->keyIndex = index;
+  }
+}
+
+static bool FFHaveKeyIndex(FFCameraData *cam)
+{
+  FFAdoptKeyIndex(cam);
+  return cam->keyIndex && !strcmp(cam->keyIndex->fName, cam->fName);
+}
+
+// Load the sidecar index, or index the file in the background.  Seeks use
+// av_seek_frame until the index is ready.
+static void FFStartKeyIndex(FFCameraData *cam)
+{
+  if(FFHaveKeyIndex(cam) || cam->indexing)
+    return;
+
+  s64 fileSize = cam->pFormatCtx->pb ? avio_size(cam->pFormatCtx->pb) : -1;
+  if(fileSize<=0)
+    return;   // Not a seekable file
+
+  SLAKeyIndex *index = SLAKeyIndexLoad(cam->fName, fileSize);
+  if(index) {
+    SLAKeyIndexFree(cam->keyIndex);
+    cam->keyIndex = index;
+    return;
+  }
+
+  // Collect the previous index task's exit
+  if(cam->indexStarted)
+    SLASemPend(cam->indexDoneSem, SEM_FOREVER);
+
+  strncpy(cam->indexName, cam->fName, sizeof(cam->indexName));
+  cam->indexing = true;
+  cam->indexStarted = true;
+  if(!SLACreateThread(ffIndexTask, 8*SL_DEFAULT_STACK_SIZE, "ffIndexTask", (void*)cam, SL_PRI_3)) {
+    cam->indexing = false;
+    cam->indexStarted = false;
+  }
+}
+
 static FFSTATE TASK_find_stream_info(FFCameraData *cam)
 {
   int rv;
+  bool probe = true;
+
+  // With fast open, trust the codec the demuxer got from the PMT; frame size and
+  // pixel format come from the in-band SPS/PPS once the first key frame decodes.
+  if(cam->fastOpen) {
+    for(u32 i=0; i<cam->pFormatCtx->nb_streams; i++) {
+      AVCodecContext *c = cam->pFormatCtx->streams[i]->codec;
+      if(c->codec_type==AVMEDIA_TYPE_VIDEO && c->codec_id!=AV_CODEC_ID_NONE)
+        probe = false;
+    }
+  }
 
-  rv = avformat_find_stream_info(cam->pFormatCtx, NULL);
-  if(rv<0) {
-    return TASK_ERROR; // Couldn't find stream information
+  if(probe) {
+    rv = avformat_find_stream_info(cam->pFormatCtx, NULL);
+    if(rv<0) {
+      return TASK_ERROR; // Couldn't find stream information
+    }
   }
 
   s32 i;
@@ -381,9 +595,61 @@ static FFSTATE TASK_find_stream_info(FFCameraData *cam)
     printf("No video stream found\n");
     return TASK_ERROR; // Didn't find a video stream
   }
+
+  if(cam->inputType == INPUT_FILE)
+    FFStartKeyIndex(cam);
+  cam->playFrame = 0;
+  cam->seekTarget = AV_NOPTS_VALUE;
+  cam->seekSkipFrames = 0;
   return TASK_OPEN2;
 }
 
+// Start the CapStats and latency histograms over, for a decoder rebound to a new stream.
+// The quality and scale in use carry over, they are settings rather than counts.
+static void FFResetStats(FFCameraData *cam)
+{
+  s32 quality = cam->stats.ConvertQuality;
+  u32 scale = cam->stats.DecodeScale;
+  SLAMemset(&cam->stats, 0, sizeof(CapStats));
+  cam->stats.MinFrameBytes = 10000000;
+  cam->stats.ConvertQuality = quality;
+  cam->stats.DecodeScale = scale;
+  for(s32 i=0; i<SLA_LATENCY_STAGES; i++)
+    SLALatencyHistClear(&cam->latency[i]);
+  cam->frameCount = cam->byteCount = cam->videoByteCount = cam->klvByteCount = 0;
+  cam->decodeTime = 0;
+  cam->latenessSum = 0;
+  cam->latenessCount = 0;
+  SLAGetMHzTime(&cam->tic0);
+}
+
+// Preview tile size, 0,0 when preview is off
+static void FFPreviewSize(FFCameraData *cam, int *high, int *wide)
+{
+  u32 size = cam->previewSize;
+  *high = (int)(size >> 16);
+  *wide = (int)(size & 0xFFFF);
+}
+
+// Largest lowres of cam->pCodec that still covers the preview tile (MJPEG, MPEG-4...),
+// 0 while the stream size is not known.  coded_width/height stay at the full stream
+// size when lowres is in use.
+static int FFPreviewLowres(FFCameraData *cam)
+{
+  AVCodecContext *ctx = cam->pCodecCtx;
+  int high, wide;
+  FFPreviewSize(cam, &high, &wide);
+  if(!high || !cam->pCodec)
+    return 0;
+  int streamHigh = ctx->coded_height ? ctx->coded_height : ctx->height;
+  int streamWide = ctx->coded_width ? ctx->coded_width : ctx->width;
+  int maxLowres = av_codec_get_max_lowres(cam->pCodec);
+  int lowres = 0;
+  while(lowres < maxLowres && (streamWide>>(lowres+1)) >= wide && (streamHigh>>(lowres+1)) >= high)
+    lowres++;
+  return lowres;
+}
+
 static FFSTATE TASK_open2(FFCameraData *cam)
 {
   int bypassCodecOpen = 0;
@@ -393,8 +659,17 @@ static FFSTATE TASK_open2(FFCameraData *cam)
   cam->stats.MinFrameBytes = 10000000;
   cam->stats.KeyFrames = 0;
   cam->stats.IFrames = cam->stats.BFrames = cam->stats.PFrames = cam->stats.OtherFrames = 0;
+  cam->stats.DispatchOverwrites = 0;
+  cam->stats.DiscardedFrames = 0;
 
   if(cam->inputType == INPUT_NETWORK){
+    // Stream type changed, old decoder has been drained
+    if(cam->pCodecCtx) {
+      avcodec_close(cam->pCodecCtx);
+      av_free(cam->pCodecCtx);
+      cam->pCodecCtx = NULL;
+    }
+
     switch(cam->lastStreamType) {
       case SLA_UDP_VIDEO_PROTOCOL_MPEG2:
         cam->pCodec = avcodec_find_decoder(AV_CODEC_ID_MPEG2VIDEO);
@@ -439,6 +714,16 @@ static FFSTATE TASK_open2(FFCameraData *cam)
       return TASK_ERROR; // Codec not found
     }
 
+    // Files can afford the extra frames of latency that frame threading adds,
+    // they are drained at the end (TASK_drain)
+    if(cam->inputType == INPUT_FILE) {
+      cam->pCodecCtx->thread_count = 0;
+      cam->pCodecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+
+    // Files know their size here, network streams at their first frame, see FFApplyDecodeSettings
+    av_codec_set_lowres(cam->pCodecCtx, FFPreviewLowres(cam));
+
     // Open codec
     av_dict_set(&cam->ioptions, "flags", "low_delay", 0);
     int rv;
@@ -456,47 +741,25 @@ static FFSTATE TASK_open2(FFCameraData *cam)
   }
 
   // Allocate video frame (raw frame)
-  cam->pFrame=av_frame_alloc();
-
-  // Allocate an AVFrame structure (converted & scaled to YUV)
-  cam->pFrameOut=av_frame_alloc();
-  if(cam->pFrameOut==NULL)
+  if(!cam->pFrame)
+    cam->pFrame=av_frame_alloc();
+  if(cam->pFrame==NULL)
     return TASK_ERROR;
 
-  int numBytesIn, numBytesOut;
-
   cam->ffOutType = SLAImageTypeToFFmpeg(cam->slOutType);
   // TODO: is there a way to know "best" input format for a codec?
   cam->ffInType = PIX_FMT_YUV420P;
   cam->slInType = SLA_IMAGE_YUV_420;
 
 
-  // Allocate largest image type so buffer only needs to be resized
-  // if dimensions change: don't have to worry about type
-  numBytesIn=avpicture_get_size(PIX_FMT_BGRA, FFMPEG_MAX_WIDTH, FFMPEG_MAX_HEIGHT);
-  numBytesOut=avpicture_get_size(PIX_FMT_BGRA, FFMPEG_MAX_WIDTH, FFMPEG_MAX_HEIGHT);
-  cam->buffer=(uint8_t *)av_malloc(numBytesIn*sizeof(uint8_t));
-  if(!cam->buffer)    return TASK_ERROR; // allocation failed
-  cam->bufferOut=(uint8_t *)av_malloc(numBytesOut*sizeof(uint8_t));
-  if(!cam->bufferOut)    return TASK_ERROR; // allocation failed
-
-  // Assign appropriate parts of buffer to image planes in pFrameRGB
-  // Note that pFrameRGB is an AVFrame, but AVFrame is a superset
-  // of AVPicture
-  //avpicture_fill((AVPicture *)cam->pFrame, cam->buffer, cam->ffInType,
-  //  cam->pCodecCtx->width, cam->pCodecCtx->height);
-  //avpicture_fill((AVPicture *)cam->pFrameOut, cam->bufferOut, cam->ffOutType,
-  //  cam->pCodecCtx->width, cam->pCodecCtx->height);
-  avpicture_fill((AVPicture *)cam->pFrame, cam->buffer, cam->ffInType,
-    FFMPEG_MAX_WIDTH, FFMPEG_MAX_HEIGHT);
-  avpicture_fill((AVPicture *)cam->pFrameOut, cam->bufferOut, cam->ffOutType,
-    FFMPEG_MAX_WIDTH, FFMPEG_MAX_HEIGHT);
-  if(cam->pFrameOut->data[0])
-    SLAMemset(cam->pFrameOut->data[0], 128, cam->pFrameOut->linesize[0]);
-  if(cam->pFrameOut->data[1])
-    SLAMemset(cam->pFrameOut->data[1], 128, cam->pFrameOut->linesize[1]);
-  if(cam->pFrameOut->data[2])
-    SLAMemset(cam->pFrameOut->data[2], 128, cam->pFrameOut->linesize[2]);
+  // Output buffers are sized from the first decoded frame in TASK_read_frame_finished
+  for(int i=0; i<N_IMAGE_BUFS; i++) {
+    FFImageBuf *ib = &cam->imageBufs[i];
+    if(!ib->pFrameOut) {
+      ib->pFrameOut = av_frame_alloc();
+      if(!ib->pFrameOut)  return TASK_ERROR;
+    }
+  }
 
   // Initialize conversion context
   cam->img_convert_ctx = NULL;
@@ -546,6 +809,269 @@ static FFSTATE TASK_read_frame_buffered(FFCameraData *cam)
     return TASK_READ_FRAME;
 }
 
+// Compressed frame classes for decode mode dropping
+enum {
+  FF_PKT_UNKNOWN = -1,
+  FF_PKT_NONREF = 0,
+  FF_PKT_REF,
+  FF_PKT_KEY
+};
+
+// Read unsigned Exp-Golomb code, good enough for the first few slice header fields
+static u32 FFReadUE(const u8 *buf, s32 len, s32 *bit)
+{
+  s32 zeros = 0;
+  while(*bit < len*8 && !((buf[*bit>>3] >> (7 - (*bit&7))) & 1) && zeros<31) {
+    zeros++;
+    (*bit)++;
+  }
+  (*bit)++;
+  u32 val = 0;
+  for(s32 i=0; i<zeros && *bit < len*8; i++, (*bit)++)
+    val = (val<<1) | ((buf[*bit>>3] >> (7 - (*bit&7))) & 1);
+  return (1u<<zeros) - 1 + val;
+}
+
+// Classify an elementary stream frame from its picture/slice header without decoding
+static s32 FFClassifyPacket(enum AVCodecID codecId, const u8 *buf, s32 len)
+{
+  if(codecId==AV_CODEC_ID_MJPEG)
+    return FF_PKT_KEY;
+
+  // Only Annex B start codes are understood (not length-prefixed mp4 samples)
+  if(len<4 || buf[0]!=0 || buf[1]!=0 || (buf[2]!=1 && (buf[2]!=0 || buf[3]!=1)))
+    return FF_PKT_UNKNOWN;
+
+  for(s32 i=0; i+4<len; i++) {
+    if(buf[i]!=0 || buf[i+1]!=0 || buf[i+2]!=1)
+      continue;
+    const u8 *p = buf + i + 3;
+    s32 n = len - i - 3;
+
+    switch(codecId) {
+      case AV_CODEC_ID_H264: {
+        u8 nalType = p[0] & 0x1F;
+        if(nalType==5)
+          return FF_PKT_KEY;
+        if(nalType==1 && n>1) {
+          // first_mb_in_slice, slice_type
+          s32 bit = 0;
+          FFReadUE(p+1, n-1, &bit);
+          u32 sliceType = FFReadUE(p+1, n-1, &bit) % 5;
+          if(sliceType==2 || sliceType==4)
+            return FF_PKT_KEY;
+          return (p[0] & 0x60) ? FF_PKT_REF : FF_PKT_NONREF;
+        }
+        break;
+      }
+      case AV_CODEC_ID_MPEG2VIDEO:
+        // picture_start_code: temporal_reference(10) picture_coding_type(3)
+        if(p[0]==0x00 && n>2) {
+          u8 type = (p[2]>>3) & 7;
+          return type==1 ? FF_PKT_KEY : type==2 ? FF_PKT_REF : FF_PKT_NONREF;
+        }
+        break;
+      case AV_CODEC_ID_MPEG4:
+        // vop_start_code: vop_coding_type(2)
+        if(p[0]==0xB6 && n>1) {
+          u8 type = p[1]>>6;
+          return type==0 ? FF_PKT_KEY : type==2 ? FF_PKT_NONREF : FF_PKT_REF;
+        }
+        break;
+      default:
+        return FF_PKT_UNKNOWN;
+    }
+  }
+  return FF_PKT_UNKNOWN;
+}
+
+// FFClassifyPacket of cam->packet, with the demuxer's key flag for files
+static s32 FFPacketClass(FFCameraData *cam)
+{
+  s32 cls = FFClassifyPacket(cam->pCodecCtx->codec_id, cam->packet.data, cam->packet.size);
+  if(cls==FF_PKT_UNKNOWN && cam->inputType != INPUT_NETWORK && (cam->packet.flags & AV_PKT_FLAG_KEY))
+    cls = FF_PKT_KEY;
+  return cls;
+}
+
+// Demux-level dropping for the decode mode, the decoder skip settings catch anything missed here
+static bool FFDiscardPacket(FFCameraData *cam)
+{
+  s32 mode = cam->decodeMode;
+  if(mode==SLA_DECODE_ALL || !cam->pCodecCtx || !cam->packet.data)
+    return false;
+
+  s32 cls = FFPacketClass(cam);
+
+  if(mode==SLA_DECODE_KEYFRAMES_ONLY)
+    return cls==FF_PKT_REF || cls==FF_PKT_NONREF;
+  return cls==FF_PKT_NONREF;
+}
+
+// Pick the sws flags for the current frame.  In adaptive mode this steps down
+// a level while frames queue up or miss their deadline, steps back up after a
+// run of frames with headroom, and sets skip when newer frames will replace
+// this one anyway.
+static int FFConvertFlags(FFCameraData *cam, s32 framesQueued, bool *skip)
+{
+  *skip = false;
+  s32 quality = cam->convertQuality;
+  if(quality != SLA_CONVERT_ADAPTIVE) {
+    for(u32 i=0; i<N_CONVERT_LEVELS; i++)
+      if(convertLevels[i].quality == quality)
+        cam->convertLevel = i;
+    cam->stats.ConvertQuality = quality;
+    return convertLevels[cam->convertLevel].swsFlags;
+  }
+
+  // Decoding and converting this frame takes most of the time until the next one
+  u64 work = cam->frameDecode + cam->convertCost;
+  bool overBudget = cam->framePeriod && work > cam->framePeriod*4/5;
+  bool pressure = framesQueued > 0 || cam->frameLate > ADAPT_LATE || overBudget;
+  bool headroom = !pressure && cam->framePeriod && work < cam->framePeriod/2;
+
+  if(pressure) {
+    cam->reliefCount = 0;
+    if(++cam->pressureCount >= ADAPT_DOWN_FRAMES && cam->convertLevel > 0) {
+      cam->convertLevel--;
+      cam->pressureCount = 0;
+    }
+  } else {
+    cam->pressureCount = 0;
+    if(headroom && ++cam->reliefCount >= ADAPT_UP_FRAMES && cam->convertLevel < (s32)N_CONVERT_LEVELS-1) {
+      cam->convertLevel++;
+      cam->reliefCount = 0;
+    } else if(!headroom) {
+      cam->reliefCount = 0;
+    }
+  }
+
+  if(framesQueued >= ADAPT_SKIP_BACKLOG && cam->convertSkipRun < ADAPT_SKIP_MAX) {
+    cam->convertSkipRun++;
+    *skip = true;
+  } else {
+    cam->convertSkipRun = 0;
+  }
+
+  cam->stats.ConvertQuality = convertLevels[cam->convertLevel].quality;
+  return convertLevels[cam->convertLevel].swsFlags;
+}
+
+// Update the integrity of the stream with a newly decoded frame.
+// A clean key frame ends the damage from earlier losses.
+static void FFCheckIntegrity(FFCameraData *cam)
+{
+  cam->frameCorrupt = (cam->pFrame->flags & AV_FRAME_FLAG_CORRUPT)!=0
+                   || av_frame_get_decode_error_flags(cam->pFrame)!=0;
+  if(cam->frameCorrupt)
+    cam->streamDamaged = true;
+  else if(cam->pFrame->key_frame)
+    cam->streamDamaged = false;
+}
+
+// Decoders with CODEC_CAP_DELAY (B frames, frame threads) hold frames back.
+// Before the decoder goes away or the input ends, feed it empty packets until
+// it has returned all of them, then continue with next.
+static FFSTATE FFStartDrain(FFCameraData *cam, FFSTATE next)
+{
+  if(!cam->pCodecCtx || !avcodec_is_open(cam->pCodecCtx) || !cam->pFrame
+     || !cam->pCodec || !(cam->pCodec->capabilities & CODEC_CAP_DELAY))
+    return next;
+  cam->draining = true;
+  cam->drainNext = next;
+  return TASK_DRAIN;
+}
+
+static FFSTATE TASK_drain(FFCameraData *cam)
+{
+  int frameFinished = 0;
+
+  av_init_packet(&cam->packet);
+  cam->packet.data = NULL;
+  cam->packet.size = 0;
+
+  u64 t0, t1;
+  SLAGetMHzTime(&t0);
+  int rv = avcodec_decode_video2(cam->pCodecCtx, cam->pFrame, &frameFinished, &cam->packet);
+  SLAGetMHzTime(&t1);
+  cam->decodeTime += t1 - t0;
+
+  // TASK_read_frame_finished comes back here
+  if(rv>=0 && frameFinished) {
+    cam->frameArrival = cam->pFrame->reordered_opaque;
+    cam->decodeEnd = t1;
+    FFCheckIntegrity(cam);
+    cam->frameScheduled = false;
+    return TASK_READ_FRAME_FINISHED;
+  }
+
+  cam->draining = false;
+  avcodec_flush_buffers(cam->pCodecCtx);
+  return (FFSTATE)cam->drainNext;
+}
+
+// Stream timestamp to usec: 90 kHz for packets from the UDP demuxer, otherwise
+// the time base of the ffmpeg stream
+static s64 FFPtsToUsec(FFCameraData *cam, s64 pts, s32 streamIndex)
+{
+  AVRational tbq = {1, AV_TIME_BASE};
+  if(pts == AV_NOPTS_VALUE)
+    return AV_NOPTS_VALUE;
+  if(cam->inputType != INPUT_NETWORK && cam->pFormatCtx &&
+     streamIndex>=0 && streamIndex<(s32)cam->pFormatCtx->nb_streams)
+    return av_rescale_q(pts, cam->pFormatCtx->streams[streamIndex]->time_base, tbq);
+  AVRational tb90k = {1, 90000};
+  return av_rescale_q(pts, tb90k, tbq);
+}
+
+// Add the merged metadata to the history at the time of the KLV packet.
+// Asynchronous metadata has no PTS and goes with the newest frame.
+static void FFRecordKlv(FFCameraData *cam)
+{
+  s64 pts = FFPtsToUsec(cam, cam->packet.pts, cam->packet.stream_index);
+  if(pts == AV_NOPTS_VALUE)
+    pts = cam->framePts;
+  if(pts == AV_NOPTS_VALUE)
+    return;
+  KLVGeo geo = *SLKlvToGeoCached(&cam->klvGeo, &cam->klv);
+  geo.pts = pts;
+  SLAKlvHistoryRecord(&cam->klvHistory, &geo);
+}
+
+// Decode one local set into klvRecent, merge it into klv and pass it on
+static bool FFApplyKlv(FFCameraData *cam, const u8 *buf, u32 len, s32 offset)
+{
+  SLResetKLV(&cam->klvRecent);
+  if(!ReadKlvFrame(&cam->klvRecent, buf, (u16)SLMIN(len, 0xFFFF), offset))
+    return false;
+  SLCopyChangedKLV(&cam->klv, &cam->klvRecent);
+  FFRecordKlv(cam);
+  if(cam->klvCallBack){
+    cam->klvCallBack(&cam->klv, &cam->klvRecent, cam->callBackContext);
+  }
+  return true;
+}
+
+// Pass a packet of the KLV stream through the parser and apply every set it completes.
+// true if the packet held KLV, even if only the start of a set.
+static bool FFReadKlvStream(FFCameraData *cam, const u8 *buf, u32 len)
+{
+  bool klv = false;
+  // A set that lost a packet would only fail its checksum
+  if(cam->packet.flags & AV_PKT_FLAG_CORRUPT)
+    SLInitKLVParser(&cam->klvParser);
+  while(len) {
+    const u8 *set;
+    u32 setLen;
+    u32 n = SLParseKLV(&cam->klvParser, buf, len, &set, &setLen);
+    buf += n;
+    len -= n;
+    if(set && FFApplyKlv(cam, set, setLen, 0))
+      klv = true;
+  }
+  return klv || cam->klvParser.total || cam->klvParser.skip;
+}
+
 static s32 nFrames = 0;
 static FFSTATE TASK_read_frame(FFCameraData *cam)
 {
@@ -556,17 +1082,17 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
       SLStatus ret = SLADemuxNextFrame(cam->udpRx, &cam->compressedFrame, READ_FRAME_TIMEOUT/1000);
       if(ret == SLA_TIMEOUT)
         return TASK_TIMEOUT;
+      if(ret == SLA_NOP)
+        return TASK_READ_FRAME;   // Woken up for a control command
       if(ret == SLA_TERMINATE)
-        return TASK_EOF;
+        return FFStartDrain(cam, TASK_EOF);
       if(ret != SLA_SUCCESS)
         return TASK_ERROR;
       if(cam->compressedFrame.streamType != cam->lastStreamType && !SLAIsMetaDataProtocol(cam->compressedFrame.streamType)){
         cam->lastStreamType = cam->compressedFrame.streamType;
-        if(cam->pCodecCtx) {
-          avcodec_close(cam->pCodecCtx);
-          av_free(cam->pCodecCtx);
-        }
-        return TASK_OPEN2;
+        // Deliver what the old decoder holds, TASK_open2 replaces it.
+        // compressedFrame is kept for the new decoder.
+        return FFStartDrain(cam, TASK_OPEN2);
       }
     }
     if(!SLAIsMetaDataProtocol(cam->compressedFrame.streamType))
@@ -576,11 +1102,17 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
     av_init_packet(&cam->packet);
     if(cam->compressedFrame.missedPacket) {
       cam->packet.flags = AV_PKT_FLAG_CORRUPT;
+      cam->stats.CCErrors++;
+      cam->streamDamaged = true;
       SLATrace("*** corrupt frame\n");
     }
     cam->packet.data = cam->compressedFrame.buffer;
     cam->packet.size = cam->compressedFrame.len;
     cam->packet.pts = cam->compressedFrame.PTS;
+    cam->pktDemux = cam->compressedFrame.demuxTime;
+    cam->pktArrival = cam->compressedFrame.arrivalTime;
+    if(cam->pktArrival==0 || cam->pktArrival>cam->pktDemux)
+      cam->pktArrival = cam->pktDemux;
     cam->packet.stream_index = cam->compressedFrame.PID;
 
     // Get PIDs from demuxer
@@ -609,9 +1141,12 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
     if(rv==AVERROR_EXIT || cam->timeExpired)
       return TASK_TIMEOUT;
     if(rv==AVERROR_EOF)
-      return TASK_LOOP;
+      return FFStartDrain(cam, TASK_LOOP);
     if(rv<0)
       return TASK_ERROR;
+    // ffmpeg does not say when the packets arrived, start the clock here
+    SLAGetMHzTime(&cam->pktDemux);
+    cam->pktArrival = cam->pktDemux;
   }
 
   nFrames++;
@@ -623,6 +1158,15 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
     cam->videoByteCount += cam->packet.size;
     cam->stats.MaxFrameBytes = SLMAX(cam->stats.MaxFrameBytes, (u32)cam->packet.size);
     cam->stats.MinFrameBytes = SLMIN(cam->stats.MinFrameBytes, (u32)cam->packet.size);
+    if(cam->inputType == INPUT_NETWORK && cam->udpRx)
+      SLALatencyHistRecord(&cam->latency[SLA_LATENCY_RECEIVE], cam->pktDemux - cam->pktArrival);
+
+    if(FFDiscardPacket(cam)) {
+      cam->stats.DiscardedFrames++;
+      cam->compressedFrame.len = 0;
+      av_free_packet(&cam->packet);
+      return TASK_READ_FRAME;
+    }
 
     return TASK_DECODE_VIDEO2;
   } else {
@@ -630,21 +1174,17 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
     u8 *buf;
     buf = cam->packet.data;
     if(buf){
-      s32 rv;
-      SLAMemcpy(&cam->klvRecent, &KLVUnknown, sizeof(KLVData));
-      rv = ReadKlvFrame(&cam->klvRecent, buf, cam->packet.size, 0);
+      bool rv = false;
+      if(cam->packet.stream_index == cam->klvStream)
+        rv = FFReadKlvStream(cam, buf, cam->packet.size);
       if(!rv){
-        // If decode fails, try again with offset 5 -- this is to support
-        // file-based reading using ffmpeg demux which may return buffer that
-        // includes 5-byte mpeg2 header.
-        rv = ReadKlvFrame(&cam->klvRecent, buf, cam->packet.size, 5);
+        // Other streams only hold whole sets.  If decode fails, try again with
+        // offset 5 -- this is to support file-based reading using ffmpeg demux
+        // which may return buffer that includes 5-byte mpeg2 header.
+        rv = FFApplyKlv(cam, buf, cam->packet.size, 0) || FFApplyKlv(cam, buf, cam->packet.size, 5);
       }
       if(rv) {
         cam->klvByteCount += cam->packet.size;
-        SLCopyChangedKLV(&cam->klv, &cam->klvRecent);
-        if(cam->klvCallBack){
-          cam->klvCallBack(&cam->klv, &cam->klvRecent, cam->callBackContext);
-        }
       }
       else {
         // could be SightLine Applications private data
@@ -673,20 +1213,55 @@ static FFSTATE TASK_read_frame(FFCameraData *cam)
   }
 }
 
+// Jump to an indexed key frame, the caller sets up decoding forward from there
+static FFSTATE FFSeekKeyFrame(FFCameraData *cam, const SLAKeyFrame *kf)
+{
+  int rv = av_seek_frame(cam->pFormatCtx, -1, kf->pos, AVSEEK_FLAG_BYTE);
+  avcodec_flush_buffers(cam->pCodecCtx);
+  SLInitKLVParser(&cam->klvParser);
+  cam->playFrame = kf->frame;
+  if(rv==AVERROR_EXIT || cam->timeExpired)
+    return TASK_TIMEOUT;
+  if(rv<0)
+    return TASK_ERROR;
+  return TASK_READ_FRAME;
+}
+
 static FFSTATE TASK_seek_frame(FFCameraData *cam, double timeStamp)
 {
+  cam->clockValid = false;
+  // Frames held for the old position are dropped by the flush below
+  cam->draining = false;
+  cam->seekTarget = AV_NOPTS_VALUE;
+  cam->seekSkipFrames = 0;
+
   if(cam->inputType == INPUT_NETWORK){
 	  //what do we do if we seek a frame in with a network input.
 	  //dvr support.  one day	  
   }  else {
+    AVStream *st = cam->pFormatCtx->streams[cam->videoStream];
+    if(FFHaveKeyIndex(cam)) {
+      // Nearest preceding key frame, then decode forward to the exact time
+      AVRational tbq = {1, AV_TIME_BASE};
+      s64 start = st->start_time!=AV_NOPTS_VALUE ? av_rescale_q(st->start_time, st->time_base, tbq) : 0;
+      s64 target = start + (s64)(AV_TIME_BASE*timeStamp);
+      const SLAKeyFrame *kf = SLAKeyIndexFindPts(cam->keyIndex, target);
+      cam->seekTarget = target;
+      return FFSeekKeyFrame(cam, kf);
+    }
+
       double seconds = timeStamp;
       int64_t seekTarget = (int64_t) (AV_TIME_BASE * seconds);
       AVRational tbq = {1, AV_TIME_BASE};
       seekTarget = av_rescale_q(seekTarget, tbq,
                     cam->pFormatCtx->streams[cam->videoStream]->time_base);
       
-	 int rv = av_seek_frame(cam->pFormatCtx, cam->videoStream, cam->pFormatCtx->streams[cam->videoStream]->start_time + seekTarget, 0);
+      // start_time is unknown after a fast open
+      if(st->start_time != AV_NOPTS_VALUE)
+        seekTarget += st->start_time;
+	 int rv = av_seek_frame(cam->pFormatCtx, cam->videoStream, seekTarget, 0);
 	  avcodec_flush_buffers (cam->pCodecCtx); //is this doing what I expect it to.
+    SLInitKLVParser(&cam->klvParser);
     if(rv==AVERROR_EXIT || cam->timeExpired)
       return TASK_TIMEOUT;
     if(rv==AVERROR_EOF)
@@ -694,13 +1269,88 @@ static FFSTATE TASK_seek_frame(FFCameraData *cam, double timeStamp)
     if(rv<0)
       return TASK_ERROR;
 
-	//todo rg get the frame and decode the frame
+    // Frame number is a guess without the index
+    AVRational rate = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+    cam->playFrame = rate.den ? (s32)(timeStamp*rate.num/rate.den) : 0;
   }
   return TASK_READ_FRAME;
 }
 
+static FFSTATE TASK_seek_frame_number(FFCameraData *cam, s32 frame)
+{
+  if(cam->inputType != INPUT_FILE)
+    return TASK_READ_FRAME;
+
+  if(!FFHaveKeyIndex(cam)) {
+    // Without the index fall back to a timestamp seek
+    AVStream *st = cam->pFormatCtx->streams[cam->videoStream];
+    AVRational rate = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+    if(!rate.num)
+      return TASK_READ_FRAME;
+    return TASK_seek_frame(cam, (double)frame*rate.den/rate.num);
+  }
+
+  cam->clockValid = false;
+  cam->draining = false;
+  cam->seekTarget = AV_NOPTS_VALUE;
+
+  const SLAKeyFrame *kf = SLAKeyIndexFindFrame(cam->keyIndex, frame);
+  cam->seekSkipFrames = SLMAX(frame - kf->frame, 0);
+  return FFSeekKeyFrame(cam, kf);
+}
+
 void SLReadH264(u8 *nal, int len);
 
+// Push decode mode and preview settings into the codec context before each frame
+static bool FFApplyDecodeSettings(FFCameraData *cam)
+{
+  AVCodecContext *ctx = cam->pCodecCtx;
+  bool preview = cam->previewSize != 0;
+
+  // lowres is set when the codec is opened.  Changing it takes a reopen, which drops
+  // the reference frames (and with frame threads the frames still in the decoder),
+  // so it only happens on a key frame, where decoding can start over cleanly.
+  int lowres = FFPreviewLowres(cam);
+  int oldLowres = av_codec_get_lowres(ctx);
+  if(lowres != oldLowres && cam->packet.data && FFPacketClass(cam)==FF_PKT_KEY) {
+    avcodec_close(ctx);
+    av_codec_set_lowres(ctx, lowres);
+    if(avcodec_open2(ctx, cam->pCodec, NULL)<0) {
+      SLATrace("Decoder did not reopen at lowres %d, staying at %d\n", lowres, oldLowres);
+      av_codec_set_lowres(ctx, oldLowres);
+      if(avcodec_open2(ctx, cam->pCodec, NULL)<0)
+        return false;
+    }
+  }
+
+  switch(cam->decodeMode) {
+    case SLA_DECODE_KEYFRAMES_ONLY:
+      ctx->skip_frame = AVDISCARD_NONKEY;
+      ctx->skip_loop_filter = AVDISCARD_NONKEY;
+      break;
+    case SLA_DECODE_REFERENCE_ONLY:
+      ctx->skip_frame = AVDISCARD_NONREF;
+      ctx->skip_loop_filter = AVDISCARD_NONREF;
+      break;
+    default:
+      ctx->skip_frame = AVDISCARD_DEFAULT;
+      ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+      break;
+  }
+
+  // No lowres for H.264: trade exactness for speed instead.  Deblocking and the
+  // B frame IDCT are invisible once the frame is scaled down to a tile.
+  if(preview) {
+    ctx->skip_loop_filter = AVDISCARD_ALL;
+    ctx->skip_idct = AVDISCARD_BIDIR;
+    ctx->flags2 |= CODEC_FLAG2_FAST;
+  } else {
+    ctx->skip_idct = AVDISCARD_DEFAULT;
+    ctx->flags2 &= ~CODEC_FLAG2_FAST;
+  }
+  return true;
+}
+
 static FFSTATE TASK_decode_video2(FFCameraData *cam)
 {
   int rv = 0, frameFinished = 0;
@@ -714,7 +1364,29 @@ static FFSTATE TASK_decode_video2(FFCameraData *cam)
     {
       //SLReadH264(cam->packet.data, cam->packet.size);
 
+      // Decode mode and preview can change at any time, and the context is recreated on stream changes
+      if(!FFApplyDecodeSettings(cam))
+        return TASK_ERROR;
+
+      u64 t0, t1;
+      SLAGetMHzTime(&t0);
+      cam->pCodecCtx->reordered_opaque = cam->pktArrival;
       rv = avcodec_decode_video2(cam->pCodecCtx, cam->pFrame, &frameFinished, &cam->packet);
+      SLAGetMHzTime(&t1);
+      cam->decodeTime += t1 - t0;
+      SLALatencyHistRecord(&cam->latency[SLA_LATENCY_QUEUE], t0>cam->pktDemux ? t0 - cam->pktDemux : 0);
+      SLALatencyHistRecord(&cam->latency[SLA_LATENCY_DECODE], t1 - t0);
+      cam->frameDecode = t1 - t0;
+      if(cam->inputType == INPUT_NETWORK && cam->pktArrival > cam->lastPktArrival) {
+        u64 period = cam->pktArrival - cam->lastPktArrival;
+        if(cam->lastPktArrival && period < 1000000)
+          cam->framePeriod = cam->framePeriod ? (7*cam->framePeriod + period)/8 : period;
+        cam->lastPktArrival = cam->pktArrival;
+      }
+      if(frameFinished) {
+        cam->frameArrival = cam->pFrame->reordered_opaque;
+        cam->decodeEnd = t1;
+      }
 #if 0
       if(rv<=0){
         char ebuf[1024];
@@ -728,6 +1400,11 @@ static FFSTATE TASK_decode_video2(FFCameraData *cam)
   }
   cam->compressedFrame.len = 0;
 
+  if(rv < 0) {
+    cam->stats.DecodeErrors++;
+    cam->streamDamaged = true;
+  }
+
   if(rv <= 0) {
     if(cam->inputType == INPUT_NETWORK) {
       return TASK_READ_FRAME;
@@ -760,6 +1437,10 @@ static FFSTATE TASK_decode_video2(FFCameraData *cam)
       default:
         cam->stats.OtherFrames++;
       }
+      // The skipped packet path shows the previous frame again
+      if(!cam->skippedFrame)
+        FFCheckIntegrity(cam);
+      cam->frameScheduled = false;
       return TASK_READ_FRAME_FINISHED;
     }
     else
@@ -821,6 +1502,244 @@ static void getFullSize(int *fullHigh, int *fullWide, int *ds, int high, int wid
   }
 }
 
+// Motion-adaptive deinterlacing needs 3 plane 8-bit YUV
+static bool FFCanDeinterlace(AVPixelFormat fmt)
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+  return desc && (desc->flags & AV_PIX_FMT_FLAG_PLANAR) && !(desc->flags & AV_PIX_FMT_FLAG_RGB)
+      && desc->nb_components==3 && desc->comp[0].depth_minus1==7;
+}
+
+// (Re)allocate the band and previous frame buffers for the decoded frame size
+static bool FFDeinterlaceAlloc(FFCameraData *cam, s32 high, s32 wide, AVPixelFormat fmt)
+{
+  if(cam->diBuf && cam->diHigh==high && cam->diWide==wide && cam->diFormat==fmt)
+    return true;
+
+  if(cam->diBuf)
+    av_free(cam->diBuf);
+  cam->diBuf = NULL;
+  cam->diPrevValid = false;
+
+  int cx, cy;
+  av_pix_fmt_get_chroma_sub_sample(fmt, &cx, &cy);
+  s32 bandBytes = 0, prevBytes = 0;
+  for(int p=0; p<3; p++) {
+    s32 w = p ? -((-wide) >> cx) : wide;
+    s32 h = p ? -((-high) >> cy) : high;
+    cam->diStride[p] = FFALIGN(w, 32);
+    bandBytes += cam->diStride[p]*DEINTERLACE_BAND;
+    prevBytes += cam->diStride[p]*h;
+  }
+  cam->diBuf = (u8*)av_malloc(bandBytes + prevBytes);
+  if(!cam->diBuf)
+    return false;
+
+  u8 *band = cam->diBuf;
+  u8 *prev = cam->diBuf + bandBytes;
+  for(int p=0; p<3; p++) {
+    s32 h = p ? -((-high) >> cy) : high;
+    cam->diBand[p] = band;
+    cam->diPrev[p] = prev;
+    band += cam->diStride[p]*DEINTERLACE_BAND;
+    prev += cam->diStride[p]*h;
+  }
+  cam->diHigh = high;
+  cam->diWide = wide;
+  cam->diFormat = fmt;
+  return true;
+}
+
+// Motion-adaptive deinterlace fused with the conversion: each band of lines is
+// deinterlaced into a small buffer and handed to sws_scale as a slice while it
+// is still in cache.  Even lines (top field) are kept, odd lines are rebuilt.
+static void FFDeinterlaceScale(FFCameraData *cam, u8 *const dst[], const int dstStride[])
+{
+  AVFrame *src = cam->pFrame;
+  s32 high = src->height, wide = src->width;
+  int cx, cy;
+  av_pix_fmt_get_chroma_sub_sample((AVPixelFormat)src->format, &cx, &cy);
+
+  for(s32 y0=0; y0<high; y0+=DEINTERLACE_BAND) {
+    s32 hb = SLMIN(DEINTERLACE_BAND, high - y0);
+    const u8 *band[3];
+
+    for(int p=0; p<3; p++) {
+      s32 w = p ? -((-wide) >> cx) : wide;
+      s32 h = p ? -((-high) >> cy) : high;
+      s32 ys = p ? y0 >> cy : y0;
+      s32 ye = p ? SLMIN(-((-(y0 + hb)) >> cy), h) : y0 + hb;
+      s32 ls = src->linesize[p];
+      s32 ps = cam->diStride[p];
+      band[p] = cam->diBand[p];
+
+      for(s32 y=ys; y<ye; y+=2) {
+        const u8 *s = src->data[p] + y*ls;
+        u8 *out = cam->diBand[p] + (y - ys)*cam->diStride[p];
+        u8 *prev = cam->diPrev[p] + y*ps;
+        SLAMemcpy(out, s, w);
+        if(y+1 < ye) {
+          const u8 *below = y+2 < h ? s + 2*ls : s;
+          SLADeinterlaceLine(out + cam->diStride[p], s, s + ls, below,
+                             cam->diPrevValid ? prev : NULL, cam->diPrevValid ? prev + ps : NULL,
+                             w, DEINTERLACE_THRESHOLD);
+          SLAMemcpy(prev + ps, s + ls, w);
+        }
+        SLAMemcpy(prev, s, w);
+      }
+    }
+    sws_scale(cam->img_convert_ctx, band, cam->diStride, y0, hb, dst, dstStride);
+  }
+  cam->diPrevValid = true;
+}
+
+// Find an output frame nobody holds.  When the application is using Release
+// the decoder waits for one to come back, otherwise the frame is dropped.
+// returns index into imageBufs, -1 if none is available
+static s32 FFAcquireImageBuf(FFCameraData *cam)
+{
+  s32 i, idx = -1;
+  while(!cam->done) {
+    SLASemPend(cam->poolSem, SEM_FOREVER);
+    for(i=0; i<N_IMAGE_BUFS && idx<0; i++) {
+      if(cam->imageBufs[i].refCount==0)
+        idx = i;
+    }
+    SLASemPost(cam->poolSem);
+    if(idx>=0 || cam->noRelease)
+      break;
+    SLASemPend(cam->processingSem, 200);
+  }
+  return idx;
+}
+
+// Make imageBufs[idx] the latest frame.  The decoder holds one reference on
+// the latest frame, which moves from the previous frame to this one.
+static void FFPublishImageBuf(FFCameraData *cam, s32 idx)
+{
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  if(cam->latestImage>=0 && cam->imageBufs[cam->latestImage].refCount>0)
+    cam->imageBufs[cam->latestImage].refCount--;
+  cam->imageBufs[idx].refCount++;
+  cam->latestImage = idx;
+  SLASemPost(cam->poolSem);
+}
+
+// Locate the pool entry an application image was handed out from
+// Must be called with poolSem held
+static s32 FFFindImageBuf(FFCameraData *cam, const SLAImage *image)
+{
+  for(s32 i=0; i<N_IMAGE_BUFS; i++) {
+    if(cam->imageBufs[i].buffer && image->y == cam->imageBufs[i].image.y)
+      return i;
+  }
+  return -1;
+}
+
+// Drop a reference taken by AddRef/Get/FFDispatch
+static void FFReleaseImageBuf(FFCameraData *cam, s32 idx)
+{
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  // Never drop the reference the decoder holds on the latest frame
+  s32 minCount = (idx == cam->latestImage) ? 1 : 0;
+  if(cam->imageBufs[idx].refCount > minCount)
+    cam->imageBufs[idx].refCount--;
+  SLASemPost(cam->poolSem);
+
+  // Decoder may be waiting for a free frame
+  SLASemPost(cam->processingSem);
+}
+
+// Callback is done with a converted frame
+static void FFRecordDelivered(FFCameraData *cam, s32 idx)
+{
+  u64 now;
+  SLAGetMHzTime(&now);
+  FFImageBuf *ib = &cam->imageBufs[idx];
+  SLALatencyHistRecord(&cam->latency[SLA_LATENCY_CALLBACK], now - ib->readyTime);
+  SLALatencyHistRecord(&cam->latency[SLA_LATENCY_TOTAL], now - ib->arrivalTime);
+}
+
+// Hand a frame (or a blank frame for idx<0) to the capture callback.  With the
+// dispatch task running, the frame replaces whatever is still waiting in the
+// mailbox so a slow callback never holds up decoding.
+static void FFDispatch(FFCameraData *cam, s32 idx, u32 capFlags)
+{
+  if(!cam->callBack)
+    return;
+
+  // asyncCallBack is checked with poolSem held, so once SetAsyncCallBack(false)
+  // has cleared it nothing more goes into the mailbox
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  if(!cam->asyncCallBack || !cam->dispatchTask) {
+    SLASemPost(cam->poolSem);
+    cam->callBack(idx>=0 ? &cam->imageBufs[idx].image : NULL, cam->callBackContext, capFlags);
+    if(idx>=0)
+      FFRecordDelivered(cam, idx);
+    return;
+  }
+
+  s32 skipped = -1;
+  if(cam->dispatchPending) {
+    // Consumer never saw the previous frame
+    cam->stats.DispatchOverwrites++;
+    skipped = cam->dispatchImage;
+  }
+  if(idx>=0)
+    cam->imageBufs[idx].refCount++;
+  cam->dispatchImage = idx;
+  cam->dispatchFlags = capFlags;
+  cam->dispatchPending = true;
+  SLASemPost(cam->poolSem);
+
+  // Given back as the dispatch task would have, which also wakes a decoder
+  // waiting in FFAcquireImageBuf
+  if(skipped>=0)
+    FFReleaseImageBuf(cam, skipped);
+
+  SLASemPost(cam->dispatchSem);
+}
+
+static int ffDispatchTask(void *pCamera)
+{
+  FFCameraData *cam = (FFCameraData*)pCamera;
+
+  while(!cam->done && !cam->dispatchStop) {
+    if(!SLASemPend(cam->dispatchSem, 100))
+      continue;
+
+    SLASemPend(cam->poolSem, SEM_FOREVER);
+    bool pending = cam->dispatchPending;
+    s32 idx = cam->dispatchImage;
+    u32 capFlags = cam->dispatchFlags;
+    cam->dispatchPending = false;
+    SLASemPost(cam->poolSem);
+
+    // Already consumed by an earlier wake-up
+    if(!pending)
+      continue;
+
+    if(cam->callBack)
+      cam->callBack(idx>=0 ? &cam->imageBufs[idx].image : NULL, cam->callBackContext, capFlags);
+    if(idx>=0) {
+      FFRecordDelivered(cam, idx);
+      FFReleaseImageBuf(cam, idx);
+    }
+  }
+
+  // A frame still in the mailbox is not delivered once stopped
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  bool pending = cam->dispatchPending;
+  s32 idx = cam->dispatchImage;
+  cam->dispatchPending = false;
+  SLASemPost(cam->poolSem);
+  if(pending && idx>=0)
+    FFReleaseImageBuf(cam, idx);
+
+  SLASemPost(cam->dispatchDoneSem);
+  return 0;
+}
+
 static FFSTATE TASK_read_frame_finished(FFCameraData *cam)
 {
   int fullHigh, fullWide, ds;
@@ -832,16 +1751,14 @@ static FFSTATE TASK_read_frame_finished(FFCameraData *cam)
     fullWide = cam->pFrame->width;
   }
   
-  // Resize image if needed (buffer is already allocated at max size)
-  // This should only happen at startup or when switching channels (eg. display NTSC, then display PAL)
-  if(true/*fullHigh != cam->high || fullWide != cam->wide*/){
-    avpicture_fill((AVPicture *)cam->pFrameOut, cam->bufferOut, cam->ffOutType, fullWide, fullHigh);
-    s32 ystride = cam->pFrameOut->linesize[0]/SLAImageTypeBytesPerPixel(cam->slOutType);
-    s32 uvstride = cam->pFrameOut->linesize[1];
-    SLASetupImage(&cam->imageOut, cam->slOutType, fullHigh, fullWide, ystride, uvstride,
-                    cam->pFrameOut->data[0], cam->pFrameOut->data[1], cam->pFrameOut->data[2]);
-
+  // Preview goes straight from the (possibly lowres) decoded frame to the tile size
+  int previewHigh, previewWide;
+  FFPreviewSize(cam, &previewHigh, &previewWide);
+  if(previewHigh) {
+    fullHigh = previewHigh & ~1;
+    fullWide = previewWide & ~1;
   }
+
   cam->high = fullHigh;
   cam->wide = fullWide;
 
@@ -856,6 +1773,9 @@ static FFSTATE TASK_read_frame_finished(FFCameraData *cam)
     cam->stats.TotalBitRate = 8000.0f*cam->byteCount/diff;
     cam->stats.VideoBitRate = 8000.0f*cam->videoByteCount/diff;
     cam->stats.KlvBitRate = 8000.0f*cam->klvByteCount/diff;
+    cam->stats.DecodeLoad = 100.0f*cam->decodeTime/diff;
+    cam->stats.LatenessAvg = cam->latenessCount ? 0.001f*cam->latenessSum/cam->latenessCount : 0;
+    cam->stats.DecodeScale = cam->pCodecCtx ? 1<<av_codec_get_lowres(cam->pCodecCtx) : 1;
 
     if (cam->inputType == INPUT_NETWORK) {
       // demux was via SLAUdpReceive
@@ -916,6 +1836,9 @@ static FFSTATE TASK_read_frame_finished(FFCameraData *cam)
       strncpy(cam->stats.Codec, "Unknown", STATS_NAME_LENGTH);
     cam->stats.Codec[STATS_NAME_LENGTH - 1] = 0;
 
+    for(s32 i=0; i<SLA_LATENCY_STAGES; i++)
+      SLALatencyHistSummary(&cam->latency[i], &cam->stats.Latency[i]);
+
     if(cam->statsCallBack)
       cam->statsCallBack(&cam->stats, cam->statsContext);
     cam->tic0 = tic;
@@ -924,71 +1847,164 @@ static FFSTATE TASK_read_frame_finished(FFCameraData *cam)
     cam->stats.MinFrameBytes = 10000000;
     cam->stats.KeyFrames = 0;
     cam->stats.IFrames = cam->stats.PFrames = cam->stats.BFrames = cam->stats.OtherFrames;
+    cam->stats.DispatchOverwrites = 0;
+    cam->stats.DiscardedFrames = 0;
+    cam->decodeTime = 0;
+    cam->stats.LatenessMax = 0;
+    cam->stats.LateDrops = 0;
+    cam->stats.CCErrors = 0;
+    cam->stats.DecodeErrors = 0;
+    cam->stats.CorruptFrames = 0;
+    cam->stats.CorruptDrops = 0;
+    cam->stats.ConvertSkips = 0;
+    cam->latenessSum = 0;
+    cam->latenessCount = 0;
   }
 
   cam->skipDisplay = 0;
+  s32 framesQueued = 0;
   if(cam->inputType == INPUT_NETWORK) {
     // If the UDP receiver is getting backed up skip displaying
     // a frame to let system catch up
     SLA_UDP_STATUS stat;
     SLAUDPStatus(cam->udpRx, &stat);
+    framesQueued = stat.framesQueued;
     if(cam->skipDisplay==0) {
       cam->skipDisplay = 0; //stat.backedUp;
     }
   }
 
-  if(cam->skipDisplay){
-    if(!cam->noRelease){
-      SLASemPost(cam->processingSem);
+  bool convertSkip;
+  int swsFlags = FFConvertFlags(cam, framesQueued, &convertSkip);
+
+  // Behind the presentation clock or before the seek target, save the conversion
+  if(cam->dropFrame)
+    cam->skipDisplay = 1;
+
+  // Damaged frames: the last good frame stays published when they are not shown
+  bool corrupt = cam->frameCorrupt || cam->streamDamaged;
+  if(corrupt) {
+    cam->stats.CorruptFrames++;
+    bool hold = false;
+    switch(cam->corruptPolicy) {
+    case SLA_CORRUPT_FREEZE:
+      hold = cam->frameCorrupt;
+      break;
+    case SLA_CORRUPT_WAIT_KEYFRAME:
+      hold = true;
+      break;
     }
-  } else {
+    if(hold && !cam->skipDisplay) {
+      cam->stats.CorruptDrops++;
+      cam->skipDisplay = 1;
+    }
+  }
+
+  // Newer frames are already waiting, showing this one only costs time
+  if(convertSkip && !cam->skipDisplay) {
+    cam->stats.ConvertSkips++;
+    cam->skipDisplay = 1;
+  }
+
+  s32 idx = -1;
+  if(!cam->skipDisplay) {
+    idx = FFAcquireImageBuf(cam);
+    if(idx<0)
+      cam->skipDisplay = 1;
+  }
+
+  if(!cam->skipDisplay) {
+    FFImageBuf *ib = &cam->imageBufs[idx];
+
+    // Grow the output frame when the stream gets bigger (first frame, channel change).
+    // Nobody references this frame so its old contents can be discarded.
+    s32 numBytes = avpicture_get_size(cam->ffOutType, fullWide, fullHigh);
+    if(numBytes > ib->bufferSize) {
+      if(ib->buffer) av_free(ib->buffer);
+      ib->buffer = (uint8_t *)av_malloc(numBytes*sizeof(uint8_t));
+      ib->bufferSize = ib->buffer ? numBytes : 0;
+      if(!ib->buffer) {
+        av_free_packet(&cam->packet);
+        return TASK_ERROR; // allocation failed
+      }
+    }
+
+    // Bob reads every other line of the decoded frame and lets the conversion scale it to full height
+    s32 deinterlace = cam->deinterlace;
+    if(deinterlace==SLA_DEINTERLACE_MOTION &&
+       (!FFCanDeinterlace(cam->inputFormat) ||
+        !FFDeinterlaceAlloc(cam, cam->pFrame->height, cam->pFrame->width, cam->inputFormat)))
+      deinterlace = SLA_DEINTERLACE_BOB;
+    s32 srcHigh = cam->pFrame->height;
+    if(deinterlace==SLA_DEINTERLACE_BOB)
+      srcHigh /= 2;
+
     cam->img_convert_ctx = 
       sws_getCachedContext(cam->img_convert_ctx,
-                            cam->pFrame->width, cam->pFrame->height, 
+                            cam->pFrame->width, srcHigh, 
                             cam->inputFormat, 
                             fullWide, fullHigh, cam->ffOutType,
-                            SWS_FAST_BILINEAR,
+                            swsFlags,
                             NULL, NULL, NULL);
     if(cam->img_convert_ctx == NULL) {
       av_free_packet(&cam->packet);
       return TASK_ERROR;
     }
 
-    if (cam->inputFormat == PIX_FMT_YUV422P && cam->slOutType == SLA_IMAGE_YUV_420 && cam->pFrame->linesize[0] >= cam->pFrameOut->linesize[0] &&
-      cam->pFrame->height>=cam->high) {
-      // NOTE:  Just clipping a bigger image to the cam size, not resizing
-      // 422 to 420 - just change the uv stride
-      s32 ystride = cam->pFrame->linesize[0];
-      s32 uvstride = cam->pFrame->linesize[1];
-      SLASetupImage(&cam->imageOut, cam->slOutType, cam->high, cam->wide, ystride, uvstride*2,
-                      cam->pFrame->data[0], cam->pFrame->data[1], cam->pFrame->data[2]);
+    avpicture_fill((AVPicture *)ib->pFrameOut, ib->buffer, cam->ffOutType, fullWide, fullHigh);
+
+    // Convert the image from its native format to output format
+    u64 t0, t1;
+    SLAGetMHzTime(&t0);
+    if(deinterlace==SLA_DEINTERLACE_MOTION) {
+      FFDeinterlaceScale(cam, ib->pFrameOut->data, ib->pFrameOut->linesize);
+    } else if(deinterlace==SLA_DEINTERLACE_BOB) {
+      int fieldStride[AV_NUM_DATA_POINTERS];
+      for(int p=0; p<AV_NUM_DATA_POINTERS; p++)
+        fieldStride[p] = 2*cam->pFrame->linesize[p];
+      sws_scale(cam->img_convert_ctx, cam->pFrame->data, 
+                fieldStride, 0, srcHigh, 
+                ib->pFrameOut->data, ib->pFrameOut->linesize);
     } else {
-      // Convert the image from its native format to output format
       sws_scale(cam->img_convert_ctx, cam->pFrame->data, 
                 cam->pFrame->linesize, 0, 
                 cam->pFrame->height, 
-                cam->pFrameOut->data, cam->pFrameOut->linesize);
-      s32 ystride = cam->pFrameOut->linesize[0]/SLAImageTypeBytesPerPixel(cam->slOutType);
-      s32 uvstride = cam->pFrameOut->linesize[1];
-      SLASetupImage(&cam->imageOut, cam->slOutType, cam->high, cam->wide, ystride, uvstride,
-                      cam->pFrameOut->data[0], cam->pFrameOut->data[1], cam->pFrameOut->data[2]);
-    }
-
-    SLAImage *outImage = &cam->imageOut;
-    outImage->type = cam->slOutType;
-
-    if(cam->callBack) {
-      cam->callBack(outImage, cam->callBackContext, 0);
+                ib->pFrameOut->data, ib->pFrameOut->linesize);
     }
-    // Throttle file input
-    if(cam->inputType == INPUT_FILE)
-      SLASleep(25);
+    if(deinterlace!=SLA_DEINTERLACE_MOTION)
+      cam->diPrevValid = false;
+    SLAGetMHzTime(&t1);
+    cam->decodeTime += t1 - t0;
+    cam->convertCost = t1 - t0;
+    SLALatencyHistRecord(&cam->latency[SLA_LATENCY_CONVERT], t1 - cam->decodeEnd);
+    ib->arrivalTime = cam->frameArrival;
+    ib->readyTime = t1;
+    ib->pts = FFPtsToUsec(cam, av_frame_get_best_effort_timestamp(cam->pFrame), cam->videoStream);
+    cam->framePts = ib->pts;
+    s32 ystride = ib->pFrameOut->linesize[0]/SLAImageTypeBytesPerPixel(cam->slOutType);
+    s32 uvstride = ib->pFrameOut->linesize[1];
+    SLASetupImage(&ib->image, cam->slOutType, cam->high, cam->wide, ystride, uvstride,
+                    ib->pFrameOut->data[0], ib->pFrameOut->data[1], ib->pFrameOut->data[2]);
+    ib->image.type = cam->slOutType;
+
+    FFPublishImageBuf(cam, idx);
+
+    // Frame stays valid for the duration of the callback, use AddRef to keep it longer
+    FFDispatch(cam, idx, corrupt ? SLA_CAP_FLAG_CORRUPT : 0);
+    // Wake up Get
+    if(!cam->noRelease)
+      SLASemPost(cam->imageSem);
+
+    if(cam->isPaused && cam->stepFrames>0)
+      cam->stepFrames--;
+    cam->shownFrame = cam->playFrame;
   } // !cam->skipDisplay
 
+  cam->playFrame++;
   cam->frame++;
   av_free_packet(&cam->packet);
 
-  return TASK_READ_FRAME;
+  return cam->draining ? TASK_DRAIN : TASK_READ_FRAME;
 }
 
 static FFSTATE TASK_timeout(FFCameraData *cam)
@@ -1001,14 +2017,18 @@ static FFSTATE TASK_timeout(FFCameraData *cam)
     cam->statsCallBack(&cam->stats, cam->statsContext);
 
   SLAGetMHzTime(&cam->tic0);
+  cam->draining = false;
 
-  if(cam->pFrameOut) {
-    if(cam->callBack)
-      cam->callBack(NULL, cam->callBackContext, 0);
+  if(cam->pFrame) {
+    FFDispatch(cam, -1, 0);
     cam->frame++;
   }
 
   if(cam->inputType == INPUT_NETWORK){
+    // Frames still held by the decoder are stale now, don't drain them later
+    if(cam->pCodecCtx && avcodec_is_open(cam->pCodecCtx))
+      avcodec_flush_buffers(cam->pCodecCtx);
+
     // Cause the codec to close and reopen to avoid
     // flicker of old video when a stream restarts
     cam->compressedFrame.streamType = SLA_UDP_VIDEO_PROTOCOL_NONE;
@@ -1031,7 +2051,10 @@ static FFSTATE TASK_Loop(FFCameraData *cam)
       cam->pFormatCtx->streams[cam->videoStream]->time_base);
     int rv = av_seek_frame(cam->pFormatCtx, -1, seekTarget, AVSEEK_FLAG_ANY);
     (void)rv;
+    SLInitKLVParser(&cam->klvParser);
     cam->frame = cam->startFrame;
+    cam->playFrame = cam->startFrame;
+    cam->clockValid = false;
     nextState = TASK_READ_FRAME;
   } else {
     nextState = TASK_EOF;
@@ -1039,6 +2062,135 @@ static FFSTATE TASK_Loop(FFCameraData *cam)
   return nextState;
 }
 
+// Wake the task loop wherever it is blocked: demux wait, pacing or pause
+static void FFWake(FFCameraData *cam)
+{
+  SLASemPost(cam->wakeSem);
+  if(cam->inputType == INPUT_NETWORK && cam->udpRx)
+    SLADemuxWake(cam->udpRx);
+}
+
+static void FFPostControl(FFCameraData *cam, FFMpegControlPacket *pkt)
+{
+  SLAMbxPost(cam->hmbx, pkt, SEM_FOREVER);
+  FFWake(cam);
+}
+
+// Block until the next file frame is due, a command arrives or the stream is unpaused.
+// Returns false if the loop should check for commands before running the state machine.
+static bool FFWaitForPace(FFCameraData *cam)
+{
+  // Parked: no callbacks until Park(false), control commands still run
+  if(cam->parked) {
+    if(!cam->parkAcked) {
+      cam->parkAcked = true;
+      SLASemPost(cam->parkSem);
+    }
+    SLASemPend(cam->wakeSem, SEM_FOREVER);
+    return false;
+  }
+
+  if(cam->inputType != INPUT_FILE)
+    return true;
+
+  if(cam->isPaused && cam->stepFrames<=0) {
+    SLASemPend(cam->wakeSem, SEM_FOREVER);
+    return false;
+  }
+
+  if(cam->paceTime) {
+    u64 now;
+    SLAGetMHzTime(&now);
+    if(now < cam->paceTime) {
+      SLASemPend(cam->wakeSem, (u32)((cam->paceTime - now + 999)/1000));
+      return false;
+    }
+  }
+  return true;
+}
+
+// Presentation clock for file playback.  Returns false while the decoded frame
+// is not due yet (paceTime is set), true once it should be shown or dropped.
+static bool FFSchedulePresentation(FFCameraData *cam)
+{
+  cam->dropFrame = false;
+  cam->paceTime = 0;
+  cam->frameLate = 0;
+  if(cam->inputType != INPUT_FILE)
+    return true;
+
+  // A held frame comes back here until it is due, its pts is only worked out once
+  s64 pts = cam->lastPts;
+  if(!cam->frameScheduled) {
+    pts = av_frame_get_best_effort_timestamp(cam->pFrame);
+    if(pts != AV_NOPTS_VALUE && cam->pFormatCtx) {
+      AVRational tbq = {1, AV_TIME_BASE};
+      pts = av_rescale_q(pts, cam->pFormatCtx->streams[cam->videoStream]->time_base, tbq);
+    }
+
+    // Decoding forward from the key frame to the seek target, nothing to show yet
+    if(cam->seekSkipFrames>0 || (cam->seekTarget!=AV_NOPTS_VALUE && pts!=AV_NOPTS_VALUE && pts<cam->seekTarget)) {
+      if(cam->seekSkipFrames>0)
+        cam->seekSkipFrames--;
+      cam->dropFrame = true;
+      cam->clockValid = false;
+      return true;
+    }
+    cam->seekTarget = AV_NOPTS_VALUE;
+  }
+
+  double speed = cam->playSpeed;
+  if(cam->isPaused || speed <= 0) {
+    cam->clockValid = false;
+    return true;
+  }
+
+  u64 now;
+  SLAGetMHzTime(&now);
+
+  if(!cam->frameScheduled) {
+    if(pts == AV_NOPTS_VALUE || !cam->pFormatCtx)
+      pts = cam->lastPts + FILE_FRAME_PERIOD;
+    if(pts < cam->lastPts || pts - cam->lastPts > PTS_JUMP_MAX)
+      cam->clockValid = false;
+    else if(cam->clockValid && pts > cam->lastPts)
+      cam->framePeriod = (u64)((pts - cam->lastPts)/speed);
+    cam->lastPts = pts;
+    cam->frameScheduled = true;
+  }
+
+  // Anchor at start, after seek/loop/speed change and across timestamp discontinuities
+  if(!cam->clockValid) {
+    cam->clockPts = pts;
+    cam->clockTime = now;
+    cam->clockValid = true;
+  }
+
+  s64 due = (s64)cam->clockTime + (s64)((pts - cam->clockPts)/speed);
+  s64 late = (s64)now - due;
+  if(late < 0) {
+    cam->paceTime = (u64)due;
+    return false;
+  }
+
+  cam->frameLate = late;
+  cam->latenessSum += late;
+  cam->latenessCount++;
+  cam->stats.LatenessMax = SLMAX(cam->stats.LatenessMax, 0.001f*late);
+
+  if(late > LATE_RESYNC) {
+    // Can't keep up at this speed, restart the clock from here
+    cam->clockPts = pts;
+    cam->clockTime = now;
+  } else if(late > LATE_DROP && !cam->lastDropped) {
+    // Never drop two in a row so the display keeps moving
+    cam->dropFrame = true;
+    cam->stats.LateDrops++;
+  }
+  cam->lastDropped = cam->dropFrame;
+  return true;
+}
+
 static int ffmpegTask(void *pCamera)
 {
   FFCameraData *cam = (FFCameraData*)pCamera;
@@ -1117,11 +2269,31 @@ static int ffmpegTask(void *pCamera)
             int port;
             av_url_split(0,0,0,0,hostname, sizeof(hostname)-1, &port, 0, 0, cam->fName);
             SLAReinitUDPReceive(cam->udpRx, hostname, port);
+
+            // Nothing from the previous address may show up on the new one.
+            // The codec stays open, it is only reopened if the stream type differs.
+            if(!cam->useSlDemux) {
+              SLStatus st;
+              do {
+                st = SLADemuxNextFrame(cam->udpRx, &cam->compressedFrame, 0);
+              } while(st==SLA_SUCCESS || st==SLA_NOP);
+              cam->compressedFrame.len = 0;
+              if(cam->pCodecCtx && avcodec_is_open(cam->pCodecCtx))
+                avcodec_flush_buffers(cam->pCodecCtx);
+              cam->draining = false;
+              SLInitKLV(&cam->klv, &cam->klvStore);
+              SLInitKLVParser(&cam->klvParser);
+              SLAKlvHistoryReset(&cam->klvHistory);
+              cam->framePts = AV_NOPTS_VALUE;
+            }
+            FFResetStats(cam);
           } else {
             ffState = TASK_TIMEOUT;
           }
           break;
         case FF_CONTROL_INDEX:
+          ffState = TASK_seek_frame_number(cam, pkt.modifier);
+          cam->paceTime = 0;
           break;
         case FF_CONTROL_SAVEFILE:
           cam->dumpFile = (FILE*)pkt.ptr;
@@ -1130,9 +2302,10 @@ static int ffmpegTask(void *pCamera)
 			double timeStamp;
 			memcpy(&timeStamp, pkt.name,sizeof(double)); 
 			 ffState = TASK_seek_frame(cam, timeStamp);
+          cam->paceTime = 0;
           break;
       }
-    } else {
+    } else if(FFWaitForPace(cam)) {
       // Run through state machine
       switch(ffState){
         case TASK_FIND_INPUT_FORMAT:
@@ -1145,7 +2318,7 @@ static int ffmpegTask(void *pCamera)
           break;
         case TASK_OPEN_INPUT:
 #ifdef WIN32
-          SLASleep(50);
+          SLASemPend(cam->wakeSem, 50);
 #endif
           nextState = TASK_open_input(cam);
           break;
@@ -1173,17 +2346,16 @@ static int ffmpegTask(void *pCamera)
           break;
         case TASK_READ_FRAME_FINISHED:
           {
+          // Hold the frame until it is due, FFWaitForPace waits for paceTime
+          if(!FFSchedulePresentation(cam)) {
+            nextState = TASK_READ_FRAME_FINISHED;
+            break;
+          }
           nextState = TASK_read_frame_finished(cam);
 
           // OK for GetImageInfo to access high, wide, type members
           if(cam->frame-cam->startFrame==1)
             SLASemPost(cam->camSemaphore);
-          // Lock semaphore, unlocked by ::Release
-          if(!cam->noRelease) {
-            SLASemPost(cam->imageSem);
-            while(!cam->done && !SLASemPend(cam->processingSem, 200))
-              SLASleep(100);
-          }
           }
           break;
         case TASK_TIMEOUT:
@@ -1193,6 +2365,9 @@ static int ffmpegTask(void *pCamera)
         case TASK_LOOP:
           nextState = TASK_Loop(cam);
           break;
+        case TASK_DRAIN:
+          nextState = TASK_drain(cam);
+          break;
 
       }
       // Check for end of file
@@ -1202,6 +2377,7 @@ static int ffmpegTask(void *pCamera)
       // Could implement error handling TODO: free context
       if(nextState == TASK_ERROR){
         cam->compressedFrame.len = 0;
+        cam->draining = false;
         if(cam->inputType == INPUT_NETWORK) {
           nextState = TASK_REOPEN2;
         } else
@@ -1214,8 +2390,8 @@ static int ffmpegTask(void *pCamera)
 
   // File is done, continue to send blank images to display thread
   while(!cam->done && cam->callBack){
-    cam->callBack(NULL, cam->callBackContext, 1);
-    SLASleep(30);
+    FFDispatch(cam, -1, SLA_CAP_FLAG_EOF);
+    SLASemPend(cam->wakeSem, 30);
   }
 
   while(SLASemPend(cam->imageSem, 100)!=SLA_SUCCESS)
@@ -1274,6 +2450,17 @@ void SLADecodeFFMPEG::SetPALResample(bool flag)
 
 }
 
+SLStatus SLADecodeFFMPEG::SetDeinterlace(s32 mode)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(mode!=SLA_DEINTERLACE_OFF && mode!=SLA_DEINTERLACE_BOB && mode!=SLA_DEINTERLACE_MOTION)
+    return SLA_FAIL;
+  cam->deinterlace = mode;
+  return SLA_SUCCESS;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 SLStatus SLADecodeFFMPEG::Initialize( const char *dirName,
                                     SLA_IMAGE_TYPE outType,
@@ -1295,7 +2482,7 @@ SLStatus SLADecodeFFMPEG::Initialize( const char *dirName,
 
     pkt.type = FF_CONTROL_NAME;
     strncpy(pkt.name, dirName, sizeof(pkt.name));
-    SLAMbxPost(cam->hmbx, &pkt, SEM_FOREVER);
+    FFPostControl(cam, &pkt);
 
     return SLA_SUCCESS;
   }
@@ -1307,9 +2494,25 @@ SLStatus SLADecodeFFMPEG::Initialize( const char *dirName,
     cam->taskDoneSem = SLASemCreate(0);
     cam->imageSem = SLASemCreate(0);
     cam->processingSem = SLASemCreate(0);
+    cam->poolSem = SLASemCreate(1, "Cam FFMPEG pool sem");
+    cam->latestImage = -1;
+    cam->dispatchSem = SLASemCreate(0);
+    cam->wakeSem = SLASemCreate(0);
+    cam->parkSem = SLASemCreate(0);
+    cam->dispatchDoneSem = SLASemCreate(0);
+    cam->indexDoneSem = SLASemCreate(0);
+    cam->seekTarget = AV_NOPTS_VALUE;
     cam->useSlDemux = useSlDemux;
     cam->resamplePAL = false;
     cam->upSample = 1;
+    cam->playSpeed = 1.0;
+    cam->convertLevel = 1;  // SWS_FAST_BILINEAR
+    SLInitKLV(&cam->klv, &cam->klvStore);
+    SLInitKLV(&cam->klvRecent, &cam->klvRecentStore);
+    SLInitKLVParser(&cam->klvParser);
+    SLAKlvHistoryInit(&cam->klvHistory);
+    SLInitKLVGeoCache(&cam->klvGeo);
+    cam->framePts = AV_NOPTS_VALUE;
 
     // Set up compression buffer
     cam->compressedFrame.buffer = cam->cFrameData;
@@ -1393,19 +2596,29 @@ SLStatus SLADecodeFFMPEG::Cleanup( )
 
   FFMpegControlPacket pkt;
   pkt.type = FF_CONTROL_NAME;
-  SLAMbxPost(cam->hmbx, &pkt, SEM_FOREVER);
+  FFPostControl(cam, &pkt);
 
   // Wait for signal that readFramesTask has exited
   SLASemPend(cam->taskDoneSem, SEM_FOREVER);
 
+  if(cam->dispatchTask)
+    SLASemPend(cam->dispatchDoneSem, SEM_FOREVER);
+
+  // Index task stops early once done is set
+  if(cam->indexStarted)
+    SLASemPend(cam->indexDoneSem, SEM_FOREVER);
+  SLAKeyIndexFree(cam->keyIndex);
+  SLAKeyIndexFree(cam->newKeyIndex);
+
   if(cam->dumpFile)
     fclose(cam->dumpFile);
   cam->dumpFile = 0;
 
   // Free the YUV image
-  if(cam->buffer) av_free(cam->buffer);
-  if(cam->bufferOut) av_free(cam->bufferOut);
-  if(cam->pFrameOut) av_free(cam->pFrameOut);
+  for(int i=0; i<N_IMAGE_BUFS; i++) {
+    if(cam->imageBufs[i].buffer) av_free(cam->imageBufs[i].buffer);
+    if(cam->imageBufs[i].pFrameOut) av_free(cam->imageBufs[i].pFrameOut);
+  }
 
   // Free the YUV frame
   if(cam->pFrame) av_free(cam->pFrame);
@@ -1418,6 +2631,8 @@ SLStatus SLADecodeFFMPEG::Cleanup( )
 
   if(cam->img_convert_ctx)
     sws_freeContext(cam->img_convert_ctx);
+  if(cam->diBuf)
+    av_free(cam->diBuf);
 
   if(cam->imageSem)
     SLASemDestroy(cam->imageSem);
@@ -1425,6 +2640,24 @@ SLStatus SLADecodeFFMPEG::Cleanup( )
   if(cam->processingSem)
     SLASemDestroy(cam->processingSem);
 
+  if(cam->poolSem)
+    SLASemDestroy(cam->poolSem);
+
+  if(cam->dispatchSem)
+    SLASemDestroy(cam->dispatchSem);
+
+  if(cam->wakeSem)
+    SLASemDestroy(cam->wakeSem);
+
+  if(cam->parkSem)
+    SLASemDestroy(cam->parkSem);
+
+  if(cam->indexDoneSem)
+    SLASemDestroy(cam->indexDoneSem);
+
+  if(cam->dispatchDoneSem)
+    SLASemDestroy(cam->dispatchDoneSem);
+
   if(cam->camSemaphore)
     SLASemDestroy(cam->camSemaphore);
 
@@ -1454,12 +2687,40 @@ SLStatus SLADecodeFFMPEG::Get( SLAImage * pImage)
     if(cam->done)
       return SLA_FAIL; 
     while(!cam->done && !SLASemPend(cam->imageSem, 2));
+    // Frames published since the last Get collapse into the latest one
+    while(SLASemPend(cam->imageSem, 0));
   }
   SLASemPend(cam->camSemaphore, -1);
-  *pImage = cam->imageOut;
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  s32 idx = cam->latestImage;
+  if(idx>=0) {
+    // Without Release the caller gets the legacy, unreferenced view of the frame
+    if(!cam->noRelease)
+      cam->imageBufs[idx].refCount++;
+    *pImage = cam->imageBufs[idx].image;
+  }
+  SLASemPost(cam->poolSem);
   SLASemPost(cam->camSemaphore);
 
-  return SLA_SUCCESS;
+  return idx>=0 ? SLA_SUCCESS : SLA_FAIL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+///////////////////////////////////////////////////////////////////////////////
+SLStatus SLADecodeFFMPEG::AddRef( SLAImage * pImage )
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam || !pImage)
+    return SLA_ERROR;
+
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  s32 idx = FFFindImageBuf(cam, pImage);
+  if(idx>=0)
+    cam->imageBufs[idx].refCount++;
+  SLASemPost(cam->poolSem);
+
+  return idx>=0 ? SLA_SUCCESS : SLA_ERROR;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1468,9 +2729,17 @@ SLStatus SLADecodeFFMPEG::Get( SLAImage * pImage)
 SLStatus SLADecodeFFMPEG::Release( SLAImage * pImage )
 {
   FFCameraData *cam = (FFCameraData*)Data;
-  SLASemPost(cam->processingSem);
- 
-  return SLA_ERROR;
+  if(!cam || !pImage)
+    return SLA_ERROR;
+
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  s32 idx = FFFindImageBuf(cam, pImage);
+  SLASemPost(cam->poolSem);
+  if(idx<0)
+    return SLA_ERROR;
+
+  FFReleaseImageBuf(cam, idx);
+  return SLA_SUCCESS;
 }
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -1489,6 +2758,36 @@ void SLADecodeFFMPEG::SetKLVCallBack(SLKLVCallback callBack)
   cam->klvCallBack = callBack;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+///////////////////////////////////////////////////////////////////////////////
+SLStatus SLADecodeFFMPEG::SetAsyncCallBack(bool enable)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_ERROR;
+
+  if(enable && !cam->dispatchTask) {
+    cam->dispatchStop = false;
+    cam->dispatchTask = SLACreateThread(ffDispatchTask, 8*SL_DEFAULT_STACK_SIZE, "ffDispatchTask", (void*)cam, SL_PRI_4);
+    if(!cam->dispatchTask)
+      return SLA_FAIL;
+  }
+
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  cam->asyncCallBack = enable;
+  SLASemPost(cam->poolSem);
+
+  // Callbacks are back on the decode thread, the dispatch thread ends
+  if(!enable && cam->dispatchTask) {
+    cam->dispatchStop = true;
+    SLASemPost(cam->dispatchSem);
+    SLASemPend(cam->dispatchDoneSem, SEM_FOREVER);
+    cam->dispatchTask = NULL;
+  }
+  return SLA_SUCCESS;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 ///////////////////////////////////////////////////////////////////////////////
@@ -1543,7 +2842,7 @@ SLStatus SLADecodeFFMPEG::StartSaving(const char *filename)
 
       pkt.type = FF_CONTROL_SAVEFILE;
       pkt.ptr = f;
-      SLAMbxPost(cam->hmbx, &pkt, SEM_FOREVER);
+      FFPostControl(cam, &pkt);
 
       return SLA_SUCCESS;
     }
@@ -1564,7 +2863,7 @@ SLStatus SLADecodeFFMPEG::StopSaving()
 
       pkt.type = FF_CONTROL_SAVEFILE;
       pkt.ptr = 0;
-      SLAMbxPost(cam->hmbx, &pkt, SEM_FOREVER);
+      FFPostControl(cam, &pkt);
 
       return SLA_SUCCESS;
     }
@@ -1587,6 +2886,9 @@ SLStatus SLADecodeFFMPEG::Pause(bool pause)
   //to do replace with a packet in the mail box
   FFCameraData *cam = (FFCameraData*)this->Data;
   cam->isPaused = pause;
+  cam->stepFrames = 0;
+  cam->clockValid = false;
+  FFWake(cam);
   SLATrace("Is Paused: %d\n",pause);
   return SLA_SUCCESS;
 }
@@ -1604,13 +2906,61 @@ SLStatus SLADecodeFFMPEG::Pause(bool pause)
 
     pkt.type = FF_CONTROL_SEEK;
     memcpy(pkt.name, &timeStamp, sizeof(double)); //dodgy but unsure how else to pass arguments rg
-    SLAMbxPost(cam->hmbx, &pkt, SEM_FOREVER);
+    FFPostControl(cam, &pkt);
 
     return SLA_SUCCESS;
   }  
   return SLA_ERROR;
  }
 
+void SLADecodeFFMPEG::SetFastOpen(bool enable)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(cam)
+    cam->fastOpen = enable;
+}
+
+SLStatus SLADecodeFFMPEG::Park(bool park)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_ERROR;
+
+  if(!park) {
+    cam->parked = false;
+    FFWake(cam);
+    return SLA_SUCCESS;
+  }
+
+  cam->parkAcked = false;
+  cam->parked = true;
+  FFWake(cam);
+  // The task may be in the middle of a frame and its callback
+  return SLASemPend(cam->parkSem, 1000) ? SLA_SUCCESS : SLA_TIMEOUT;
+}
+
+SLStatus SLADecodeFFMPEG::SeekFrame(s32 frame)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+
+  if(!cam || cam->inputType != INPUT_FILE || frame < 0)
+    return SLA_ERROR;
+
+  FFMpegControlPacket pkt;
+  pkt.type = FF_CONTROL_INDEX;
+  pkt.modifier = frame;
+  FFPostControl(cam, &pkt);
+  return SLA_SUCCESS;
+}
+
+s32 SLADecodeFFMPEG::GetFrameNumber()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return -1;
+  return cam->shownFrame;
+}
+
 double SLADecodeFFMPEG::GetDuration()
  {
   FFCameraData *cam = (FFCameraData*)Data;
@@ -1640,3 +2990,137 @@ int SLADecodeFFMPEG::GetUpSample()
   return 1;
 }
 
+SLStatus SLADecodeFFMPEG::SetDecodeMode(s32 mode)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(mode!=SLA_DECODE_ALL && mode!=SLA_DECODE_REFERENCE_ONLY && mode!=SLA_DECODE_KEYFRAMES_ONLY)
+    return SLA_FAIL;
+  cam->decodeMode = mode;
+  return SLA_SUCCESS;
+}
+
+s32 SLADecodeFFMPEG::GetDecodeMode()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(cam)
+    return cam->decodeMode;
+  return SLA_DECODE_ALL;
+}
+
+SLStatus SLADecodeFFMPEG::GetLatency(s32 stage, SLALatencySummary *summary)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam || !summary || stage<0 || stage>=SLA_LATENCY_STAGES)
+    return SLA_FAIL;
+  SLALatencyHistSummary(&cam->latency[stage], summary);
+  return SLA_SUCCESS;
+}
+
+void SLADecodeFFMPEG::ResetLatency()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return;
+  for(s32 i=0; i<SLA_LATENCY_STAGES; i++)
+    SLALatencyHistClear(&cam->latency[i]);
+}
+
+SLStatus SLADecodeFFMPEG::GetPts(const SLAImage *pImage, s64 *pts)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam || !pImage || !pts)
+    return SLA_ERROR;
+
+  SLASemPend(cam->poolSem, SEM_FOREVER);
+  s32 idx = FFFindImageBuf(cam, pImage);
+  if(idx>=0)
+    *pts = cam->imageBufs[idx].pts;
+  SLASemPost(cam->poolSem);
+
+  return (idx>=0 && *pts!=AV_NOPTS_VALUE) ? SLA_SUCCESS : SLA_ERROR;
+}
+
+SLStatus SLADecodeFFMPEG::GetKlvAt(s64 pts, KLVGeoAt *at)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam || !at)
+    return SLA_FAIL;
+  return SLAKlvHistoryAt(&cam->klvHistory, pts, at);
+}
+
+SLStatus SLADecodeFFMPEG::SetConvertQuality(s32 quality)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(quality<SLA_CONVERT_FAST || quality>SLA_CONVERT_ADAPTIVE)
+    return SLA_FAIL;
+  cam->convertQuality = quality;
+  return SLA_SUCCESS;
+}
+
+s32 SLADecodeFFMPEG::GetConvertQuality()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(cam)
+    return cam->convertQuality;
+  return SLA_CONVERT_FAST;
+}
+
+SLStatus SLADecodeFFMPEG::SetCorruptPolicy(s32 policy)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(policy!=SLA_CORRUPT_DELIVER && policy!=SLA_CORRUPT_FREEZE && policy!=SLA_CORRUPT_WAIT_KEYFRAME)
+    return SLA_FAIL;
+  cam->corruptPolicy = policy;
+  return SLA_SUCCESS;
+}
+
+s32 SLADecodeFFMPEG::GetCorruptPolicy()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(cam)
+    return cam->corruptPolicy;
+  return SLA_CORRUPT_DELIVER;
+}
+
+SLStatus SLADecodeFFMPEG::SetPreviewSize(s16 high, s16 wide)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(high<0 || wide<0 || high>FFMPEG_MAX_HEIGHT || wide>FFMPEG_MAX_WIDTH)
+    return SLA_FAIL;
+  if(high==0 || wide==0)
+    high = wide = 0;
+  // Both in one store, the decoder thread never sees a new height with an old width
+  cam->previewSize = ((u32)high << 16) | (u32)wide;
+  return SLA_SUCCESS;
+}
+
+SLStatus SLADecodeFFMPEG::SetPlaybackSpeed(double speed)
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam)
+    return SLA_FAIL;
+  if(speed != 0 && (speed < 0.25 || speed > 16))
+    return SLA_FAIL;
+  cam->playSpeed = speed;
+  cam->clockValid = false;
+  FFWake(cam);
+  return SLA_SUCCESS;
+}
+
+SLStatus SLADecodeFFMPEG::StepFrame()
+{
+  FFCameraData *cam = (FFCameraData*)Data;
+  if(!cam || cam->inputType != INPUT_FILE || !cam->isPaused)
+    return SLA_FAIL;
+  cam->stepFrames++;
+  FFWake(cam);
+  return SLA_SUCCESS;
+}
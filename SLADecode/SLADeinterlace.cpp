@@ -0,0 +1,62 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include "SLADeinterlace.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+void SLADeinterlaceLine(u8 *dst, const u8 *above, const u8 *cur, const u8 *below,
+                        const u8 *prevAbove, const u8 *prevCur, s32 wide, s32 threshold)
+{
+  s32 x = 0;
+
+  if(!prevAbove || !prevCur) {
+#if USE_SSE2
+    for(; x+16<=wide; x+=16) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(above + x));
+      __m128i b = _mm_loadu_si128((const __m128i*)(below + x));
+      _mm_storeu_si128((__m128i*)(dst + x), _mm_avg_epu8(a, b));
+    }
+#endif
+    for(; x<wide; x++)
+      dst[x] = (u8)((above[x] + below[x] + 1) >> 1);
+    return;
+  }
+
+#if USE_SSE2
+  const __m128i thr = _mm_set1_epi8((char)SLLIMIT(threshold, 0, 255));
+  const __m128i zero = _mm_setzero_si128();
+  for(; x+16<=wide; x+=16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(above + x));
+    __m128i c = _mm_loadu_si128((const __m128i*)(cur + x));
+    __m128i b = _mm_loadu_si128((const __m128i*)(below + x));
+    __m128i pa = _mm_loadu_si128((const __m128i*)(prevAbove + x));
+    __m128i pc = _mm_loadu_si128((const __m128i*)(prevCur + x));
+
+    // |x - prev| with saturating subtracts, then the larger of the two lines
+    __m128i dc = _mm_or_si128(_mm_subs_epu8(c, pc), _mm_subs_epu8(pc, c));
+    __m128i da = _mm_or_si128(_mm_subs_epu8(a, pa), _mm_subs_epu8(pa, a));
+    __m128i motion = _mm_max_epu8(dc, da);
+
+    // still where motion <= threshold
+    __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(motion, thr), zero);
+    __m128i interp = _mm_avg_epu8(a, b);
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_and_si128(still, c), _mm_andnot_si128(still, interp)));
+  }
+#endif
+  for(; x<wide; x++) {
+    s32 dc = cur[x] - prevCur[x];
+    s32 da = above[x] - prevAbove[x];
+    s32 motion = SLMAX(abs(dc), abs(da));
+    dst[x] = motion <= threshold ? cur[x] : (u8)((above[x] + below[x] + 1) >> 1);
+  }
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SLAKeyIndex.h"
+#include "SLAHal.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#define KEY_INDEX_MAGIC   0x494B4C53  // "SLKI"
+#define KEY_INDEX_VERSION 2   // 1 numbered key frames in decode order
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  s64 fileSize;
+  s32 count;
+  s32 entrySize;
+} KeyIndexHeader;
+
+static void sidecarName(char *dst, u32 len, const char *fName)
+{
+  dst[0] = 0;
+  strncat(dst, fName, len - sizeof(SLA_KEY_INDEX_EXT));
+  strcat(dst, SLA_KEY_INDEX_EXT);
+}
+
+static SLAKeyIndex *allocIndex(const char *fName, s64 fileSize)
+{
+  SLAKeyIndex *index = (SLAKeyIndex*)SLACalloc(sizeof(SLAKeyIndex));
+  if(!index)
+    return NULL;
+  strncpy(index->fName, fName, sizeof(index->fName) - 1);
+  index->fileSize = fileSize;
+  return index;
+}
+
+SLAKeyIndex *SLAKeyIndexLoad(const char *fName, s64 fileSize)
+{
+  char name[1024 + sizeof(SLA_KEY_INDEX_EXT)];
+  sidecarName(name, sizeof(name), fName);
+
+  FILE *fp = fopen(name, "rb");
+  if(!fp)
+    return NULL;
+
+  KeyIndexHeader hdr;
+  SLAKeyIndex *index = NULL;
+  if(fread(&hdr, sizeof(hdr), 1, fp)==1 && hdr.magic==KEY_INDEX_MAGIC && hdr.version==KEY_INDEX_VERSION
+     && hdr.entrySize==sizeof(SLAKeyFrame) && hdr.fileSize==fileSize && hdr.count>0) {
+    index = allocIndex(fName, fileSize);
+    if(index) {
+      index->frames = (SLAKeyFrame*)SLAMalloc(hdr.count*sizeof(SLAKeyFrame));
+      if(index->frames && fread(index->frames, sizeof(SLAKeyFrame), hdr.count, fp)==(size_t)hdr.count) {
+        index->count = hdr.count;
+      } else {
+        SLAKeyIndexFree(index);
+        index = NULL;
+      }
+    }
+  }
+  fclose(fp);
+  return index;
+}
+
+SLStatus SLAKeyIndexSave(const SLAKeyIndex *index)
+{
+  char name[1024 + sizeof(SLA_KEY_INDEX_EXT)];
+  sidecarName(name, sizeof(name), index->fName);
+
+  // Recordings may sit on read-only media, the index is then rebuilt each time
+  FILE *fp = fopen(name, "wb");
+  if(!fp)
+    return SLA_FAIL;
+
+  KeyIndexHeader hdr;
+  SLAMemset(&hdr, 0, sizeof(hdr));
+  hdr.magic = KEY_INDEX_MAGIC;
+  hdr.version = KEY_INDEX_VERSION;
+  hdr.fileSize = index->fileSize;
+  hdr.count = index->count;
+  hdr.entrySize = sizeof(SLAKeyFrame);
+
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, fp)==1
+         && fwrite(index->frames, sizeof(SLAKeyFrame), index->count, fp)==(size_t)index->count;
+  fclose(fp);
+  if(!ok) {
+    remove(name);
+    return SLA_FAIL;
+  }
+  return SLA_SUCCESS;
+}
+
+static int comparePts(const void *a, const void *b)
+{
+  s64 pa = *(const s64*)a, pb = *(const s64*)b;
+  return pa < pb ? -1 : pa > pb;
+}
+
+// Packets come in decode order; with B-frames the packets before a key frame are
+// not the frames shown before it, so a key frame's number is the count of video
+// packets with a smaller pts. Key frame pts are still in the stream time base here.
+static void numberFrames(SLAKeyIndex *index, s64 *pts, s32 nPts)
+{
+  qsort(pts, nPts, sizeof(s64), comparePts);
+  for(s32 i = 0; i < index->count; i++) {
+    s32 lo = 0, hi = nPts;
+    while(lo < hi) {
+      s32 mid = (lo + hi)/2;
+      if(pts[mid] < index->frames[i].pts)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    index->frames[i].frame = lo;
+  }
+}
+
+SLAKeyIndex *SLAKeyIndexBuild(const char *fName, volatile u32 *abort)
+{
+  AVFormatContext *ctx = NULL;
+  if(avformat_open_input(&ctx, fName, NULL, NULL)!=0)
+    return NULL;
+  if(avformat_find_stream_info(ctx, NULL)<0) {
+    avformat_close_input(&ctx);
+    return NULL;
+  }
+
+  s32 videoStream = av_find_best_stream(ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  s64 fileSize = ctx->pb ? avio_size(ctx->pb) : -1;
+  if(videoStream<0 || fileSize<=0) {
+    avformat_close_input(&ctx);
+    return NULL;
+  }
+
+  SLAKeyIndex *index = allocIndex(fName, fileSize);
+  s32 allocated = 0;
+  s64 *pts = NULL;        // of every video packet
+  s32 nPts = 0, ptsAllocated = 0;
+  AVRational tbq = {1, AV_TIME_BASE};
+  AVRational tb = ctx->streams[videoStream]->time_base;
+  AVPacket packet;
+
+  while(index && !*abort && av_read_frame(ctx, &packet)>=0) {
+    if(packet.stream_index==videoStream) {
+      s64 ts = packet.pts!=AV_NOPTS_VALUE ? packet.pts : packet.dts;
+      if(ts!=AV_NOPTS_VALUE) {
+        if(nPts==ptsAllocated) {
+          ptsAllocated = ptsAllocated ? 2*ptsAllocated : 16*1024;
+          s64 *grown = (s64*)realloc(pts, ptsAllocated*sizeof(s64));
+          if(!grown) {
+            SLAKeyIndexFree(index);
+            index = NULL;
+            av_free_packet(&packet);
+            break;
+          }
+          pts = grown;
+        }
+        pts[nPts++] = ts;
+      }
+      if((packet.flags & AV_PKT_FLAG_KEY) && packet.pos>=0 && ts!=AV_NOPTS_VALUE) {
+        if(index->count==allocated) {
+          allocated = allocated ? 2*allocated : 1024;
+          SLAKeyFrame *frames = (SLAKeyFrame*)realloc(index->frames, allocated*sizeof(SLAKeyFrame));
+          if(!frames) {
+            SLAKeyIndexFree(index);
+            index = NULL;
+            av_free_packet(&packet);
+            break;
+          }
+          index->frames = frames;
+        }
+        SLAKeyFrame *kf = &index->frames[index->count++];
+        kf->pos = packet.pos;
+        kf->pts = ts;
+      }
+    }
+    av_free_packet(&packet);
+  }
+  avformat_close_input(&ctx);
+
+  if(index && !*abort) {
+    numberFrames(index, pts, nPts);
+    for(s32 i = 0; i < index->count; i++)
+      index->frames[i].pts = av_rescale_q(index->frames[i].pts, tb, tbq);
+  }
+  free(pts);
+
+  if(index && (*abort || index->count==0)) {
+    SLAKeyIndexFree(index);
+    return NULL;
+  }
+  if(index)
+    SLAKeyIndexSave(index);
+  return index;
+}
+
+void SLAKeyIndexFree(SLAKeyIndex *index)
+{
+  if(!index)
+    return;
+  if(index->frames)
+    SLAFree(index->frames);
+  SLAFree(index);
+}
+
+// Key frames are in file order, which is also pts order for a recording without discontinuities
+const SLAKeyFrame *SLAKeyIndexFindPts(const SLAKeyIndex *index, s64 pts)
+{
+  if(!index || index->count==0)
+    return NULL;
+  s32 lo = 0, hi = index->count - 1;
+  while(lo < hi) {
+    s32 mid = (lo + hi + 1)/2;
+    if(index->frames[mid].pts <= pts)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &index->frames[lo];
+}
+
+const SLAKeyFrame *SLAKeyIndexFindFrame(const SLAKeyIndex *index, s32 frame)
+{
+  if(!index || index->count==0)
+    return NULL;
+  s32 lo = 0, hi = index->count - 1;
+  while(lo < hi) {
+    s32 mid = (lo + hi + 1)/2;
+    if(index->frames[mid].frame <= frame)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &index->frames[lo];
+}
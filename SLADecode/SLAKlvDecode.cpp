@@ -4,33 +4,166 @@
  * http://www.sightlineapplications.com
  *------------------------------------------------------------------------*/
 
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
 #include "SLAKlvDecode.h"
 #include "SLAHal.h"
 
-// Implements MISB EG 0601.1
-static const u8 SLUniversalKey[] = {0x06, 0x0E, 0x2B, 0x34,  0x02, 0x0B, 0x01, 0x01,   0x0E, 0x01, 0x03, 0x01,  0x01, 0x00, 0x00, 0x00};
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
 
 #if (defined linux || defined LINUX)
 static const u64 UTC_EPOCH = 1322647200000000LLU;
-static u64 CONST_K0 = (u64)0x060e2b34020b0101LLU;
-static u64 CONST_K1 = (u64)0x0e01030101000000LLU;
 #else
 // Starting time (November 30, 2011 ~10am in us since 1/1/1970)
 static const u64 UTC_EPOCH = 1322647200000000LU;
-static u64 CONST_K0 = (u64)0x060e2b34020b0101LU;
-static u64 CONST_K1 = (u64)0x0e01030101000000LU;
 #endif
-static u8  CONST_K0_FIRST_BYTE = 0x06;
 
+#define KLV_LEN_UPTO(n) (u16)(0x116 & ((2u<<(n))-1))   // 1, 2, 4 or 8 bytes up to n
+#define KLV_TAG(el, type, lenMask, wire) {(u16)offsetof(KLVData, el), (u16)sizeof(((KLVData*)0)->el), lenMask, type, wire}
+#define KLV_UTYPE(n)      ((n)==1 ? KLV_TYPE_U8 : (n)==2 ? KLV_TYPE_U16 : (n)==4 ? KLV_TYPE_U32 : KLV_TYPE_U64)
+#define KLV_UINT(el, len) KLV_TAG(el, KLV_UTYPE(sizeof(((KLVData*)0)->el)), KLV_LEN_UPTO(sizeof(((KLVData*)0)->el)), len)
+#define KLV_INT(el, len)  KLV_TAG(el, KLV_TYPE_INT, KLV_LEN_UPTO(sizeof(((KLVData*)0)->el)), len)
+#define KLV_BYTES(el)     KLV_TAG(el, KLV_TYPE_BYTES, 0, 0)
+
+// Indexed by tag number. A newer ST 0601 item only needs its KLVData field and a row here.
+const KLVTag klvTags[KLV_PRESENT_TAGS] = {
+  {0, 0, 0, KLV_TYPE_NONE},                         // #0
+  {0, 0, KLV_LEN_UPTO(2), KLV_TYPE_CHECKSUM, 2},    // #1
+  KLV_UINT(Utctime, 8),                             // #2
+  KLV_BYTES(Missionid),                             // #3
+  KLV_BYTES(PlatformTailNumber),                    // #4
+  KLV_UINT(PlatformHeadingAngle, 2),                // #5
+  KLV_UINT(PlatformPitchAngle, 2),                  // #6
+  KLV_UINT(PlatformRollAngle, 2),                   // #7
+  KLV_UINT(PlatformTrueAirSpeed, 1),                // #8
+  KLV_UINT(PlatformIndicatedAirSpeed, 1),           // #9
+  KLV_BYTES(PlatformDesignation),                   // #10
+  KLV_BYTES(ImageSourceSensor),                     // #11
+  KLV_BYTES(ImageCoordinateSystem),                 // #12
+  KLV_UINT(SensorLatitude, 4),                      // #13
+  KLV_UINT(SensorLongitude, 4),                     // #14
+  KLV_UINT(SensorAltitude, 2),                      // #15
+  KLV_UINT(SensorHorizontalFieldOfView, 2),         // #16
+  KLV_UINT(SensorVerticalFieldOfView, 2),           // #17
+  KLV_UINT(SensorRelativeAzimuthAngle, 4),          // #18
+  KLV_UINT(SensorRelativeElevationAngle, 4),        // #19
+  KLV_UINT(SensorRelativeRollAngle, 4),             // #20
+  KLV_UINT(SlantRange, 4),                          // #21
+  KLV_UINT(TargetWidth, 2),                         // #22
+  KLV_UINT(FrameCenterLatitude, 4),                 // #23
+  KLV_UINT(FrameCenterLongitude, 4),                // #24
+  KLV_UINT(FrameCenterElevation, 2),                // #25
+  KLV_UINT(OffsetCornerLatitudePoint1, 2),          // #26
+  KLV_UINT(OffsetCornerLongitudePoint1, 2),         // #27
+  KLV_UINT(OffsetCornerLatitudePoint2, 2),          // #28
+  KLV_UINT(OffsetCornerLongitudePoint2, 2),         // #29
+  KLV_UINT(OffsetCornerLatitudePoint3, 2),          // #30
+  KLV_UINT(OffsetCornerLongitudePoint3, 2),         // #31
+  KLV_UINT(OffsetCornerLatitudePoint4, 2),          // #32
+  KLV_UINT(OffsetCornerLongitudePoint4, 2),         // #33
+  KLV_UINT(IcingDetected, 1),                       // #34
+  KLV_UINT(WindDirection, 2),                       // #35
+  KLV_UINT(WindSpeed, 1),                           // #36
+  KLV_UINT(StaticPressure, 2),                      // #37
+  KLV_UINT(DensityAltitude, 2),                     // #38
+  KLV_INT(OutsideAirTemp, 1),                       // #39
+  KLV_UINT(TargetLocationLatitude, 4),              // #40
+  KLV_UINT(TargetLocationLongitude, 4),             // #41
+  KLV_UINT(TargetLocationElevation, 2),             // #42
+  KLV_UINT(TargetTrackGateWidth, 1),                // #43
+  KLV_UINT(TargetTrackGateHeight, 1),               // #44
+  KLV_UINT(TargetErrorEstimateCE90, 2),             // #45
+  KLV_UINT(TargetErrorEstimateLE90, 2),             // #46
+  KLV_UINT(GenericFlagData, 1),                     // #47
+  KLV_TAG(SecurityLDS, KLV_TYPE_SECURITY, 0, 0),    // #48
+  KLV_UINT(DifferentialPressure, 2),                // #49
+  KLV_UINT(PlatformAngleOfAttack, 2),               // #50
+  KLV_UINT(PlatformVerticalSpeed, 2),               // #51
+  KLV_UINT(PlatformSideSlipAngle, 2),               // #52
+  KLV_UINT(AirfieldBarometricPressure, 2),          // #53
+  KLV_UINT(Elevation, 2),                           // #54
+  KLV_UINT(RelativeHumidity, 1),                    // #55
+  KLV_UINT(PlatformGroundSpeed, 1),                 // #56
+  KLV_UINT(GroundRange, 4),                         // #57
+  KLV_UINT(PlatformFuelRemaining, 2),               // #58
+  KLV_BYTES(PlatformCallSign),                      // #59
+  KLV_UINT(WeaponLoad, 2),                          // #60
+  KLV_UINT(WeaponFired, 1),                         // #61
+  KLV_UINT(LaserPRFCode, 2),                        // #62
+  KLV_UINT(SensorFieldOfViewName, 1),               // #63
+  KLV_UINT(PlatformMagneticHeading, 2),             // #64
+  KLV_UINT(UasLDSVersionNumber, 1),                 // #65
+  {0, 0, 0, KLV_TYPE_NONE},                         // #66
+  KLV_UINT(AlternatePlatformLatitude, 4),           // #67
+  KLV_UINT(AlternatePlatformLongitude, 4),          // #68
+  KLV_UINT(AlternatePlatformAltitude, 2),           // #69
+  KLV_BYTES(AlternatePlatformName),                 // #70
+  KLV_UINT(AlternatePlatformHeading, 2),            // #71
+  KLV_UINT(EventStartTime, 8),                      // #72
+  KLV_BYTES(Rvt),                                   // #73
+  KLV_TAG(VMti, KLV_TYPE_VMTI, 0, 0),               // #74
+  KLV_UINT(SensorEllipsoidHeight, 2),               // #75
+  KLV_UINT(AlternatePlatformEllipsoidHeight, 2),    // #76
+  KLV_UINT(OperationalMode, 1),                     // #77
+  KLV_UINT(FrameCenterHeightAboveEllipsoid, 2),     // #78
+  KLV_UINT(SensorNorthVelocity, 2),                 // #79
+  KLV_UINT(SensorEastVelocity, 2),                  // #80
+  KLV_BYTES(ImageHorizonPixelPack),                 // #81
+  KLV_UINT(CornerLatitudePoint1Full, 4),            // #82
+  KLV_UINT(CornerLongitudePoint1Full, 4),           // #83
+  KLV_UINT(CornerLatitudePoint2Full, 4),            // #84
+  KLV_UINT(CornerLongitudePoint2Full, 4),           // #85
+  KLV_UINT(CornerLatitudePoint3Full, 4),            // #86
+  KLV_UINT(CornerLongitudePoint3Full, 4),           // #87
+  KLV_UINT(CornerLatitudePoint4Full, 4),            // #88
+  KLV_UINT(CornerLongitudePoint4Full, 4),           // #89
+  KLV_UINT(PlatformPitchAngleFull, 4),              // #90
+  KLV_UINT(PlatformRollAngleFull, 4),               // #91
+  KLV_UINT(PlatformAngleOfAttackFull, 4),           // #92
+  KLV_UINT(PlatformSideSlipAngleFull, 4),           // #93
+  KLV_BYTES(MotionImageryCoreIdentifier),           // #94
+  KLV_BYTES(SARMotionImageryMetadata),              // #95
+  {0, 0, 0, KLV_TYPE_NONE},                         // #96
+  {0, 0, 0, KLV_TYPE_NONE},                         // #97
+  {0, 0, 0, KLV_TYPE_NONE},                         // #98
+  {0, 0, 0, KLV_TYPE_NONE},                         // #99
+  KLV_BYTES(ASMAappend),                            // #100
+};
 
+
+// ST 0601 running checksum: even bytes are the high byte of each 16-bit word,
+// odd bytes the low byte, so it is the two byte sums combined at the end.
 u16 Checksum(const u8 *src, u32 len)
 {
-  u32 j;
-  u32 checksum = 0;
-  for(j=0;j<len;j++){
-    checksum += src[j] << (8*((j+1)%2));
+  u32 j = 0;
+  u32 even = 0, odd = 0;
+#if USE_SSE2
+  const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sumEven = zero, sumOdd = zero;
+  for(; j+16<=len; j+=16){
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+    sumEven = _mm_add_epi64(sumEven, _mm_sad_epu8(_mm_and_si128(v, lowBytes), zero));
+    sumOdd = _mm_add_epi64(sumOdd, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
   }
-  return (u16)checksum;
+  sumEven = _mm_add_epi64(sumEven, _mm_srli_si128(sumEven, 8));
+  sumOdd = _mm_add_epi64(sumOdd, _mm_srli_si128(sumOdd, 8));
+  even = (u32)_mm_cvtsi128_si32(sumEven);
+  odd = (u32)_mm_cvtsi128_si32(sumOdd);
+#endif
+  for(; j+1<len; j+=2){
+    even += src[j];
+    odd += src[j+1];
+  }
+  if(j<len)
+    even += src[j];
+  return (u16)((even<<8) + odd);
 }
 
 static s32 ReadBer(const u8 *buffer, u16 *length)
@@ -79,60 +212,36 @@ static s32 ReadEl(const u8 *buffer, u16 len, u16 *val)
   return len;
 }
 
-static s32 ReadEl(const u8 *buffer, u16 len, u32 *val)
+// Big-endian integer of 1..8 bytes
+static u64 ReadUInt(const u8 *buffer, u16 len)
 {
-  if(len != 1 && len != 2 && len != 4)
-    return -1;
-  if(len==1)
-    *val = buffer[0];
-  else if(len==2)
-    *val = (buffer[0]<<8) | buffer[1];
-  else
-    *val = (buffer[0]<<24) | (buffer[1]<<16) | (buffer[2]<<8) | buffer[3];
-  return len;
-}
-
-static s32 ReadEl(const u8 *buffer, u16 len, u64 *val)
-{
-  if(len != 1 && len != 2 && len != 4 && len != 8)
-    return -1;
-
-  if(len<=4){
-    u32 tmp;
-    ReadEl(buffer, len, &tmp);
-    *val = tmp;
-    return len;
+  switch(len){
+    case 1: return buffer[0];
+    case 2: return (buffer[0]<<8) | buffer[1];
+    case 4: return ((u32)buffer[0]<<24) | (buffer[1]<<16) | (buffer[2]<<8) | buffer[3];
   }
   u64 v = 0;
-  for(int b=0;b<len;b++){
-    u64 tmp = buffer[b];
-    v |= tmp<<((7-b)*8);
-  }
-  *val = v;
-  return len;
-}
-
-static s32 ReadEl(const u8 *buffer, u16 len, s16 *val)
-{
-  return ReadEl(buffer, len, (u16*)val);
-}
-
-static s32 ReadEl(const u8 *buffer, u16 len, s32 *val)
-{
-  return ReadEl(buffer, len, (u32*)val);
+  for(u16 b=0;b<len;b++)
+    v = (v<<8) | buffer[b];
+  return v;
 }
 
-static s32 ReadEl(const u8 *buffer, u16 len, s64 *val)
+static void StoreInt(u8 *field, u16 size, u64 v)
 {
-  return ReadEl(buffer, len, (u64*)val);
+  switch(size){
+    case 1: *field = (u8)v; break;
+    case 2: *(u16*)field = (u16)v; break;
+    case 4: *(u32*)field = (u32)v; break;
+    default: *(u64*)field = v; break;
+  }
 }
 
 static s32 ReadEl(const u8 *buffer, u16 len, KLVBytes *b)
 {
-  int i;
-  b->len = (u8)SLMIN(len, sizeof(b->data));
-  for(i=0;i<b->len;i++)
-    b->data[i] = buffer[i];
+  if(!b->data)
+    return -1;   // KLVData was not set up with SLInitKLV
+  b->len = (u8)SLMIN(len, KLV_MAX_BYTE_ARRAY);
+  SLAMemcpy(b->data, buffer, b->len);
   return len;
 }
 
@@ -192,8 +301,10 @@ static s32 ReadElementSecurity(const u8 *buffer, KLVSecurityLocalSet *s)
   int j=1;
   u8 key = buffer[0];
   u16 len;
-  s32 rv;
-  j += ReadBer(&buffer[1], &len);
+  s32 rv = ReadBer(&buffer[1], &len);
+  if(rv<0)
+    return -1;
+  j += rv;
 
   s32 unknown = 0;
 
@@ -245,7 +356,7 @@ static s32 ReadEl(const u8 *buffer, u16 len, KLVSecurityLocalSet *s)
   s32 rv;
   for(u16 k=0;k<len;){
     rv = ReadElementSecurity(buffer+k, s);
-    if(rv<0)
+    if(rv<0 || k+rv>len)
       return -1;
     k+=rv;
   }
@@ -257,8 +368,10 @@ static s32 ReadElementTargetPack(const u8 *buffer, KLVVTargetPack *t)
   int j=1;
   u8 key = buffer[0];
   u16 len;
-  s32 rv;
-  j += ReadBer(&buffer[1], &len);
+  s32 rv = ReadBer(&buffer[1], &len);
+  if(rv<0)
+    return -1;
+  j += rv;
 
   s32 unknown = 0;
 
@@ -298,7 +411,10 @@ static s32 ReadTargetPack(const u8 *buffer, KLVVTargetPack *t)
   u16 len, beroidLen, j=0;
   s32 rv;
 
-  j += ReadBer(&buffer[0], &len);
+  rv = ReadBer(&buffer[0], &len);
+  if(rv<0)
+    return -1;
+  j += rv;
 
   // First value is id number w/o key or length
   beroidLen = ReadElementBEROID(buffer+j, &t->TargetIDNumber);
@@ -307,7 +423,7 @@ static s32 ReadTargetPack(const u8 *buffer, KLVVTargetPack *t)
   int k;
   for(k=0;k+beroidLen<len;){
     rv = ReadElementTargetPack(buffer+j+beroidLen+k, t);
-    if(rv<0)
+    if(rv<0 || k+beroidLen+rv>len)
       return -1;
     k += rv;
   }
@@ -321,8 +437,10 @@ static s32 ReadElementVmti(const u8 *buffer, KLVVmtiLocalSet *v)
   int j=1;
   u8 key = buffer[0];
   u16 len;
-  s32 rv;
-  j += ReadBer(&buffer[1], &len);
+  s32 rv = ReadBer(&buffer[1], &len);
+  if(rv<0)
+    return -1;
+  j += rv;
 
   s32 unknown = 0;
 
@@ -336,7 +454,7 @@ static s32 ReadElementVmti(const u8 *buffer, KLVVmtiLocalSet *v)
         //rv = ReadV(buffer, len, &v->nTargets);
         //break;
       case SL_LDS_KEY_VMTI_NUM_REPORTED_TARGETS:
-        rv = ReadV(buffer, len, &v->nTargets);
+        rv = ReadV(buffer, len, &v->nReported);
         break;
       case SL_LDS_KEY_VMTI_FRAME_WIDTH:
         rv = ReadV(buffer, len, &v->FrameWidth);
@@ -345,15 +463,19 @@ static s32 ReadElementVmti(const u8 *buffer, KLVVmtiLocalSet *v)
         rv = ReadV(buffer, len, &v->FrameHeight);
         break;
       case SL_LDS_KEY_VMTI_VTARGET_SERIES:
+        if(!v->Target)
+          return -1;
         i = nt = 0;
         while(i<len && nt<KLV_MAX_NUMBER_OF_TARGETS){
+          // A pack may leave out items, none may survive from an earlier packet
+          SLAMemset(&v->Target[nt], 0, sizeof(KLVVTargetPack));
           rv = ReadTargetPack(buffer+i, &v->Target[nt]);
-          if(rv<0)
+          if(rv<0 || i+rv>len)
             return -1;
           i += rv;
           nt++;
         }
-        v->nTargets = nt;  // may have already been set with SL_LDS_KEY_VMTI_NUM_REPORTED_TARGETS
+        v->nTargets = nt;
 
         rv = i;
         break;
@@ -372,10 +494,12 @@ static s32 ReadElementVmti(const u8 *buffer, KLVVmtiLocalSet *v)
 static s32 ReadEl(const u8 *buffer, u16 len, KLVVmtiLocalSet *v)
 {
   s32 rv;
+  // Only the packs of this set are valid, whatever count it reports
+  v->nTargets = 0;
   // Parse the records
   for(u16 k=0;k<len;){
     rv = ReadElementVmti(buffer+k, v);
-    if(rv<0)
+    if(rv<0 || k+rv>len)
       return -1;
     k += rv;
   }
@@ -384,328 +508,59 @@ static s32 ReadEl(const u8 *buffer, u16 len, KLVVmtiLocalSet *v)
 
 s32 ReadElement(const u8 *buf, u32 ldsOffset, KLVData *dest)
 {
-  int j=1;
   const u8 *buffer = buf+ldsOffset;
   u8 key = buffer[0];
-  s32 rv;
   u16 len;
-  j += ReadBer(&buffer[1], &len);
-
-  s32 unknown = 0;
+  s32 j = ReadBer(&buffer[1], &len);
+  if(j<0)
+    return -1;
+  j++;
 
   buffer += j;
-  if(dest){
-    switch(key){
-      case SL_LDS_KEY_CHECKSUM:
-        // Calculate checksum 
-        u16 cs, expectedCs;
-        expectedCs = Checksum(buf, ldsOffset+2);
-        rv = Read(buffer, len, &cs);
-        if(expectedCs != cs)
-          rv = -2;
-        break;
-      case SL_LDS_KEY_UTCTIME:
-        rv = Read(buffer, len, &dest->Utctime);
-        break;
-      case SL_LDS_KEY_MISSIONID:
-        rv = Read(buffer, len, &dest->Missionid);
-        break;
-      case SL_LDS_KEY_PLATFORMTAILNUMBER:
-        rv = Read(buffer, len, &dest->PlatformTailNumber);
-        break;
-      case SL_LDS_KEY_PLATFORMHEADINGANGLE:
-        rv = Read(buffer, len, &dest->PlatformHeadingAngle);
-        break;
-      case SL_LDS_KEY_PLATFORMPITCHANGLE:
-        rv = Read(buffer, len, &dest->PlatformPitchAngle);
-        break;
-      case SL_LDS_KEY_PLATFORMROLLANGLE:
-        rv = Read(buffer, len, &dest->PlatformRollAngle);
-        break;
-      case SL_LDS_KEY_PLATFORMTRUEAIRSPEED:
-        rv = Read(buffer, len, &dest->PlatformTrueAirSpeed);
-        break;
-      case SL_LDS_KEY_PLATFORMINDICATEDAIRSPEED:
-        rv = Read(buffer, len, &dest->PlatformIndicatedAirSpeed);
-        break;
-      case SL_LDS_KEY_PLATFORMDESIGNATION:
-        rv = Read(buffer, len, &dest->PlatformDesignation);
-        break;
-      case SL_LDS_KEY_IMAGESOURCESENSOR:
-        rv = Read(buffer, len, &dest->ImageSourceSensor);
-        break;
-      case SL_LDS_KEY_IMAGECOORDINATESYSTEM:
-        rv = Read(buffer, len, &dest->ImageCoordinateSystem);
-        break;
-      case SL_LDS_KEY_SENSORLATITUDE:
-        rv = Read(buffer, len, &dest->SensorLatitude);
-        break;
-      case SL_LDS_KEY_SENSORLONGITUDE:
-        rv = Read(buffer, len, &dest->SensorLongitude);
-        break;
-      case SL_LDS_KEY_SENSORALTITUDE:
-        rv = Read(buffer, len, &dest->SensorAltitude);
-        break;
-      case SL_LDS_KEY_SENSORHORIZONTALFIELDOFVIEW:
-        rv = Read(buffer, len, &dest->SensorHorizontalFieldOfView);
-        break;
-      case SL_LDS_KEY_SENSORVERTICALFIELDOFVIEW:
-        rv = Read(buffer, len, &dest->SensorVerticalFieldOfView);
-        break;
-      case SL_LDS_KEY_SENSORRELATIVEAZIMUTHANGLE:
-        rv = Read(buffer, len, &dest->SensorRelativeAzimuthAngle);
-        break;
-      case SL_LDS_KEY_SENSORRELATIVEELEVATIONANGLE:
-        rv = Read(buffer, len, &dest->SensorRelativeElevationAngle);
-        break;
-      case SL_LDS_KEY_SENSORRELATIVEROLLANGLE:
-        rv = Read(buffer, len, &dest->SensorRelativeRollAngle);
-        break;
-      case SL_LDS_KEY_SLANTRANGE:
-        rv = Read(buffer, len, &dest->SlantRange);
-        break;
-      case SL_LDS_KEY_TARGETWIDTH:
-        rv = Read(buffer, len, &dest->TargetWidth);
-        break;
-      case SL_LDS_KEY_FRAMECENTERLATITUDE:
-        rv = Read(buffer, len, &dest->FrameCenterLatitude);
-        break;
-      case SL_LDS_KEY_FRAMECENTERLONGITUDE:
-        rv = Read(buffer, len, &dest->FrameCenterLongitude);
-        break;
-      case SL_LDS_KEY_FRAMECENTERELEVATION:
-        rv = Read(buffer, len, &dest->FrameCenterElevation);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLATITUDEPOINT1:
-        rv = Read(buffer, len, &dest->OffsetCornerLatitudePoint1);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLONGITUDEPOINT1:
-        rv = Read(buffer, len, &dest->OffsetCornerLongitudePoint1);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLATITUDEPOINT2:
-        rv = Read(buffer, len, &dest->OffsetCornerLatitudePoint2);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLONGITUDEPOINT2:
-        rv = Read(buffer, len, &dest->OffsetCornerLongitudePoint2);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLATITUDEPOINT3:
-        rv = Read(buffer, len, &dest->OffsetCornerLatitudePoint3);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLONGITUDEPOINT3:
-        rv = Read(buffer, len, &dest->OffsetCornerLongitudePoint3);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLATITUDEPOINT4:
-        rv = Read(buffer, len, &dest->OffsetCornerLatitudePoint4);
-        break;
-      case SL_LDS_KEY_OFFSETCORNERLONGITUDEPOINT4:
-        rv = Read(buffer, len, &dest->OffsetCornerLongitudePoint4);
-        break;
-      case SL_LDS_KEY_ICINGDETECTED:
-        rv = Read(buffer, len, &dest->IcingDetected);
-        break;
-      case SL_LDS_KEY_WINDDIRECTION:
-        rv = Read(buffer, len, &dest->WindDirection);
-        break;
-      case SL_LDS_KEY_WINDSPEED:
-        rv = Read(buffer, len, &dest->WindSpeed);
-        break;
-      case SL_LDS_KEY_STATICPRESSURE:
-        rv = Read(buffer, len, &dest->StaticPressure);
-        break;
-      case SL_LDS_KEY_DENSITYALTITUDE:
-        rv = Read(buffer, len, &dest->DensityAltitude);
-        break;
-      case SL_LDS_KEY_OUTSIDEAIRTEMP:
-        rv = Read(buffer, len, (u8*)&dest->OutsideAirTemp);
-        break;
-      case SL_LDS_KEY_TARGETLOCATIONLATITUDE:
-        rv = Read(buffer, len, &dest->TargetLocationLatitude);
-        break;
-      case SL_LDS_KEY_TARGETLOCATIONLONGITUDE:
-        rv = Read(buffer, len, &dest->TargetLocationLongitude);
-        break;
-      case SL_LDS_KEY_TARGETLOCATIONELEVATION:
-        rv = Read(buffer, len, &dest->TargetLocationElevation);
-        break;
-      case SL_LDS_KEY_TARGETTRACKGATEWIDTH:
-        rv = Read(buffer, len, &dest->TargetTrackGateWidth);
-        break;
-      case SL_LDS_KEY_TARGETTRACKGATEHEIGHT:
-        rv = Read(buffer, len, &dest->TargetTrackGateHeight);
-        break;
-      case SL_LDS_KEY_TARGETERRORESTIMATECE90:
-        rv = Read(buffer, len, &dest->TargetErrorEstimateCE90);
-        break;
-      case SL_LDS_KEY_TARGETERRORESTIMATELE90:
-        rv = Read(buffer, len, &dest->TargetErrorEstimateLE90);
-        break;
-      case SL_LDS_KEY_GENERICFLAGDATA01:
-        rv = Read(buffer, len, &dest->GenericFlagData);
-        break;
-      case SL_LDS_KEY_SECURITYLOCALMETADATASET:
-        rv = Read(buffer, len, &dest->SecurityLDS);
-        break;
-      case SL_LDS_KEY_DIFFERENTIALPRESSURE:
-        rv = Read(buffer, len, &dest->DifferentialPressure);
-        break;
-      case SL_LDS_KEY_PLATFORMANGLEOFATTACK:
-        rv = Read(buffer, len, &dest->PlatformAngleOfAttack);
-        break;
-      case SL_LDS_KEY_PLATFORMVERTICALSPEED:
-        rv = Read(buffer, len, &dest->PlatformVerticalSpeed);
-        break;
-      case SL_LDS_KEY_PLATFORMSIDESLIPANGLE:
-        rv = Read(buffer, len, &dest->PlatformSideSlipAngle);
-        break;
-      case SL_LDS_KEY_AIRFIELDBAROMETRICPRESSURE:
-        rv = Read(buffer, len, &dest->AirfieldBarometricPressure);
-        break;
-      case SL_LDS_KEY_ELEVATION:
-        rv = Read(buffer, len, &dest->Elevation);
-        break;
-      case SL_LDS_KEY_RELATIVEHUMIDITY:
-        rv = Read(buffer, len, &dest->RelativeHumidity);
-        break;
-      case SL_LDS_KEY_PLATFORMGROUNDSPEED:
-        rv = Read(buffer, len, &dest->PlatformGroundSpeed);
-        break;
-      case SL_LDS_KEY_GROUNDRANGE:
-        rv = Read(buffer, len, &dest->GroundRange);
-        break;
-      case SL_LDS_KEY_PLATFORMFUELREMAINING:
-        rv = Read(buffer, len, &dest->PlatformFuelRemaining);
-        break;
-      case SL_LDS_KEY_PLATFORMCALLSIGN:
-        rv = Read(buffer, len, &dest->PlatformCallSign);
-        break;
-      case SL_LDS_KEY_WEAPONLOAD:
-        rv = Read(buffer, len, &dest->WeaponLoad);
-        break;
-      case SL_LDS_KEY_WEAPONFIRED:
-        rv = Read(buffer, len, &dest->WeaponFired);
-        break;
-      case SL_LDS_KEY_LASERPRFCODE:
-        rv = Read(buffer, len, &dest->LaserPRFCode);
-        break;
-      case SL_LDS_KEY_SENSORFIEDLOFVIEWNAME:
-        rv = Read(buffer, len, &dest->SensorFieldOfViewName);
-        break;
-      case SL_LDS_KEY_PLATFORMMAGNETICHEADING:
-        rv = Read(buffer, len, &dest->PlatformMagneticHeading);
-        break;
-      case SL_LDS_KEY_UASLDSVERSIONNUMBER:
-        rv = Read(buffer, len, &dest->UasLDSVersionNumber);
-        break;
-      case SL_LDS_KEY_TARGETLOCATIONCOVARIANCEMATRIX:
-        // This is TBD in MISB ST 0601.7, so ignore
-        rv = len;
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMLATITUDE:
-        rv = Read(buffer, len, &dest->AlternatePlatformLatitude);
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMLONGITUDE:
-        rv = Read(buffer, len, &dest->AlternatePlatformLongitude);
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMALTITUDE:
-        rv = Read(buffer, len, &dest->AlternatePlatformAltitude);
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMNAME:
-        rv = Read(buffer, len, &dest->AlternatePlatformName);
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMHEADING:
-        rv = Read(buffer, len, &dest->AlternatePlatformHeading);
-        break;
-      case SL_LDS_KEY_EVENTSTARTTIME:
-        rv = Read(buffer, len, &dest->EventStartTime);
-        break;
-      case SL_LDS_KEY_RVTLOCALDATASET:
-        // Could add parsing of this LDS in the future
-        // For now it's treated as a block of bytes
-        rv = Read(buffer, len, &dest->Rvt);
-        break;
-      case SL_LDS_KEY_VMTILOCALDATASET:
-        rv = Read(buffer, len, &dest->VMti);
-        break;
-      case SL_LDS_KEY_SENSORELLIPSOIDHEIGHT:
-        rv = Read(buffer, len, &dest->SensorEllipsoidHeight);
-        break;
-      case SL_LDS_KEY_ALTERNATEPLATFORMELLIPSOIDHEIGHT:
-        rv = Read(buffer, len, &dest->AlternatePlatformEllipsoidHeight);
-        break;
-      case SL_LDS_KEY_OPERATIONALMODE:
-        rv = Read(buffer, len, &dest->OperationalMode);
-        break;
-      case SL_LDS_KEY_FRAMECENTERHEIGHTABOVEELLIPSOID:
-        rv = Read(buffer, len, &dest->FrameCenterHeightAboveEllipsoid);
-        break;
-      case SL_LDS_KEY_SENSORNORTHVELOCITY:
-        rv = Read(buffer, len, &dest->SensorNorthVelocity);
-        break;
-      case SL_LDS_KEY_SENSOREASTVELOCITY:
-        rv = Read(buffer, len, &dest->SensorEastVelocity);
-        break;
-      case SL_LDS_KEY_IMAGEHORIZONPIXELPACK:
-        // Could add parsing of this field in the future
-        // For now it's treated as a block of bytes
-        rv = Read(buffer, len, &dest->ImageHorizonPixelPack);
-        break;
-      case SL_LDS_KEY_CORNERLATITUDEPOINT1FULL:
-        rv = Read(buffer, len, &dest->CornerLatitudePoint1Full);
-        break;
-      case SL_LDS_KEY_CORNERLONGITUDEPOINT1FULL:
-        rv = Read(buffer, len, &dest->CornerLongitudePoint1Full);
-        break;
-      case SL_LDS_KEY_CORNERLATITUDEPOINT2FULL:
-        rv = Read(buffer, len, &dest->CornerLatitudePoint2Full);
-        break;
-      case SL_LDS_KEY_CORNERLONGITUDEPOINT2FULL:
-        rv = Read(buffer, len, &dest->CornerLongitudePoint2Full);
-        break;
-      case SL_LDS_KEY_CORNERLATITUDEPOINT3FULL:
-        rv = Read(buffer, len, &dest->CornerLatitudePoint3Full);
-        break;
-      case SL_LDS_KEY_CORNERLONGITUDEPOINT3FULL:
-        rv = Read(buffer, len, &dest->CornerLongitudePoint3Full);
-        break;
-      case SL_LDS_KEY_CORNERLATITUDEPOINT4FULL:
-        rv = Read(buffer, len, &dest->CornerLatitudePoint4Full);
+  if(dest && key<KLV_PRESENT_TAGS){
+    const KLVTag *t = &klvTags[key];
+    u8 *field = (u8*)dest + t->offset;
+    s32 rv = len;
+    if(t->lenMask && (len>8 || !(t->lenMask & (1<<len))))
+      return -1;
+    switch(t->type){
+      case KLV_TYPE_NONE:
+        return j+len;
+      case KLV_TYPE_CHECKSUM:
+        if(Checksum(buf, ldsOffset+2) != (u16)ReadUInt(buffer, len))
+          return -1;
         break;
-      case SL_LDS_KEY_CORNERLONGITUDEPOINT4FULL:
-        rv = Read(buffer, len, &dest->CornerLongitudePoint4Full);
+      case KLV_TYPE_U8:
+        *field = (u8)ReadUInt(buffer, len);
         break;
-      case SL_LDS_KEY_PLATFORMPITCHANGLEFULL:
-        rv = Read(buffer, len, &dest->PlatformPitchAngleFull);
+      case KLV_TYPE_U16:
+        *(u16*)field = (u16)ReadUInt(buffer, len);
         break;
-      case SL_LDS_KEY_PLATFORMROLLANGLEFULL:
-        rv = Read(buffer, len, &dest->PlatformRollAngleFull);
+      case KLV_TYPE_U32:
+        *(u32*)field = (u32)ReadUInt(buffer, len);
         break;
-      case SL_LDS_KEY_PLATFORMANGLEOFATTACKFULL:
-        rv = Read(buffer, len, &dest->PlatformAngleOfAttackFull);
+      case KLV_TYPE_U64:
+        *(u64*)field = ReadUInt(buffer, len);
         break;
-      case SL_LDS_KEY_PLATFORMSIDESLIPANGLEFULL:
-        rv = Read(buffer, len, &dest->PlatformSideSlipAngleFull);
+      case KLV_TYPE_INT: {
+        u32 shift = 64 - 8*len;
+        StoreInt(field, t->size, (u64)((s64)(ReadUInt(buffer, len)<<shift)>>shift));
         break;
-      case SL_LDS_KEY_COREIDENTIFIER:
-        rv = Read(buffer, len, &dest->MotionImageryCoreIdentifier);
+      }
+      case KLV_TYPE_BYTES:
+        rv = ReadEl(buffer, len, (KLVBytes*)field);
         break;
-      case SL_LDS_KEY_SARMOTIONIMAGERYMETADATA:
-        // Could add parsing of this LDS in the future
-        // For now it's treated as a block of bytes
-        rv = Read(buffer, len, &dest->SARMotionImageryMetadata);
+      case KLV_TYPE_SECURITY:
+        rv = ReadEl(buffer, len, (KLVSecurityLocalSet*)field);
         break;
-      case SL_LDS_KEY_APPEND_METADATA:
-        // Parsing of this LDS is done by the user. 
-        // Also, This is not yet offically in the standard (AD, 6.22.2016)
-        rv = Read(buffer, len, &dest->ASMAappend);
-        break;
-      default:
-        SLATrace("Unkown KLV key:%x\n", key);
-        unknown++;
-        rv = len;
+      case KLV_TYPE_VMTI:
+        rv = ReadEl(buffer, len, (KLVVmtiLocalSet*)field);
         break;
     }
     if(rv!=len)
       return -1;
+    if(t->size)
+      KLV_SET_PRESENT(dest, key);
   }
   return j+len;
 }
@@ -717,13 +572,11 @@ s32 ReadKeyLength(const u8* buf, u16 len, u16 *bytesRead, u16 *klvLen, u16 *head
     return 0;
   }
 
-  int j=0;
-  u64 k0,k1;
-  do {
-    k0 = k1 = 0;
-
-    // Scan for first byte of universal key
-    for(;j<len && buf[j]!= CONST_K0_FIRST_BYTE; j++);
+  // memchr finds the candidates, one compare checks the whole key
+  u32 j=0;
+  for(;;) {
+    const u8 *p = (const u8*)memchr(buf+j, SLUniversalKey[0], len-j);
+    j = p ? (u32)(p-buf) : len;
 
     if(len < j+19) {
       if(headerStart)
@@ -732,21 +585,12 @@ s32 ReadKeyLength(const u8* buf, u16 len, u16 *bytesRead, u16 *klvLen, u16 *head
       *klvLen = 0;
       return 0;
     }
-
-    // Check for universal key
-    for(int b=0;b<8;b++){
-      u64 tmp = buf[j+b];
-      k0 |= tmp<<((7-b)*8);
-    }
-    for(int b=0;b<8;b++){
-      u64 tmp = buf[j+b+8];
-      k1 |= tmp<<((7-b)*8);
-    }
-    // If do loop continues, next byte should be inspected
+    if(!memcmp(buf+j, SLUniversalKey, sizeof(SLUniversalKey)))
+      break;
     j++;
-  } while ((k0 != CONST_K0) || (k1 != CONST_K1));
+  }
   // Adjust j to past the 16-byte key
-  j += 15;
+  j += sizeof(SLUniversalKey);
 
   s32 rv = ReadBer(buf+j, klvLen);
   if(rv<0){
@@ -805,116 +649,557 @@ s32 ReadKlvFrame(KLVData *klv, const u8* buf, u16 len, s32 bufStartOffset)
 }
 
 #define CopyEl(dst, src, u, el) if(s->el!=u.el) d->el = s->el
-#define CopyElBytes(dst, src, u, el) if(s->el.len != u.el.len) d->el = s->el
+#define CopyElBytes(dst, src, u, el) if(s->el.len != u.el.len) CopyBytes(&d->el, &s->el)
+
+// Only the bytes in use are copied, into d's own storage
+static void CopyBytes(KLVBytes *d, const KLVBytes *s)
+{
+  d->len = s->len;
+  SLAMemcpy(d->data, s->data, s->len);
+}
 
 void SLCopyChangedKLV(KLVData *d, KLVData *s)
 {
-  CopyEl(d,s,KLVUnknown,Utctime);
-  CopyElBytes(d,s,KLVUnknown,Missionid);
-  CopyElBytes(d,s,KLVUnknown,PlatformTailNumber);
-  CopyEl(d,s,KLVUnknown,PlatformHeadingAngle);
-  CopyEl(d,s,KLVUnknown,PlatformPitchAngle);
-  CopyEl(d,s,KLVUnknown,PlatformRollAngle);
-  CopyEl(d,s,KLVUnknown,PlatformTrueAirSpeed);
-  CopyEl(d,s,KLVUnknown,PlatformIndicatedAirSpeed);
-  CopyElBytes(d,s,KLVUnknown,PlatformDesignation);
-  CopyElBytes(d,s,KLVUnknown,ImageSourceSensor);
-  CopyElBytes(d,s,KLVUnknown,ImageCoordinateSystem);
-  CopyEl(d,s,KLVUnknown,SensorLatitude);
-  CopyEl(d,s,KLVUnknown,SensorLongitude);
-  CopyEl(d,s,KLVUnknown,SensorAltitude);
-  CopyEl(d,s,KLVUnknown,SensorHorizontalFieldOfView);
-  CopyEl(d,s,KLVUnknown,SensorVerticalFieldOfView);
-  CopyEl(d,s,KLVUnknown,SensorRelativeAzimuthAngle);
-  CopyEl(d,s,KLVUnknown,SensorRelativeElevationAngle);
-  CopyEl(d,s,KLVUnknown,SensorRelativeRollAngle);
-  CopyEl(d,s,KLVUnknown,SlantRange);
-  CopyEl(d,s,KLVUnknown,TargetWidth);
-  CopyEl(d,s,KLVUnknown,FrameCenterLatitude);
-  CopyEl(d,s,KLVUnknown,FrameCenterLongitude);
-  CopyEl(d,s,KLVUnknown,FrameCenterElevation);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLatitudePoint1);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLongitudePoint1);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLatitudePoint2);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLongitudePoint2);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLatitudePoint3);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLongitudePoint3);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLatitudePoint4);
-  CopyEl(d,s,KLVUnknown,OffsetCornerLongitudePoint4);
-  CopyEl(d,s,KLVUnknown,IcingDetected);
-  CopyEl(d,s,KLVUnknown,WindDirection);
-  CopyEl(d,s,KLVUnknown,WindSpeed);
-  CopyEl(d,s,KLVUnknown,StaticPressure);
-  CopyEl(d,s,KLVUnknown,DensityAltitude);
-  CopyEl(d,s,KLVUnknown,OutsideAirTemp);
-  CopyEl(d,s,KLVUnknown,TargetLocationLatitude);
-  CopyEl(d,s,KLVUnknown,TargetLocationLongitude);
-  CopyEl(d,s,KLVUnknown,TargetLocationElevation);
-  CopyEl(d,s,KLVUnknown,TargetTrackGateWidth);
-  CopyEl(d,s,KLVUnknown,TargetTrackGateHeight);
-  CopyEl(d,s,KLVUnknown,TargetErrorEstimateCE90);
-  CopyEl(d,s,KLVUnknown,TargetErrorEstimateLE90);
-  CopyEl(d,s,KLVUnknown,GenericFlagData);
-  CopyEl(d,s,KLVUnknown,SecurityLDS.Classification);
-  CopyEl(d,s,KLVUnknown,SecurityLDS.ClassifyingCountryCodingMethod);
-  CopyElBytes(d,s,KLVUnknown,SecurityLDS.ClassifyingCountry);
-  CopyElBytes(d,s,KLVUnknown,SecurityLDS.SCISHIInformation);
-  CopyElBytes(d,s,KLVUnknown,SecurityLDS.Caveats);
-  CopyElBytes(d,s,KLVUnknown,SecurityLDS.ReleasingInstructions);
-  CopyEl(d,s,KLVUnknown,SecurityLDS.ObjectCountryCodingMethod);
-  CopyElBytes(d,s,KLVUnknown,SecurityLDS.ObjectCountryCodes);
-  CopyEl(d,s,KLVUnknown,SecurityLDS.SecurityMetadataVersion);
-  CopyEl(d,s,KLVUnknown,DifferentialPressure);
-  CopyEl(d,s,KLVUnknown,PlatformAngleOfAttack);
-  CopyEl(d,s,KLVUnknown,PlatformVerticalSpeed);
-  CopyEl(d,s,KLVUnknown,PlatformSideSlipAngle);
-  CopyEl(d,s,KLVUnknown,AirfieldBarometricPressure);
-  CopyEl(d,s,KLVUnknown,Elevation);
-  CopyEl(d,s,KLVUnknown,RelativeHumidity);
-  CopyEl(d,s,KLVUnknown,PlatformGroundSpeed);
-  CopyEl(d,s,KLVUnknown,GroundRange);
-  CopyEl(d,s,KLVUnknown,PlatformFuelRemaining);
-  CopyElBytes(d,s,KLVUnknown,PlatformCallSign);
-  CopyEl(d,s,KLVUnknown,WeaponLoad);
-  CopyEl(d,s,KLVUnknown,WeaponFired);
-  CopyEl(d,s,KLVUnknown,LaserPRFCode);
-  CopyEl(d,s,KLVUnknown,SensorFieldOfViewName);
-  CopyEl(d,s,KLVUnknown,PlatformMagneticHeading);
-  CopyEl(d,s,KLVUnknown,UasLDSVersionNumber);
-  CopyEl(d,s,KLVUnknown,AlternatePlatformLatitude);
-  CopyEl(d,s,KLVUnknown,AlternatePlatformLongitude);
-  CopyEl(d,s,KLVUnknown,AlternatePlatformAltitude);
-  CopyElBytes(d,s,KLVUnknown,AlternatePlatformName);
-  CopyEl(d,s,KLVUnknown,AlternatePlatformHeading);
-  CopyEl(d,s,KLVUnknown,EventStartTime);
-  CopyElBytes(d,s,KLVUnknown,Rvt);
-  CopyEl(d,s,KLVUnknown,VMti.FrameHeight);
-  CopyEl(d,s,KLVUnknown,VMti.FrameWidth);
-  CopyEl(d,s,KLVUnknown,VMti.Version);
+  // Targets only describe the frame they were sent with
   d->VMti.nTargets = s->VMti.nTargets;
-  if(s->VMti.nTargets != KLVUnknown.VMti.nTargets)
-    SLAMemcpy(d->VMti.Target, s->VMti.Target, sizeof(s->VMti.Target));
-  CopyEl(d,s,KLVUnknown,SensorEllipsoidHeight);
-  CopyEl(d,s,KLVUnknown,AlternatePlatformEllipsoidHeight);
-  CopyEl(d,s,KLVUnknown,OperationalMode);
-  CopyEl(d,s,KLVUnknown,FrameCenterHeightAboveEllipsoid);
-  CopyEl(d,s,KLVUnknown,SensorNorthVelocity);
-  CopyEl(d,s,KLVUnknown,SensorEastVelocity);
-  CopyElBytes(d,s,KLVUnknown,ImageHorizonPixelPack);
-  CopyEl(d,s,KLVUnknown,CornerLatitudePoint1Full);
-  CopyEl(d,s,KLVUnknown,CornerLongitudePoint1Full);
-  CopyEl(d,s,KLVUnknown,CornerLatitudePoint2Full);
-  CopyEl(d,s,KLVUnknown,CornerLongitudePoint2Full);
-  CopyEl(d,s,KLVUnknown,CornerLatitudePoint3Full);
-  CopyEl(d,s,KLVUnknown,CornerLongitudePoint3Full);
-  CopyEl(d,s,KLVUnknown,CornerLatitudePoint4Full);
-  CopyEl(d,s,KLVUnknown,CornerLongitudePoint4Full);
-  CopyEl(d,s,KLVUnknown,PlatformPitchAngleFull);
-  CopyEl(d,s,KLVUnknown,PlatformRollAngleFull);
-  CopyEl(d,s,KLVUnknown,PlatformAngleOfAttackFull);
-  CopyEl(d,s,KLVUnknown,PlatformSideSlipAngleFull);
-  CopyElBytes(d,s,KLVUnknown,MotionImageryCoreIdentifier);
-  CopyElBytes(d,s,KLVUnknown,SARMotionImageryMetadata);
-  CopyElBytes(d,s,KLVUnknown,ASMAappend);
+
+  for(u32 w=0;w<KLV_PRESENT_WORDS;w++){
+    u32 bits = s->Present[w];
+    d->Present[w] |= bits;
+    for(u32 tag=w*32;bits;tag++,bits>>=1){
+      if(!(bits & 1))
+        continue;
+      switch(klvTags[tag].type){
+        case KLV_TYPE_BYTES:
+          CopyBytes((KLVBytes*)((u8*)d + klvTags[tag].offset), (KLVBytes*)((u8*)s + klvTags[tag].offset));
+          break;
+        case KLV_TYPE_SECURITY:
+          // The local set may carry only some of its items
+          CopyEl(d,s,KLVUnknown,SecurityLDS.Classification);
+          CopyEl(d,s,KLVUnknown,SecurityLDS.ClassifyingCountryCodingMethod);
+          CopyElBytes(d,s,KLVUnknown,SecurityLDS.ClassifyingCountry);
+          CopyElBytes(d,s,KLVUnknown,SecurityLDS.SCISHIInformation);
+          CopyElBytes(d,s,KLVUnknown,SecurityLDS.Caveats);
+          CopyElBytes(d,s,KLVUnknown,SecurityLDS.ReleasingInstructions);
+          CopyEl(d,s,KLVUnknown,SecurityLDS.ObjectCountryCodingMethod);
+          CopyElBytes(d,s,KLVUnknown,SecurityLDS.ObjectCountryCodes);
+          CopyEl(d,s,KLVUnknown,SecurityLDS.SecurityMetadataVersion);
+          break;
+        case KLV_TYPE_VMTI:
+          CopyEl(d,s,KLVUnknown,VMti.FrameHeight);
+          CopyEl(d,s,KLVUnknown,VMti.FrameWidth);
+          CopyEl(d,s,KLVUnknown,VMti.Version);
+          d->VMti.nReported = s->VMti.nReported;
+          SLAMemcpy(d->VMti.Target, s->VMti.Target,
+                    SLMIN(s->VMti.nTargets, KLV_MAX_NUMBER_OF_TARGETS)*sizeof(KLVVTargetPack));
+          break;
+        default:
+          SLAMemcpy((u8*)d + klvTags[tag].offset, (u8*)s + klvTags[tag].offset, klvTags[tag].size);
+          break;
+      }
+    }
+  }
+}
+
+void SLResetKLV(KLVData *k)
+{
+  for(u32 w=0;w<KLV_PRESENT_WORDS;w++){
+    u32 bits = k->Present[w];
+    for(u32 tag=w*32;bits;tag++,bits>>=1){
+      if(!(bits & 1))
+        continue;
+      // Strings and targets keep pointing at their storage
+      switch(klvTags[tag].type){
+        case KLV_TYPE_BYTES:
+          ((KLVBytes*)((u8*)k + klvTags[tag].offset))->len = 0;
+          break;
+        case KLV_TYPE_SECURITY: {
+          KLVSecurityLocalSet *s = &k->SecurityLDS;
+          const KLVSecurityLocalSet *u = &KLVUnknown.SecurityLDS;
+          s->Classification = u->Classification;
+          s->ClassifyingCountryCodingMethod = u->ClassifyingCountryCodingMethod;
+          s->ClassifyingCountry.len = s->SCISHIInformation.len = s->Caveats.len = 0;
+          s->ReleasingInstructions.len = s->ObjectCountryCodes.len = 0;
+          s->ObjectCountryCodingMethod = u->ObjectCountryCodingMethod;
+          s->SecurityMetadataVersion = u->SecurityMetadataVersion;
+          break;
+        }
+        case KLV_TYPE_VMTI:
+          k->VMti.nTargets = KLVUnknown.VMti.nTargets;
+          k->VMti.nReported = KLVUnknown.VMti.nReported;
+          k->VMti.Version = KLVUnknown.VMti.Version;
+          k->VMti.FrameWidth = KLVUnknown.VMti.FrameWidth;
+          k->VMti.FrameHeight = KLVUnknown.VMti.FrameHeight;
+          break;
+        default:
+          SLAMemcpy((u8*)k + klvTags[tag].offset, (const u8*)&KLVUnknown + klvTags[tag].offset, klvTags[tag].size);
+          break;
+      }
+    }
+    k->Present[w] = 0;
+  }
+}
+
+// The KLVBytes of k in KLVStore::bytes order
+static void StoreFields(const KLVData *k, KLVBytes *f[KLV_STORE_STRINGS])
+{
+  u32 n = 0;
+  for(u32 tag=0;tag<KLV_PRESENT_TAGS;tag++){
+    if(klvTags[tag].type == KLV_TYPE_BYTES)
+      f[n++] = (KLVBytes*)((u8*)k + klvTags[tag].offset);
+  }
+  f[n++] = (KLVBytes*)&k->SecurityLDS.ClassifyingCountry;
+  f[n++] = (KLVBytes*)&k->SecurityLDS.SCISHIInformation;
+  f[n++] = (KLVBytes*)&k->SecurityLDS.Caveats;
+  f[n++] = (KLVBytes*)&k->SecurityLDS.ReleasingInstructions;
+  f[n++] = (KLVBytes*)&k->SecurityLDS.ObjectCountryCodes;
+}
+
+void SLBindKLV(KLVData *k, KLVStore *store)
+{
+  KLVBytes *f[KLV_STORE_STRINGS];
+  StoreFields(k, f);
+  for(u32 n=0;n<KLV_STORE_STRINGS;n++)
+    f[n]->data = store->bytes[n];
+  k->VMti.Target = store->targets;
+}
+
+void SLInitKLV(KLVData *k, KLVStore *store)
+{
+  SLAMemcpy(k, &KLVUnknown, sizeof(KLVData));
+  SLBindKLV(k, store);
+}
+
+void SLCopyKLV(KLVData *d, KLVStore *store, const KLVData *s)
+{
+  KLVBytes *df[KLV_STORE_STRINGS], *sf[KLV_STORE_STRINGS];
+  SLAMemcpy(d, s, sizeof(KLVData));
+  SLBindKLV(d, store);
+  StoreFields(d, df);
+  StoreFields(s, sf);
+  for(u32 n=0;n<KLV_STORE_STRINGS;n++){
+    if(sf[n]->data)
+      SLAMemcpy(df[n]->data, sf[n]->data, sf[n]->len);
+    else
+      df[n]->len = 0;
+  }
+  if(s->VMti.Target)
+    SLAMemcpy(d->VMti.Target, s->VMti.Target, SLMIN(s->VMti.nTargets, KLV_MAX_NUMBER_OF_TARGETS)*sizeof(KLVVTargetPack));
+  else
+    d->VMti.nTargets = 0;
+}
+
+// ST 0601 integer mappings: signed items map -(2^(n-1)-1)..2^(n-1)-1, with
+// -2^(n-1) reserved for "out of range"; unsigned items map 0..2^n-1
+#define KLV_S16_SPAN 65534.0
+#define KLV_S32_SPAN 4294967294.0
+#define KLV_U16_SPAN 65535.0
+#define KLV_U32_SPAN 4294967295.0
+#define KLV_S16_ERROR ((s16)0x8000)
+#define KLV_S32_ERROR ((s32)0x80000000)
+
+// Index of a double of KLVGeo in KLVGeoInput::raw
+#define GEO_SLOT(f) ((offsetof(KLVGeo, f) - offsetof(KLVGeo, platformHeading))/sizeof(double))
+
+// KLVGeoInput::forms, items sent in the other of their two forms
+enum {
+  GEO_SHORT_PITCH    = 0x1,   // #6 rather than #90
+  GEO_SHORT_ROLL     = 0x2,   // #7 rather than #91
+  GEO_OFFSET_CORNERS = 0x4,   // #26.. rather than #82..
+};
+
+// Scale and bias of each double of KLVGeo, for the long forms
+static const double geoScale[KLV_GEO_VALUES] = {
+  360.0/KLV_U16_SPAN,                                               // platformHeading
+  180.0/KLV_S32_SPAN, 180.0/KLV_S32_SPAN,                           // platformPitch, platformRoll
+  180.0/KLV_S32_SPAN, 360.0/KLV_S32_SPAN, 19900.0/KLV_U16_SPAN,     // sensorLat, sensorLon, sensorAlt
+  360.0/KLV_U32_SPAN, 360.0/KLV_S32_SPAN, 360.0/KLV_U32_SPAN,       // sensorAzimuth, sensorElevation, sensorRoll
+  180.0/KLV_U16_SPAN, 180.0/KLV_U16_SPAN, 5000000.0/KLV_U32_SPAN,   // hfov, vfov, slantRange
+  180.0/KLV_S32_SPAN, 360.0/KLV_S32_SPAN, 19900.0/KLV_U16_SPAN,     // centerLat, centerLon, centerElevation
+  180.0/KLV_S32_SPAN, 180.0/KLV_S32_SPAN, 180.0/KLV_S32_SPAN, 180.0/KLV_S32_SPAN,   // cornerLat
+  360.0/KLV_S32_SPAN, 360.0/KLV_S32_SPAN, 360.0/KLV_S32_SPAN, 360.0/KLV_S32_SPAN,   // cornerLon
+};
+static const double geoBias[KLV_GEO_VALUES] = {
+  0.0, 0.0, 0.0, 0.0, 0.0, -900.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, -900.0,
+  0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+};
+
+// Items with the non-extended ST 0601 lengths only, longer values are left out
+static void GatherGeo(const KLVData *k, KLVGeoInput *in)
+{
+  u32 valid = 0, forms = 0;
+  double *raw = in->raw;
+  s32 i;
+
+  SLAMemset(in, 0, sizeof(KLVGeoInput));
+
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_PLATFORMHEADINGANGLE) && k->PlatformHeadingAngle <= 0xFFFF){
+    raw[GEO_SLOT(platformHeading)] = k->PlatformHeadingAngle;
+    valid |= KLV_GEO_PLATFORM_HEADING;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_PLATFORMPITCHANGLEFULL) && k->PlatformPitchAngleFull != KLV_S32_ERROR){
+    raw[GEO_SLOT(platformPitch)] = k->PlatformPitchAngleFull;
+    valid |= KLV_GEO_PLATFORM_PITCH;
+  }
+  else if(KLV_IS_PRESENT(k, SL_LDS_KEY_PLATFORMPITCHANGLE) && k->PlatformPitchAngle != KLV_S16_ERROR){
+    raw[GEO_SLOT(platformPitch)] = k->PlatformPitchAngle;
+    valid |= KLV_GEO_PLATFORM_PITCH;
+    forms |= GEO_SHORT_PITCH;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_PLATFORMROLLANGLEFULL) && k->PlatformRollAngleFull != KLV_S32_ERROR){
+    raw[GEO_SLOT(platformRoll)] = k->PlatformRollAngleFull;
+    valid |= KLV_GEO_PLATFORM_ROLL;
+  }
+  else if(KLV_IS_PRESENT(k, SL_LDS_KEY_PLATFORMROLLANGLE) && k->PlatformRollAngle != KLV_S16_ERROR){
+    raw[GEO_SLOT(platformRoll)] = k->PlatformRollAngle;
+    valid |= KLV_GEO_PLATFORM_ROLL;
+    forms |= GEO_SHORT_ROLL;
+  }
+
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORLATITUDE) && KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORLONGITUDE) &&
+     k->SensorLatitude != KLV_S32_ERROR && k->SensorLongitude != KLV_S32_ERROR){
+    raw[GEO_SLOT(sensorLat)] = k->SensorLatitude;
+    raw[GEO_SLOT(sensorLon)] = k->SensorLongitude;
+    valid |= KLV_GEO_SENSOR_POSITION;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORALTITUDE) && k->SensorAltitude <= 0xFFFF){
+    raw[GEO_SLOT(sensorAlt)] = k->SensorAltitude;
+    valid |= KLV_GEO_SENSOR_ALTITUDE;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORRELATIVEAZIMUTHANGLE) && k->SensorRelativeAzimuthAngle <= 0xFFFFFFFF){
+    raw[GEO_SLOT(sensorAzimuth)] = (double)k->SensorRelativeAzimuthAngle;
+    valid |= KLV_GEO_SENSOR_AZIMUTH;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORRELATIVEELEVATIONANGLE) && k->SensorRelativeElevationAngle != KLV_S32_ERROR){
+    raw[GEO_SLOT(sensorElevation)] = k->SensorRelativeElevationAngle;
+    valid |= KLV_GEO_SENSOR_ELEVATION;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORRELATIVEROLLANGLE) && k->SensorRelativeRollAngle <= 0xFFFFFFFF){
+    raw[GEO_SLOT(sensorRoll)] = (double)k->SensorRelativeRollAngle;
+    valid |= KLV_GEO_SENSOR_ROLL;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORHORIZONTALFIELDOFVIEW) && KLV_IS_PRESENT(k, SL_LDS_KEY_SENSORVERTICALFIELDOFVIEW) &&
+     k->SensorHorizontalFieldOfView <= 0xFFFF && k->SensorVerticalFieldOfView <= 0xFFFF){
+    raw[GEO_SLOT(hfov)] = k->SensorHorizontalFieldOfView;
+    raw[GEO_SLOT(vfov)] = k->SensorVerticalFieldOfView;
+    valid |= KLV_GEO_FIELD_OF_VIEW;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_SLANTRANGE) && k->SlantRange <= 0xFFFFFFFF){
+    raw[GEO_SLOT(slantRange)] = (double)k->SlantRange;
+    valid |= KLV_GEO_SLANT_RANGE;
+  }
+
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_FRAMECENTERLATITUDE) && KLV_IS_PRESENT(k, SL_LDS_KEY_FRAMECENTERLONGITUDE) &&
+     k->FrameCenterLatitude != KLV_S32_ERROR && k->FrameCenterLongitude != KLV_S32_ERROR){
+    raw[GEO_SLOT(centerLat)] = k->FrameCenterLatitude;
+    raw[GEO_SLOT(centerLon)] = k->FrameCenterLongitude;
+    valid |= KLV_GEO_CENTER;
+  }
+  if(KLV_IS_PRESENT(k, SL_LDS_KEY_FRAMECENTERELEVATION) && k->FrameCenterElevation <= 0xFFFF){
+    raw[GEO_SLOT(centerElevation)] = k->FrameCenterElevation;
+    valid |= KLV_GEO_CENTER_ELEVATION;
+  }
+
+  // Full corners when all eight are there, otherwise the offsets from the center
+  const s32 *full = &k->CornerLatitudePoint1Full;
+  const s16 *offset = &k->OffsetCornerLatitudePoint1;
+  u32 nFull = 0, nOffset = 0;
+  for(i=0;i<8;i++){
+    nFull += KLV_IS_PRESENT(k, SL_LDS_KEY_CORNERLATITUDEPOINT1FULL+i) && full[i] != KLV_S32_ERROR;
+    nOffset += KLV_IS_PRESENT(k, SL_LDS_KEY_OFFSETCORNERLATITUDEPOINT1+i) && offset[i] != KLV_S16_ERROR;
+  }
+  if(nFull == 8){
+    for(i=0;i<4;i++){
+      raw[GEO_SLOT(cornerLat)+i] = full[2*i];
+      raw[GEO_SLOT(cornerLon)+i] = full[2*i+1];
+    }
+    valid |= KLV_GEO_CORNERS;
+  }
+  else if(nOffset == 8 && (valid & KLV_GEO_CENTER)){
+    for(i=0;i<4;i++){
+      raw[GEO_SLOT(cornerLat)+i] = offset[2*i];
+      raw[GEO_SLOT(cornerLon)+i] = offset[2*i+1];
+    }
+    valid |= KLV_GEO_CORNERS;
+    forms |= GEO_OFFSET_CORNERS;
+  }
+
+  in->valid = valid;
+  in->forms = forms;
+}
+
+// out[i] = raw[i]*scale[i] + bias[i] for every double of KLVGeo, two at a time with SSE2
+static void MapGeoValues(const double *raw, const double *scale, const double *bias, double *out)
+{
+  s32 i = 0;
+#if USE_SSE2
+  for(;i+2<=KLV_GEO_VALUES;i+=2){
+    __m128d v = _mm_mul_pd(_mm_loadu_pd(raw+i), _mm_loadu_pd(scale+i));
+    _mm_storeu_pd(out+i, _mm_add_pd(v, _mm_loadu_pd(bias+i)));
+  }
+#endif
+  for(;i<KLV_GEO_VALUES;i++)
+    out[i] = raw[i]*scale[i] + bias[i];
+}
+
+#define KLV_RAD (3.14159265358979323846/180.0)
+#define WGS84_A 6378137.0
+#define WGS84_E2 6.69437999014e-3
+
+// Yaw, pitch, roll rotation in degrees, taking x forward, y right, z down to north, east, down
+static void RotationYpr(double yaw, double pitch, double roll, double m[3][3])
+{
+  double cy = cos(yaw*KLV_RAD), sy = sin(yaw*KLV_RAD);
+  double cp = cos(pitch*KLV_RAD), sp = sin(pitch*KLV_RAD);
+  double cr = cos(roll*KLV_RAD), sr = sin(roll*KLV_RAD);
+  m[0][0] = cy*cp;  m[0][1] = cy*sp*sr - sy*cr;  m[0][2] = cy*sp*cr + sy*sr;
+  m[1][0] = sy*cp;  m[1][1] = sy*sp*sr + cy*cr;  m[1][2] = sy*sp*cr - cy*sr;
+  m[2][0] = -sp;    m[2][1] = cp*sr;             m[2][2] = cp*cr;
+}
+
+// Fill in the corners, and the center if it was not sent, where the sensor's line of
+// sight and the rays through the image corners meet a level ground. The ground is at
+// the frame center elevation, else at the end of the slant range, else at sea level.
+// Flat earth around the sensor, good while the footprint is a few km.
+static void GeoFromPose(KLVGeo *geo)
+{
+  const u32 needed = KLV_GEO_SENSOR_POSITION | KLV_GEO_SENSOR_ALTITUDE | KLV_GEO_FIELD_OF_VIEW |
+                     KLV_GEO_PLATFORM_HEADING | KLV_GEO_SENSOR_AZIMUTH | KLV_GEO_SENSOR_ELEVATION;
+  if((geo->valid & needed) != needed || (geo->valid & (KLV_GEO_CENTER | KLV_GEO_CORNERS)) == (KLV_GEO_CENTER | KLV_GEO_CORNERS))
+    return;
+
+  // Sensor to platform to north, east, down. Missing pitch and rolls are 0.
+  double p[3][3], s[3][3], m[3][3];
+  RotationYpr(geo->platformHeading, geo->platformPitch, geo->platformRoll, p);
+  RotationYpr(geo->sensorAzimuth, geo->sensorElevation, geo->sensorRoll, s);
+  s32 i, j;
+  for(i=0;i<3;i++)
+    for(j=0;j<3;j++)
+      m[i][j] = p[i][0]*s[0][j] + p[i][1]*s[1][j] + p[i][2]*s[2][j];
+
+  // Height above the ground
+  double ground = 0.0;
+  if(geo->valid & KLV_GEO_CENTER_ELEVATION)
+    ground = geo->centerElevation;
+  else if(geo->valid & KLV_GEO_SLANT_RANGE)
+    ground = geo->sensorAlt - geo->slantRange*m[2][0];
+  double height = geo->sensorAlt - ground;
+  if(height <= 0.0)
+    return;
+
+  // Meters to degrees at the sensor
+  double sinLat = sin(geo->sensorLat*KLV_RAD);
+  double cosLat = cos(geo->sensorLat*KLV_RAD);
+  double w = 1.0 - WGS84_E2*sinLat*sinLat;
+  double perLat = 1.0/(KLV_RAD*WGS84_A*(1.0 - WGS84_E2)/(w*sqrt(w)));
+  double perLon = cosLat > 1e-9 ? 1.0/(KLV_RAD*WGS84_A/sqrt(w)*cosLat) : 0.0;
+
+  // Line of sight, then corners 1..4 from the upper left, clockwise
+  double tx = tan(0.5*geo->hfov*KLV_RAD);
+  double tz = tan(0.5*geo->vfov*KLV_RAD);
+  static const double cx[5] = {0, -1, 1, 1, -1};
+  static const double cz[5] = {0, -1, -1, 1, 1};
+  double lat[5], lon[5];
+  for(i=0;i<5;i++){
+    double y = cx[i]*tx, z = cz[i]*tz;
+    double north = m[0][0] + m[0][1]*y + m[0][2]*z;
+    double east  = m[1][0] + m[1][1]*y + m[1][2]*z;
+    double down  = m[2][0] + m[2][1]*y + m[2][2]*z;
+    // At or above the horizon
+    if(down <= 1e-6)
+      return;
+    double t = height/down;
+    lat[i] = geo->sensorLat + t*north*perLat;
+    lon[i] = geo->sensorLon + t*east*perLon;
+    if(lon[i] >= 180.0)
+      lon[i] -= 360.0;
+    else if(lon[i] < -180.0)
+      lon[i] += 360.0;
+  }
+
+  if(!(geo->valid & KLV_GEO_CENTER)){
+    geo->centerLat = lat[0];
+    geo->centerLon = lon[0];
+    geo->valid |= KLV_GEO_CENTER;
+  }
+  if(!(geo->valid & KLV_GEO_CORNERS)){
+    for(i=0;i<4;i++){
+      geo->cornerLat[i] = lat[i+1];
+      geo->cornerLon[i] = lon[i+1];
+    }
+    geo->valid |= KLV_GEO_CORNERS;
+  }
+  geo->valid |= KLV_GEO_FROM_POSE;
 }
 
+static void ConvertGeo(const KLVGeoInput *in, KLVGeo *geo)
+{
+  const double *scale = geoScale;
+  double shortScale[KLV_GEO_VALUES];
+  s32 i;
+
+  if(in->forms){
+    SLAMemcpy(shortScale, geoScale, sizeof(shortScale));
+    if(in->forms & GEO_SHORT_PITCH)
+      shortScale[GEO_SLOT(platformPitch)] = 40.0/KLV_S16_SPAN;
+    if(in->forms & GEO_SHORT_ROLL)
+      shortScale[GEO_SLOT(platformRoll)] = 100.0/KLV_S16_SPAN;
+    if(in->forms & GEO_OFFSET_CORNERS){
+      for(i=0;i<8;i++)
+        shortScale[GEO_SLOT(cornerLat)+i] = 0.15/KLV_S16_SPAN;
+    }
+    scale = shortScale;
+  }
+
+  geo->pts = 0;
+  geo->valid = in->valid;
+  MapGeoValues(in->raw, scale, geoBias, &geo->platformHeading);
+  if(!(in->valid & KLV_GEO_SENSOR_ALTITUDE))
+    geo->sensorAlt = 0.0;
+  if(!(in->valid & KLV_GEO_CENTER_ELEVATION))
+    geo->centerElevation = 0.0;
+  if(in->forms & GEO_OFFSET_CORNERS){
+    for(i=0;i<4;i++){
+      geo->cornerLat[i] += geo->centerLat;
+      geo->cornerLon[i] += geo->centerLon;
+    }
+  }
+  GeoFromPose(geo);
+}
+
+void SLKlvToGeo(const KLVData *k, KLVGeo *geo)
+{
+  KLVGeoInput in;
+  GatherGeo(k, &in);
+  ConvertGeo(&in, geo);
+}
+
+void SLInitKLVGeoCache(KLVGeoCache *c)
+{
+  SLAMemset(c, 0, sizeof(KLVGeoCache));
+  c->in.valid = 0xFFFFFFFF;   // never gathered, so the first call converts
+}
+
+const KLVGeo *SLKlvToGeoCached(KLVGeoCache *c, const KLVData *k)
+{
+  KLVGeoInput in;
+  GatherGeo(k, &in);
+  if(memcmp(&in, &c->in, sizeof(KLVGeoInput))){
+    c->in = in;
+    ConvertGeo(&in, &c->geo);
+  }
+  return &c->geo;
+}
+
+// Start of the first set in data: a full universal key, or the part of one at the end
+// of data. len if there is none.
+static u32 FindKeyStart(const u8 *data, u32 len)
+{
+  u32 j = 0;
+  for(;;) {
+    const u8 *p = (const u8*)memchr(data+j, SLUniversalKey[0], len-j);
+    if(!p)
+      return len;
+    j = (u32)(p-data);
+    if(!memcmp(data+j, SLUniversalKey, SLMIN(len-j, sizeof(SLUniversalKey))))
+      return j;
+    j++;
+  }
+}
+
+// Length of the set whose first n bytes are at hdr, 0 if its header is incomplete,
+// -1 if hdr is not the start of a set
+static s32 SetLength(const u8 *hdr, u32 n)
+{
+  if(memcmp(hdr, SLUniversalKey, SLMIN(n, sizeof(SLUniversalKey))))
+    return -1;
+  if(n < 17)
+    return 0;
+  if(hdr[16] < 0x80)
+    return 17 + hdr[16];
+  if(hdr[16] == 0x81)
+    return n < 18 ? 0 : 18 + hdr[17];
+  if(hdr[16] == 0x82)
+    return n < 19 ? 0 : 19 + ((hdr[17]<<8) | hdr[18]);
+  return -1;
+}
+
+void SLInitKLVParser(KLVParser *p)
+{
+  p->have = p->total = p->skip = 0;
+}
+
+u32 SLParseKLV(KLVParser *p, const u8 *data, u32 len, const u8 **set, u32 *setLen)
+{
+  u32 used = 0;
+  s32 total;
+
+  *set = NULL;
+  *setLen = 0;
+  while(used < len) {
+    if(p->skip) {
+      u32 n = SLMIN(p->skip, len-used);
+      p->skip -= n;
+      used += n;
+    }
+    else if(!p->have) {
+      // Nothing held back: a set that is all in data is returned in place
+      used += FindKeyStart(data+used, len-used);
+      if(used == len)
+        break;
+      u32 n = len-used;
+      total = SetLength(data+used, n);
+      if(total < 0) {
+        used++;
+        continue;
+      }
+      if(total > 0 && (u32)total <= n) {
+        *set = data+used;
+        *setLen = total;
+        return used+total;
+      }
+      if(total > KLV_MAX_SET_LENGTH) {
+        SLATrace("KLV local set of %d bytes skipped\n", total);
+        p->skip = total-n;
+      } else {
+        SLAMemcpy(p->buf, data+used, n);
+        p->have = n;
+        p->total = total;
+      }
+      used = len;
+    }
+    else if(!p->total) {
+      // The header was split, complete it a byte at a time
+      p->buf[p->have++] = data[used++];
+      total = SetLength(p->buf, p->have);
+      while(total < 0) {
+        // Not a key after all, look again after its first byte
+        u32 j = 1 + FindKeyStart(p->buf+1, p->have-1);
+        memmove(p->buf, p->buf+j, p->have-j);
+        p->have -= j;
+        total = p->have ? SetLength(p->buf, p->have) : 0;
+      }
+      if(total > KLV_MAX_SET_LENGTH) {
+        SLATrace("KLV local set of %d bytes skipped\n", total);
+        p->skip = total-p->have;
+        p->have = 0;
+      }
+      else
+        p->total = total;
+    }
+    else {
+      u32 n = SLMIN(p->total-p->have, len-used);
+      SLAMemcpy(p->buf+p->have, data+used, n);
+      p->have += n;
+      used += n;
+    }
+
+    if(p->total && p->have == p->total) {
+      *set = p->buf;
+      *setLen = p->total;
+      p->have = p->total = 0;
+      return used;
+    }
+  }
+  return used;
+}
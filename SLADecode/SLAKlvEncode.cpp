@@ -0,0 +1,363 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "SLAKlvEncode.h"
+#include "SLAKlvDecode.h"
+#include "SLAHal.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_HEADER_SIZE 4
+
+typedef struct {
+  u8 *buf;
+  u32 pos;
+  u32 size;
+  s32 full;   // set once anything did not fit, later writes are dropped
+} KLVWriter;
+
+static void Put(KLVWriter *w, const u8 *src, u32 len)
+{
+  if(w->full || w->pos+len > w->size) {
+    w->full = 1;
+    return;
+  }
+  SLAMemcpy(w->buf+w->pos, src, len);
+  w->pos += len;
+}
+
+static void PutByte(KLVWriter *w, u8 b)
+{
+  Put(w, &b, 1);
+}
+
+// Big-endian, the low len bytes of v
+static void PutUInt(KLVWriter *w, u64 v, u32 len)
+{
+  u8 tmp[8];
+  for(u32 b=0;b<len;b++)
+    tmp[b] = (u8)(v >> (8*(len-1-b)));
+  Put(w, tmp, len);
+}
+
+static u32 BerLength(u8 *dst, u32 len)
+{
+  if(len<128) {
+    dst[0] = (u8)len;
+    return 1;
+  }
+  if(len<256) {
+    dst[0] = 0x81;
+    dst[1] = (u8)len;
+    return 2;
+  }
+  dst[0] = 0x82;
+  dst[1] = (u8)(len>>8);
+  dst[2] = (u8)len;
+  return 3;
+}
+
+// Reserve the longest BER length the decoder reads for a set whose size is not known yet
+static u32 OpenSet(KLVWriter *w)
+{
+  u32 at = w->pos;
+  u8 ber[3] = {0x82, 0, 0};
+  Put(w, ber, sizeof(ber));
+  return at;
+}
+
+// Fill in the set length, moving the contents down when a shorter BER form fits
+static void CloseSet(KLVWriter *w, u32 at)
+{
+  if(w->full)
+    return;
+  u32 len = w->pos - at - 3;
+  if(len > 0xFFFF) {
+    w->full = 1;
+    return;
+  }
+  u8 ber[3];
+  u32 n = BerLength(ber, len);
+  if(n<3)
+    memmove(w->buf+at+n, w->buf+at+3, len);
+  SLAMemcpy(w->buf+at, ber, n);
+  w->pos -= 3-n;
+}
+
+static void PutItem(KLVWriter *w, u8 key, const u8 *v, u32 len)
+{
+  u8 ber[3];
+  PutByte(w, key);
+  Put(w, ber, BerLength(ber, len));
+  Put(w, v, len);
+}
+
+static void PutUIntItem(KLVWriter *w, u8 key, u64 v, u32 len)
+{
+  u8 hdr[2] = {key, (u8)len};
+  Put(w, hdr, sizeof(hdr));
+  PutUInt(w, v, len);
+}
+
+// Fewest bytes holding v
+static u32 MinLen(u64 v)
+{
+  u32 len = 1;
+  while(len<8 && (v >> (8*len)))
+    len++;
+  return len;
+}
+
+// The ST 0601 length, widened to 2, 4 or 8 bytes for an extended value
+static u32 WideLen(u64 v, u32 len, u32 size)
+{
+  while(len<size && (v >> (8*len)))
+    len = len<2 ? 2 : 2*len;
+  return len;
+}
+
+static u64 FieldUInt(const u8 *field, u16 size)
+{
+  switch(size) {
+    case 1: return *field;
+    case 2: return *(const u16*)field;
+    case 4: return *(const u32*)field;
+  }
+  return *(const u64*)field;
+}
+
+// Signed fields widen while v does not sign extend from len bytes
+static u32 WideIntLen(s64 v, u32 len, u32 size)
+{
+  while(len<size && (v < -((s64)1 << (8*len-1)) || v >= ((s64)1 << (8*len-1))))
+    len = len<2 ? 2 : 2*len;
+  return len;
+}
+
+static s64 FieldInt(const u8 *field, u16 size)
+{
+  switch(size) {
+    case 1: return *(const s8*)field;
+    case 2: return *(const s16*)field;
+    case 4: return *(const s32*)field;
+  }
+  return *(const s64*)field;
+}
+
+static void PutBytesItem(KLVWriter *w, u8 key, const KLVBytes *b)
+{
+  if(b->len)
+    PutItem(w, key, b->data, b->len);
+}
+
+static void WriteSecurity(KLVWriter *w, const KLVSecurityLocalSet *s)
+{
+  const KLVSecurityLocalSet *u = &KLVUnknown.SecurityLDS;
+  if(s->Classification != u->Classification)
+    PutUIntItem(w, SL_LDS_KEY_SECURITY_CLASSIFICATION, s->Classification, 1);
+  if(s->ClassifyingCountryCodingMethod != u->ClassifyingCountryCodingMethod)
+    PutUIntItem(w, SL_LDS_KEY_SECURITY_CLASSIFYINGCOUNTRYCODINGMETHOD, s->ClassifyingCountryCodingMethod, 1);
+  PutBytesItem(w, SL_LDS_KEY_SECURITY_CLASSIFYINGCOUNTRY, &s->ClassifyingCountry);
+  PutBytesItem(w, SL_LDS_KEY_SECURITY_SCISHIINFORMATION, &s->SCISHIInformation);
+  PutBytesItem(w, SL_LDS_KEY_SECURITY_CAVEATS, &s->Caveats);
+  PutBytesItem(w, SL_LDS_KEY_SECURITY_RELEASINGINSTRUCTIONS, &s->ReleasingInstructions);
+  if(s->ObjectCountryCodingMethod != u->ObjectCountryCodingMethod)
+    PutUIntItem(w, SL_LDS_KEY_SECURITY_OBJECTCOUNTRYCODINGMETHOD, s->ObjectCountryCodingMethod, 1);
+  PutBytesItem(w, SL_LDS_KEY_SECURITY_OBJECTCOUNTRYCODES, &s->ObjectCountryCodes);
+  if(s->SecurityMetadataVersion != u->SecurityMetadataVersion)
+    PutUIntItem(w, SL_LDS_KEY_SECURITY_METADATAVERSION, s->SecurityMetadataVersion, 2);
+}
+
+// ST 0903 target ids are BER-OID, 7 bits per byte with the top bit set on all but the last
+static void PutBerOid(KLVWriter *w, u32 v)
+{
+  u8 tmp[5];
+  u32 n = 0;
+  do {
+    tmp[4-n] = (u8)((v & 0x7F) | (n ? 0x80 : 0));
+    v >>= 7;
+    n++;
+  } while(v);
+  Put(w, tmp+5-n, n);
+}
+
+static void WriteTargetPack(KLVWriter *w, const KLVVTargetPack *t)
+{
+  u32 pack = OpenSet(w);
+  PutBerOid(w, t->TargetIDNumber);
+  if(t->TargetCentroidPixelNumber)
+    PutUIntItem(w, SL_LDS_KEY_VTARGET_CENTROID_PIXEL, t->TargetCentroidPixelNumber, MinLen(t->TargetCentroidPixelNumber));
+  if(t->BoundingBoxTopLeftPixelNumber)
+    PutUIntItem(w, SL_LDS_KEY_VTARGET_BOUNDING_BOX_TOP_LEFT, t->BoundingBoxTopLeftPixelNumber, MinLen(t->BoundingBoxTopLeftPixelNumber));
+  if(t->BoundingBoxBottomRightPixelNumber)
+    PutUIntItem(w, SL_LDS_KEY_VTARGET_BOUNDING_BOX_BOTTOM_RIGHT, t->BoundingBoxBottomRightPixelNumber, MinLen(t->BoundingBoxBottomRightPixelNumber));
+  if(t->TargetConfidenceNumber)
+    PutUIntItem(w, SL_LDS_KEY_VTARGET_TARGET_CONFIDENCE_LEVEL, t->TargetConfidenceNumber, 1);
+  CloseSet(w, pack);
+}
+
+static void WriteVmti(KLVWriter *w, const KLVVmtiLocalSet *v)
+{
+  u32 n = SLMIN(v->nTargets, KLV_MAX_NUMBER_OF_TARGETS);
+  if(v->Version)
+    PutUIntItem(w, SL_LDS_KEY_VMTI_VERSION, v->Version, MinLen(v->Version));
+  u32 reported = SLMAX((u32)v->nReported, n);
+  PutUIntItem(w, SL_LDS_KEY_VMTI_NUM_REPORTED_TARGETS, reported, MinLen(reported));
+  if(v->FrameWidth)
+    PutUIntItem(w, SL_LDS_KEY_VMTI_FRAME_WIDTH, v->FrameWidth, MinLen(v->FrameWidth));
+  if(v->FrameHeight)
+    PutUIntItem(w, SL_LDS_KEY_VMTI_FRAME_HEIGHT, v->FrameHeight, MinLen(v->FrameHeight));
+  if(n) {
+    PutByte(w, SL_LDS_KEY_VMTI_VTARGET_SERIES);
+    u32 series = OpenSet(w);
+    for(u32 i=0;i<n;i++)
+      WriteTargetPack(w, &v->Target[i]);
+    CloseSet(w, series);
+  }
+}
+
+u32 WriteKlvFrame(const KLVData *klv, const u32 *present, u8 *buf, u32 maxLen)
+{
+  KLVWriter w = {buf, 0, maxLen, 0};
+  if(!present)
+    present = klv->Present;
+
+  Put(&w, SLUniversalKey, sizeof(SLUniversalKey));
+  u32 set = OpenSet(&w);
+
+  for(u32 tag=0;tag<KLV_PRESENT_TAGS && !w.full;tag++) {
+    const KLVTag *t = &klvTags[tag];
+    if(!t->size || !((present[tag>>5] >> (tag&31)) & 1))
+      continue;
+    const u8 *field = (const u8*)klv + t->offset;
+    u64 v;
+    switch(t->type) {
+      case KLV_TYPE_U8:
+      case KLV_TYPE_U16:
+      case KLV_TYPE_U32:
+      case KLV_TYPE_U64:
+        v = FieldUInt(field, t->size);
+        PutUIntItem(&w, (u8)tag, v, WideLen(v, t->wireLen, t->size));
+        break;
+      case KLV_TYPE_INT:
+        v = (u64)FieldInt(field, t->size);
+        PutUIntItem(&w, (u8)tag, v, WideIntLen((s64)v, t->wireLen, t->size));
+        break;
+      case KLV_TYPE_BYTES:
+        PutItem(&w, (u8)tag, ((const KLVBytes*)field)->data, ((const KLVBytes*)field)->len);
+        break;
+      case KLV_TYPE_SECURITY: {
+        PutByte(&w, (u8)tag);
+        u32 at = OpenSet(&w);
+        WriteSecurity(&w, (const KLVSecurityLocalSet*)field);
+        CloseSet(&w, at);
+        break;
+      }
+      case KLV_TYPE_VMTI: {
+        PutByte(&w, (u8)tag);
+        u32 at = OpenSet(&w);
+        WriteVmti(&w, (const KLVVmtiLocalSet*)field);
+        CloseSet(&w, at);
+        break;
+      }
+    }
+  }
+
+  // The checksum covers everything up to and including its own key and length
+  u8 cs[4] = {SL_LDS_KEY_CHECKSUM, 2, 0, 0};
+  Put(&w, cs, sizeof(cs));
+  CloseSet(&w, set);
+  if(w.full)
+    return 0;
+  u16 sum = Checksum(buf, w.pos-2);
+  buf[w.pos-2] = (u8)(sum>>8);
+  buf[w.pos-1] = (u8)sum;
+  return w.pos;
+}
+
+void SLAKlvTsInit(SLAKlvTsMux *mux, u16 pid)
+{
+  SLAMemset(mux, 0, sizeof(SLAKlvTsMux));
+  mux->pid = pid & 0x1FFF;
+}
+
+// 33-bit timestamp with its 4-bit prefix and marker bits
+static void PutPts(KLVWriter *w, u8 prefix, s64 pts)
+{
+  u8 tmp[5];
+  u64 t = (u64)pts & 0x1FFFFFFFFull;
+  tmp[0] = (u8)((prefix<<4) | ((t>>29) & 0x0E) | 1);
+  tmp[1] = (u8)(t>>22);
+  tmp[2] = (u8)(((t>>14) & 0xFE) | 1);
+  tmp[3] = (u8)(t>>7);
+  tmp[4] = (u8)(((t<<1) & 0xFE) | 1);
+  Put(w, tmp, sizeof(tmp));
+}
+
+u32 SLAKlvTsWrite(SLAKlvTsMux *mux, const u8 *klv, u32 klvLen, s64 pts, u8 *ts, u32 maxLen)
+{
+  // PES header and, for synchronous metadata, the metadata AU cell header
+  u8 pes[19];
+  KLVWriter h = {pes, 0, sizeof(pes), 0};
+  bool sync = pts != SLA_KLV_NO_PTS;
+  u32 pesLen = 3 + (sync ? 5 + 5 : 0) + klvLen;   // bytes after PES_packet_length
+  if(pesLen > 0xFFFF)
+    return 0;
+
+  u8 start[4] = {0, 0, 1, (u8)(sync ? 0xFC : 0xBD)};
+  Put(&h, start, sizeof(start));
+  PutUInt(&h, pesLen, 2);
+  PutByte(&h, 0x84);                // data_alignment_indicator
+  PutByte(&h, sync ? 0x80 : 0x00);  // PTS only
+  PutByte(&h, sync ? 5 : 0);
+  if(sync) {
+    PutPts(&h, 2, pts);
+    PutByte(&h, 0);                 // metadata_service_id
+    PutByte(&h, mux->sequence++);
+    PutByte(&h, 0xDF);              // complete cell, random access point
+    PutUInt(&h, klvLen, 2);
+  }
+
+  u32 total = h.pos + klvLen;
+  u32 packets = (total + TS_PACKET_SIZE-TS_HEADER_SIZE-1) / (TS_PACKET_SIZE-TS_HEADER_SIZE);
+  if(packets*TS_PACKET_SIZE > maxLen)
+    return 0;
+
+  u32 done = 0;
+  for(u32 i=0;i<packets;i++) {
+    u8 *p = ts + i*TS_PACKET_SIZE;
+    u32 payload = SLMIN(total-done, TS_PACKET_SIZE-TS_HEADER_SIZE);
+    u32 stuff = TS_PACKET_SIZE-TS_HEADER_SIZE - payload;
+
+    p[0] = 0x47;
+    p[1] = (u8)((i==0 ? 0x40 : 0) | (mux->pid>>8));
+    p[2] = (u8)mux->pid;
+    p[3] = (u8)((stuff ? 0x30 : 0x10) | mux->cc);
+    mux->cc = (mux->cc+1) & 0x0F;
+
+    // The last packet is padded with an adaptation field
+    u8 *q = p + TS_HEADER_SIZE;
+    if(stuff) {
+      q[0] = (u8)(stuff-1);
+      if(stuff>1) {
+        q[1] = 0;
+        SLAMemset(q+2, 0xFF, stuff-2);
+      }
+      q += stuff;
+    }
+
+    // Payload is the PES header followed by the local set
+    u32 n = 0;
+    if(done < h.pos) {
+      n = SLMIN(payload, h.pos-done);
+      SLAMemcpy(q, pes+done, n);
+    }
+    if(payload > n)
+      SLAMemcpy(q+n, klv+done+n-h.pos, payload-n);
+    done += payload;
+  }
+  return packets*TS_PACKET_SIZE;
+}
@@ -0,0 +1,567 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <string.h>
+#include "SLAKlvExtract.h"
+#include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLAHal.h"
+
+#define TS_PACKET 188
+#define READ_BLOCK (TS_PACKET*8192)   // 1.5 MB per read, so the file is read at disk speed
+#define MAX_LINE 65536
+#define AU_CELL_HEADER 5    // metadata_service_id, sequence_number, flags, cell_data_length
+
+// Tags with a signed field in KLVData.  The tag table reads them as unsigned
+// because the wire length is the field size.
+static const u8 signedTags[] = {
+  6, 7, 13, 14, 19, 23, 24, 26, 27, 28, 29, 30, 31, 32, 33, 39, 40, 41,
+  50, 51, 52, 67, 68, 79, 80, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93
+};
+
+static bool isSignedTag(u32 tag)
+{
+  for(u32 i=0; i<sizeof(signedTags); i++) {
+    if(signedTags[i] == tag)
+      return true;
+  }
+  return false;
+}
+
+// Tags with a column: everything the decoder stores except the checksum
+static bool hasColumn(u32 tag)
+{
+  return klvTags[tag].size && klvTags[tag].type != KLV_TYPE_CHECKSUM;
+}
+
+typedef struct {
+  char *p;
+  char *end;        // one short of the buffer end, for the terminating 0
+  bool quoting;     // inside a quoted CSV cell, quotes are doubled
+} TextOut;
+
+static void putChar(TextOut *o, char c)
+{
+  if(o->quoting && c == '"' && o->p < o->end)
+    *o->p++ = '"';
+  if(o->p < o->end)
+    *o->p++ = c;
+}
+
+static void putText(TextOut *o, const char *s)
+{
+  while(*s)
+    putChar(o, *s++);
+}
+
+static void putU64(TextOut *o, u64 v)
+{
+  char tmp[20];
+  s32 n = 0;
+  do {
+    tmp[n++] = (char)('0' + v%10);
+    v /= 10;
+  } while(v);
+  while(n)
+    putChar(o, tmp[--n]);
+}
+
+static void putS64(TextOut *o, s64 v)
+{
+  if(v < 0) {
+    putChar(o, '-');
+    putU64(o, 0 - (u64)v);
+  } else {
+    putU64(o, (u64)v);
+  }
+}
+
+// Quotes, backslashes, control and non-ASCII bytes are escaped
+static void putJsonString(TextOut *o, const u8 *s, u32 len)
+{
+  static const char hex[] = "0123456789abcdef";
+  putChar(o, '"');
+  for(u32 i=0; i<len; i++) {
+    u8 c = s[i];
+    if(c == '"' || c == '\\') {
+      putChar(o, '\\');
+      putChar(o, (char)c);
+    } else if(c < 0x20 || c >= 0x7F) {
+      putText(o, "\\u00");
+      putChar(o, hex[c >> 4]);
+      putChar(o, hex[c & 15]);
+    } else {
+      putChar(o, (char)c);
+    }
+  }
+  putChar(o, '"');
+}
+
+// "tag":  with a leading comma for all but the first key of an object
+static void putKey(TextOut *o, u32 tag, bool *first)
+{
+  if(!*first)
+    putChar(o, ',');
+  *first = false;
+  putChar(o, '"');
+  putU64(o, tag);
+  putText(o, "\":");
+}
+
+static void putBytesItem(TextOut *o, u32 tag, const KLVBytes *b, bool *first)
+{
+  if(!b->len)
+    return;
+  putKey(o, tag, first);
+  putJsonString(o, b->data, b->len);
+}
+
+// Items that differ from KLVUnknown, as the encoder writes them
+static void putSecurity(TextOut *o, const KLVSecurityLocalSet *s)
+{
+  const KLVSecurityLocalSet *u = &KLVUnknown.SecurityLDS;
+  bool first = true;
+  putChar(o, '{');
+  if(s->Classification != u->Classification) {
+    putKey(o, SL_LDS_KEY_SECURITY_CLASSIFICATION, &first);
+    putU64(o, s->Classification);
+  }
+  if(s->ClassifyingCountryCodingMethod != u->ClassifyingCountryCodingMethod) {
+    putKey(o, SL_LDS_KEY_SECURITY_CLASSIFYINGCOUNTRYCODINGMETHOD, &first);
+    putU64(o, s->ClassifyingCountryCodingMethod);
+  }
+  putBytesItem(o, SL_LDS_KEY_SECURITY_CLASSIFYINGCOUNTRY, &s->ClassifyingCountry, &first);
+  putBytesItem(o, SL_LDS_KEY_SECURITY_SCISHIINFORMATION, &s->SCISHIInformation, &first);
+  putBytesItem(o, SL_LDS_KEY_SECURITY_CAVEATS, &s->Caveats, &first);
+  putBytesItem(o, SL_LDS_KEY_SECURITY_RELEASINGINSTRUCTIONS, &s->ReleasingInstructions, &first);
+  if(s->ObjectCountryCodingMethod != u->ObjectCountryCodingMethod) {
+    putKey(o, SL_LDS_KEY_SECURITY_OBJECTCOUNTRYCODINGMETHOD, &first);
+    putU64(o, s->ObjectCountryCodingMethod);
+  }
+  putBytesItem(o, SL_LDS_KEY_SECURITY_OBJECTCOUNTRYCODES, &s->ObjectCountryCodes, &first);
+  if(s->SecurityMetadataVersion != u->SecurityMetadataVersion) {
+    putKey(o, SL_LDS_KEY_SECURITY_METADATAVERSION, &first);
+    putU64(o, s->SecurityMetadataVersion);
+  }
+  putChar(o, '}');
+}
+
+// Targets are objects with their id and the ST 0903 pack items that are set
+static void putVmti(TextOut *o, const KLVVmtiLocalSet *v)
+{
+  const KLVVmtiLocalSet *u = &KLVUnknown.VMti;
+  bool first = true;
+  putChar(o, '{');
+  if(v->Version != u->Version) {
+    putKey(o, SL_LDS_KEY_VMTI_VERSION, &first);
+    putU64(o, v->Version);
+  }
+  if(v->nReported != u->nReported) {
+    putKey(o, SL_LDS_KEY_VMTI_NUM_REPORTED_TARGETS, &first);
+    putU64(o, v->nReported);
+  }
+  if(v->FrameWidth != u->FrameWidth) {
+    putKey(o, SL_LDS_KEY_VMTI_FRAME_WIDTH, &first);
+    putU64(o, v->FrameWidth);
+  }
+  if(v->FrameHeight != u->FrameHeight) {
+    putKey(o, SL_LDS_KEY_VMTI_FRAME_HEIGHT, &first);
+    putU64(o, v->FrameHeight);
+  }
+  putKey(o, SL_LDS_KEY_VMTI_VTARGET_SERIES, &first);
+  putChar(o, '[');
+  // The packs decoded from this set, the reported count may be larger
+  u32 n = SLMIN(v->nTargets, KLV_MAX_NUMBER_OF_TARGETS);
+  for(u32 i=0; i<n; i++) {
+    const KLVVTargetPack *t = &v->Target[i];
+    bool firstItem = true;
+    if(i)
+      putChar(o, ',');
+    putText(o, "{\"id\":");
+    putU64(o, t->TargetIDNumber);
+    firstItem = false;
+    if(t->TargetCentroidPixelNumber) {
+      putKey(o, SL_LDS_KEY_VTARGET_CENTROID_PIXEL, &firstItem);
+      putU64(o, t->TargetCentroidPixelNumber);
+    }
+    if(t->BoundingBoxTopLeftPixelNumber) {
+      putKey(o, SL_LDS_KEY_VTARGET_BOUNDING_BOX_TOP_LEFT, &firstItem);
+      putU64(o, t->BoundingBoxTopLeftPixelNumber);
+    }
+    if(t->BoundingBoxBottomRightPixelNumber) {
+      putKey(o, SL_LDS_KEY_VTARGET_BOUNDING_BOX_BOTTOM_RIGHT, &firstItem);
+      putU64(o, t->BoundingBoxBottomRightPixelNumber);
+    }
+    if(t->TargetConfidenceNumber) {
+      putKey(o, SL_LDS_KEY_VTARGET_TARGET_CONFIDENCE_LEVEL, &firstItem);
+      putU64(o, t->TargetConfidenceNumber);
+    }
+    putChar(o, '}');
+  }
+  putText(o, "]}");
+}
+
+static void putValue(TextOut *o, const KLVData *klv, u32 tag)
+{
+  const KLVTag *t = &klvTags[tag];
+  const u8 *f = (const u8*)klv + t->offset;
+  bool isSigned = t->type == KLV_TYPE_INT || isSignedTag(tag);
+
+  switch(t->type) {
+    case KLV_TYPE_BYTES:
+      putJsonString(o, ((const KLVBytes*)f)->data, ((const KLVBytes*)f)->len);
+      break;
+    case KLV_TYPE_SECURITY:
+      putSecurity(o, (const KLVSecurityLocalSet*)f);
+      break;
+    case KLV_TYPE_VMTI:
+      putVmti(o, (const KLVVmtiLocalSet*)f);
+      break;
+    default:
+      switch(t->size) {
+        case 1:
+          isSigned ? putS64(o, *(const s8*)f) : putU64(o, *f);
+          break;
+        case 2:
+          isSigned ? putS64(o, *(const s16*)f) : putU64(o, *(const u16*)f);
+          break;
+        case 4:
+          isSigned ? putS64(o, *(const s32*)f) : putU64(o, *(const u32*)f);
+          break;
+        default:
+          isSigned ? putS64(o, *(const s64*)f) : putU64(o, *(const u64*)f);
+          break;
+      }
+      break;
+  }
+}
+
+// Close the line, 0 if it did not fit
+static u32 endLine(TextOut *o, char *line)
+{
+  putChar(o, '\n');
+  if(o->p >= o->end)
+    return 0;
+  *o->p = 0;
+  return (u32)(o->p - line);
+}
+
+u32 SLAKlvFormatHeader(s32 format, char *line, u32 maxLen)
+{
+  if(format != SLA_KLV_TEXT_CSV || maxLen == 0)
+    return 0;
+  TextOut o = {line, line + maxLen - 1, false};
+  putText(&o, "pts");
+  for(u32 tag=0; tag<KLV_PRESENT_TAGS; tag++) {
+    if(hasColumn(tag)) {
+      putChar(&o, ',');
+      putU64(&o, tag);
+    }
+  }
+  return endLine(&o, line);
+}
+
+u32 SLAKlvFormat(const KLVData *klv, s64 pts, s32 format, char *line, u32 maxLen)
+{
+  if(maxLen == 0)
+    return 0;
+  TextOut o = {line, line + maxLen - 1, false};
+
+  if(format == SLA_KLV_TEXT_JSON) {
+    putText(&o, "{\"pts\":");
+    putS64(&o, pts);
+    for(u32 tag=0; tag<KLV_PRESENT_TAGS; tag++) {
+      if(hasColumn(tag) && KLV_IS_PRESENT(klv, tag)) {
+        bool first = false;
+        putKey(&o, tag, &first);
+        putValue(&o, klv, tag);
+      }
+    }
+    putChar(&o, '}');
+  } else {
+    putS64(&o, pts);
+    for(u32 tag=0; tag<KLV_PRESENT_TAGS; tag++) {
+      if(!hasColumn(tag))
+        continue;
+      putChar(&o, ',');
+      if(!KLV_IS_PRESENT(klv, tag))
+        continue;
+      // Strings and nested sets go in quotes, their own quotes doubled
+      bool quote = klvTags[tag].type >= KLV_TYPE_BYTES;
+      if(quote) {
+        putChar(&o, '"');
+        o.quoting = true;
+      }
+      putValue(&o, klv, tag);
+      if(quote) {
+        o.quoting = false;
+        putChar(&o, '"');
+      }
+    }
+  }
+  return endLine(&o, line);
+}
+
+typedef struct {
+  KLVParser parser;
+  KLVData klv;
+  KLVStore store;
+  u16 pid;            // KLV PID, 0 until the PMT gave it
+  u16 pmtPid;         // 0 until the PAT gave it
+  s32 cc;             // continuity counter of the last KLV packet, -1 for none
+  bool inPes;         // payload belongs to a PES whose header was read
+  bool auCells;       // synchronous metadata, the sets are wrapped in metadata AU cells
+  u32 cellHave;       // bytes of the AU cell header read
+  u32 cellLeft;       // bytes of the AU cell still to come
+  u8 cell[AU_CELL_HEADER];
+  s64 pts;            // of the current PES
+  s64 setPts;         // of the PES the set being put together started in
+  s32 format;
+  FILE *out;
+  SLAKlvExtractStats *stats;
+  char line[MAX_LINE];
+} KlvExtract;
+
+// First program of the PAT, sections are taken to fit in one TS packet
+static void readPat(KlvExtract *x, const u8 *s, u32 n)
+{
+  if(n < 12 || s[0] != 0x00)
+    return;
+  u32 end = SLMIN(3u + (((s[1] & 0x0F) << 8) | s[2]), n);
+  if(end < 12)
+    return;
+  end -= 4;   // CRC
+  for(u32 i=8; i+4<=end; i+=4) {
+    u16 program = (u16)((s[i] << 8) | s[i+1]);
+    if(program) {
+      x->pmtPid = (u16)(((s[i+2] & 0x1F) << 8) | s[i+3]);
+      return;
+    }
+  }
+}
+
+// The first KLV elementary stream of the PMT
+static void readPmt(KlvExtract *x, const u8 *s, u32 n)
+{
+  if(n < 16 || s[0] != 0x02 || x->pid)
+    return;
+  u32 end = SLMIN(3u + (((s[1] & 0x0F) << 8) | s[2]), n);
+  if(end < 16)
+    return;
+  end -= 4;   // CRC
+  u32 i = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+  while(i+5 <= end) {
+    u8 type = s[i];
+    u16 pid = (u16)(((s[i+1] & 0x1F) << 8) | s[i+2]);
+    u32 infoLen = ((s[i+3] & 0x0F) << 8) | s[i+4];
+    bool klv = type == 0x15;
+    // Registration descriptor with format_identifier KLVA
+    for(u32 d=i+5; type==0x06 && d+2<=SLMIN(i+5+infoLen, end); d+=2+s[d+1]) {
+      if(s[d] == 0x05 && s[d+1] >= 4 && d+6 <= end && !memcmp(s+d+2, "KLVA", 4))
+        klv = true;
+    }
+    if(klv) {
+      x->pid = pid;
+      return;
+    }
+    i += 5 + infoLen;
+  }
+}
+
+// returns the PES header length, -1 if d is not the start of a PES
+static s32 readPesHeader(KlvExtract *x, const u8 *d, u32 n)
+{
+  x->pts = SLA_KLV_NO_PTS;
+  if(n < 9 || d[0] || d[1] || d[2] != 1)
+    return -1;
+  x->auCells = d[3] == 0xFC;
+  x->cellHave = x->cellLeft = 0;
+  // padding_stream and private_stream_2 have no optional header
+  if(d[3] == 0xBE || d[3] == 0xBF)
+    return 6;
+  u32 hlen = 9 + d[8];
+  if(hlen > n)
+    return -1;
+  if((d[7] & 0x80) && d[8] >= 5) {
+    x->pts = ((s64)(d[9] & 0x0E) << 29) | ((s64)d[10] << 22) | ((s64)(d[11] & 0xFE) << 14) |
+             ((s64)d[12] << 7) | (d[13] >> 1);
+  }
+  return (s32)hlen;
+}
+
+static void writeSet(KlvExtract *x, const u8 *set, u32 len, s64 pts)
+{
+  SLResetKLV(&x->klv);
+  if(!ReadKlvFrame(&x->klv, set, (u16)len, 0)) {
+    x->stats->badSets++;
+    return;
+  }
+  u32 n = SLAKlvFormat(&x->klv, pts, x->format, x->line, sizeof(x->line));
+  if(n) {
+    fwrite(x->line, 1, n, x->out);
+    x->stats->sets++;
+  }
+}
+
+static void readKlvBytes(KlvExtract *x, const u8 *d, u32 n)
+{
+  while(n) {
+    // A set put together from several PES has the PTS of the first
+    if(!x->parser.have)
+      x->setPts = x->pts;
+    const u8 *set;
+    u32 setLen;
+    u32 used = SLParseKLV(&x->parser, d, n, &set, &setLen);
+    if(set)
+      writeSet(x, set, setLen, set == x->parser.buf ? x->setPts : x->pts);
+    d += used;
+    n -= used;
+  }
+}
+
+// Unwraps the metadata AU cells of a synchronous metadata PES
+static void readAuCells(KlvExtract *x, const u8 *d, u32 n)
+{
+  while(n) {
+    if(!x->cellLeft) {
+      while(n && x->cellHave < AU_CELL_HEADER) {
+        x->cell[x->cellHave++] = *d++;
+        n--;
+      }
+      if(x->cellHave < AU_CELL_HEADER)
+        return;
+      x->cellHave = 0;
+      x->cellLeft = (x->cell[3] << 8) | x->cell[4];
+      continue;
+    }
+    u32 m = SLMIN(n, x->cellLeft);
+    readKlvBytes(x, d, m);
+    x->cellLeft -= m;
+    d += m;
+    n -= m;
+  }
+}
+
+static void readTsPacket(KlvExtract *x, const u8 *p)
+{
+  u16 pid = (u16)(((p[1] & 0x1F) << 8) | p[2]);
+  bool isKlv = x->pid && pid == x->pid;
+  bool isPsi = pid == 0 || (x->pmtPid && pid == x->pmtPid && !x->pid);
+  if(!isKlv && !isPsi)
+    return;
+
+  // Adaptation field and payload
+  u8 afc = (p[3] >> 4) & 3;
+  u32 off = 4;
+  if(afc & 2)
+    off += 1 + p[4];
+  bool lost = (p[1] & 0x80) != 0;
+  bool pusi = (p[1] & 0x40) != 0;
+  if(!(afc & 1) || off >= TS_PACKET)
+    return;
+  const u8 *d = p + off;
+  u32 n = TS_PACKET - off;
+
+  if(isPsi) {
+    if(!lost && pusi && 1u + d[0] < n) {
+      if(pid == 0)
+        readPat(x, d + 1 + d[0], n - 1 - d[0]);
+      else
+        readPmt(x, d + 1 + d[0], n - 1 - d[0]);
+    }
+    return;
+  }
+
+  s32 cc = p[3] & 0x0F;
+  if(x->cc >= 0 && cc != ((x->cc + 1) & 0x0F)) {
+    if(cc == x->cc && !lost)
+      return;   // duplicate packet
+    lost = true;
+  }
+  x->cc = cc;
+  if(lost) {
+    x->stats->ccErrors++;
+    x->inPes = false;
+    SLInitKLVParser(&x->parser);
+    return;
+  }
+  if(pusi) {
+    s32 hlen = readPesHeader(x, d, n);
+    x->inPes = hlen >= 0;
+    if(!x->inPes)
+      return;
+    d += hlen;
+    n -= hlen;
+  }
+  if(!x->inPes)
+    return;
+  if(x->auCells)
+    readAuCells(x, d, n);
+  else
+    readKlvBytes(x, d, n);
+}
+
+SLStatus SLAKlvExtract(const char *tsName, FILE *out, s32 format, u16 pid, SLAKlvExtractStats *stats)
+{
+  SLAMemset(stats, 0, sizeof(SLAKlvExtractStats));
+  FILE *fp = fopen(tsName, "rb");
+  if(!fp)
+    return SLA_FAIL;
+
+  KlvExtract *x = (KlvExtract*)SLAMalloc(sizeof(KlvExtract));
+  u8 *buf = (u8*)SLAMalloc(READ_BLOCK);
+  if(!x || !buf) {
+    SLAFree(x);
+    SLAFree(buf);
+    fclose(fp);
+    return SLA_FAIL;
+  }
+  SLInitKLVParser(&x->parser);
+  SLInitKLV(&x->klv, &x->store);
+  x->pid = pid;
+  x->pmtPid = 0;
+  x->cc = -1;
+  x->inPes = x->auCells = false;
+  x->cellHave = x->cellLeft = 0;
+  x->pts = x->setPts = SLA_KLV_NO_PTS;
+  x->format = format;
+  x->out = out;
+  x->stats = stats;
+
+  u32 n = SLAKlvFormatHeader(format, x->line, sizeof(x->line));
+  if(n)
+    fwrite(x->line, 1, n, out);
+
+  u32 have = 0;
+  for(;;) {
+    size_t got = fread(buf + have, 1, READ_BLOCK - have, fp);
+    if(!got)
+      break;
+    have += (u32)got;
+    stats->bytes += got;
+
+    u32 i = 0;
+    while(i + TS_PACKET <= have) {
+      // After a sync loss, take a 0x47 only if the next packet starts with one too
+      if(buf[i] != 0x47 || (i + 2*TS_PACKET <= have && buf[i + TS_PACKET] != 0x47)) {
+        i++;
+        continue;
+      }
+      readTsPacket(x, buf + i);
+      i += TS_PACKET;
+    }
+    memmove(buf, buf + i, have - i);
+    have -= i;
+  }
+
+  stats->pid = x->pid;
+  SLStatus rv = (x->pid && !ferror(fp)) ? SLA_SUCCESS : SLA_FAIL;
+  SLAFree(buf);
+  SLAFree(x);
+  fclose(fp);
+  return rv;
+}
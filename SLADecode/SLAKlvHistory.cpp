@@ -0,0 +1,188 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#include "SLAKlvHistory.h"
+#include "SLAHal.h"
+
+#define SLOT_MASK (SLA_KLV_HISTORY_SIZE - 1)
+#define READ_TRIES 4
+
+// Keeps the compiler from moving slot accesses across the sequence count.  x86
+// does not reorder stores with stores or loads with loads, so that is enough.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define COMPILER_BARRIER() _ReadWriteBarrier()
+#else
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+#endif
+
+void SLAKlvHistoryInit(SLAKlvHistory *hist)
+{
+  SLAMemset(hist, 0, sizeof(SLAKlvHistory));
+}
+
+void SLAKlvHistoryReset(SLAKlvHistory *hist)
+{
+  hist->first = hist->count;
+}
+
+void SLAKlvHistoryRecord(SLAKlvHistory *hist, const KLVGeo *geo)
+{
+  u32 n = hist->count;
+
+  if(n != hist->first) {
+    s64 last = hist->slots[(n - 1) & SLOT_MASK].geo.pts;
+    if(geo->pts == last)
+      n--;
+    else if(geo->pts < last || geo->pts - last > SLA_KLV_HISTORY_MAX_GAP)
+      hist->first = n;
+  }
+
+  SLAKlvSlot *slot = &hist->slots[n & SLOT_MASK];
+  slot->seq++;
+  COMPILER_BARRIER();
+  slot->number = n;
+  slot->geo = *geo;
+  COMPILER_BARRIER();
+  slot->seq++;
+  hist->count = n + 1;
+}
+
+// Read the time (and the whole sample if geo is given) of sample n.
+// false if the slot was being written or already holds a newer sample.
+static bool readSample(const SLAKlvHistory *hist, u32 n, s64 *pts, KLVGeo *geo)
+{
+  const SLAKlvSlot *slot = &hist->slots[n & SLOT_MASK];
+  u32 seq = slot->seq;
+  if(seq & 1)
+    return false;
+  COMPILER_BARRIER();
+  u32 number = slot->number;
+  *pts = slot->geo.pts;
+  if(geo)
+    *geo = slot->geo;
+  COMPILER_BARRIER();
+  return slot->seq == seq && number == n;
+}
+
+static double lerp(double a, double b, double t)
+{
+  return a + (b - a)*t;
+}
+
+// Degrees that wrap at 360, the short way round, result in [lo, lo+360)
+static double lerpAngle(double a, double b, double t, double lo)
+{
+  double d = b - a;
+  if(d > 180.0)
+    d -= 360.0;
+  else if(d < -180.0)
+    d += 360.0;
+  double v = a + d*t;
+  if(v < lo)
+    v += 360.0;
+  else if(v >= lo + 360.0)
+    v -= 360.0;
+  return v;
+}
+
+// Items valid in both samples are interpolated, the rest are taken from before
+static void interpolate(KLVGeoAt *at, s64 pts)
+{
+  const KLVGeo *a = &at->before;
+  const KLVGeo *b = &at->after;
+  KLVGeo *g = &at->at;
+
+  *g = *a;
+  g->pts = pts;
+  if(b->pts <= a->pts)
+    return;
+
+  double t = (double)(pts - a->pts)/(double)(b->pts - a->pts);
+  u32 both = a->valid & b->valid;
+
+  if(both & KLV_GEO_PLATFORM_HEADING)
+    g->platformHeading = lerpAngle(a->platformHeading, b->platformHeading, t, 0.0);
+  if(both & KLV_GEO_PLATFORM_PITCH)
+    g->platformPitch = lerp(a->platformPitch, b->platformPitch, t);
+  if(both & KLV_GEO_PLATFORM_ROLL)
+    g->platformRoll = lerp(a->platformRoll, b->platformRoll, t);
+  if(both & KLV_GEO_SENSOR_POSITION) {
+    g->sensorLat = lerp(a->sensorLat, b->sensorLat, t);
+    g->sensorLon = lerpAngle(a->sensorLon, b->sensorLon, t, -180.0);
+  }
+  if(both & KLV_GEO_SENSOR_ALTITUDE)
+    g->sensorAlt = lerp(a->sensorAlt, b->sensorAlt, t);
+  if(both & KLV_GEO_SENSOR_AZIMUTH)
+    g->sensorAzimuth = lerpAngle(a->sensorAzimuth, b->sensorAzimuth, t, 0.0);
+  if(both & KLV_GEO_SENSOR_ELEVATION)
+    g->sensorElevation = lerpAngle(a->sensorElevation, b->sensorElevation, t, -180.0);
+  if(both & KLV_GEO_SENSOR_ROLL)
+    g->sensorRoll = lerpAngle(a->sensorRoll, b->sensorRoll, t, 0.0);
+  if(both & KLV_GEO_FIELD_OF_VIEW) {
+    g->hfov = lerp(a->hfov, b->hfov, t);
+    g->vfov = lerp(a->vfov, b->vfov, t);
+  }
+  if(both & KLV_GEO_SLANT_RANGE)
+    g->slantRange = lerp(a->slantRange, b->slantRange, t);
+  if(both & KLV_GEO_CENTER) {
+    g->centerLat = lerp(a->centerLat, b->centerLat, t);
+    g->centerLon = lerpAngle(a->centerLon, b->centerLon, t, -180.0);
+  }
+  if(both & KLV_GEO_CENTER_ELEVATION)
+    g->centerElevation = lerp(a->centerElevation, b->centerElevation, t);
+  if(both & KLV_GEO_CORNERS) {
+    for(s32 i=0; i<4; i++) {
+      g->cornerLat[i] = lerp(a->cornerLat[i], b->cornerLat[i], t);
+      g->cornerLon[i] = lerpAngle(a->cornerLon[i], b->cornerLon[i], t, -180.0);
+    }
+  }
+}
+
+SLStatus SLAKlvHistoryAt(const SLAKlvHistory *hist, s64 pts, KLVGeoAt *at)
+{
+  for(s32 tries=0; tries<READ_TRIES; tries++) {
+    u32 count = hist->count;
+    COMPILER_BARRIER();
+    u32 first = hist->first;
+    // The writer's next slot holds the oldest sample
+    if(count - first > SLA_KLV_HISTORY_SIZE - 1)
+      first = count - (SLA_KLV_HISTORY_SIZE - 1);
+    if(count == first)
+      return SLA_FAIL;
+
+    // Newest sample at or before pts in [first, count)
+    s64 p;
+    if(!readSample(hist, first, &p, NULL))
+      continue;
+    if(pts < p)
+      return SLA_FAIL;
+    u32 lo = first, hi = count;
+    bool torn = false;
+    while(hi - lo > 1) {
+      u32 mid = lo + (hi - lo)/2;
+      if(!readSample(hist, mid, &p, NULL)) {
+        torn = true;
+        break;
+      }
+      if(p <= pts)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    if(torn || !readSample(hist, lo, &p, &at->before))
+      continue;
+    if(lo + 1 == count)
+      at->after = at->before;
+    else if(!readSample(hist, lo + 1, &p, &at->after))
+      continue;
+
+    interpolate(at, pts);
+    return SLA_SUCCESS;
+  }
+  // The writer kept overtaking, the samples are moving too fast to be of use
+  return SLA_FAIL;
+}
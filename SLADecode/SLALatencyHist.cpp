@@ -0,0 +1,95 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#include "SLALatencyHist.h"
+#include "SLAHal.h"
+
+#define SUB_COUNT (1 << SLA_LATENCY_SUB_BITS)
+
+static u32 bucketIndex(u64 usec)
+{
+  if(usec < SUB_COUNT)
+    return (u32)usec;
+  if(usec >= ((u64)1 << (SLA_LATENCY_MAX_BITS + 1)))
+    return SLA_LATENCY_BUCKETS - 1;
+
+  u32 msb = SLA_LATENCY_SUB_BITS;
+  while((usec >> (msb + 1)) != 0)
+    msb++;
+  u32 shift = msb - SLA_LATENCY_SUB_BITS;
+  u32 sub = (u32)(usec >> shift) & (SUB_COUNT - 1);
+  return ((shift + 1) << SLA_LATENCY_SUB_BITS) + sub;
+}
+
+// Largest value that lands in bucket idx
+static u32 bucketValue(u32 idx)
+{
+  if(idx < SUB_COUNT)
+    return idx;
+  u32 shift = (idx >> SLA_LATENCY_SUB_BITS) - 1;
+  u32 sub = idx & (SUB_COUNT - 1);
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void SLALatencyHistRecord(SLALatencyHist *hist, u64 usec)
+{
+  if(hist->clearRequest) {
+    SLAMemset((void*)hist->counts, 0, sizeof(hist->counts));
+    hist->total = 0;
+    hist->max = 0;
+    hist->clearRequest = 0;
+  }
+  hist->counts[bucketIndex(usec)]++;
+  hist->total++;
+  if(usec > hist->max)
+    hist->max = usec > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)usec;
+}
+
+void SLALatencyHistClear(SLALatencyHist *hist)
+{
+  hist->clearRequest = 1;
+}
+
+static u32 percentile(const u32 *counts, u32 total, u32 permille10)
+{
+  // Rank of the sample at permille10/10000, rounded up
+  u64 rank = ((u64)total*permille10 + 9999)/10000;
+  if(rank == 0)
+    rank = 1;
+  u64 seen = 0;
+  for(u32 i=0; i<SLA_LATENCY_BUCKETS; i++) {
+    seen += counts[i];
+    if(seen >= rank)
+      return bucketValue(i);
+  }
+  return bucketValue(SLA_LATENCY_BUCKETS - 1);
+}
+
+void SLALatencyHistSummary(const SLALatencyHist *hist, SLALatencySummary *summary)
+{
+  u32 counts[SLA_LATENCY_BUCKETS];
+  u32 total = 0;
+
+  SLAMemset(summary, 0, sizeof(*summary));
+  if(hist->clearRequest)
+    return;
+
+  // The total is taken from the snapshot so percentiles stay consistent with it
+  for(u32 i=0; i<SLA_LATENCY_BUCKETS; i++) {
+    counts[i] = hist->counts[i];
+    total += counts[i];
+  }
+  if(total == 0)
+    return;
+
+  // Bucket edges can overshoot the largest sample
+  u32 max = hist->max;
+  summary->count = total;
+  summary->p50 = SLMIN(percentile(counts, total, 5000), max);
+  summary->p99 = SLMIN(percentile(counts, total, 9900), max);
+  summary->p999 = SLMIN(percentile(counts, total, 9990), max);
+  summary->max = max;
+}
@@ -19,9 +19,13 @@
 #define UDP_PACKET_LEN 1500
 #define QSIZE 4
 
+// fullMbx type classes, so the video backlog can be counted
+#define FRAME_CLASS_VIDEO 1
+#define FRAME_CLASS_META  2
+
 typedef struct {
   u32 len;
-//  u32 timestamp;
+  u64 timestamp;    // SLAGetMHzTime usec the packet was received
   u8 *data;
 } SL_UDP_PACKET; 
 
@@ -74,6 +78,7 @@ typedef struct {
   int bufLen;
   int PID;
   u64 pts;
+  u64 arrivalTime;  // receive time of the packet that started the PES
   int bufferPos;
   u16 pesDataLen;
   int started;
@@ -131,6 +136,7 @@ typedef struct UDPReceiveStruct {
   u32 quality, wide, high;
   s32 type;
   s32 dataLen;
+  u64 frameArrival; //!< Receive time of the first packet of the frame
   u8 lumaq[64], chromaq[64];
   s32 failed;     //!< Count of failures from received packets while building frame
   s32 maxFailCount; //!< log fail count over lifespan
@@ -312,6 +318,7 @@ static int setFrame(SLA_COMPRESSED_FRAME *frame, PESStruct *pes, UDPReceiveStruc
   frame->len = pes->bufferPos;
   frame->PID = pes->PID;
   frame->PTS = pes->pts;
+  frame->arrivalTime = pes->arrivalTime;
   frame->missedPacket = pes->missedPacket;
   frame->high = 0;
   frame->wide = 0;
@@ -1033,6 +1040,7 @@ static int demuxTSPacket(UDPReceiveStruct *tsData, SL_UDP_PACKET *packet, SLA_CO
         currentPES->bufferPos = 0;
         currentPES->started = 1;
         currentPES->missedPacket = 0;
+        currentPES->arrivalTime = packet->timestamp;
         k = parsePESHeader(currentPES, &ph, &packet->data[i+tp.DataOffset], packet->len-i-tp.DataOffset);
         //trace(&ph, 1);
         // Skip the 5-byte header associated with synchronous metadata
@@ -1477,6 +1485,7 @@ static int demuxRTPMJpeg(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_C
   SLAMemcpy(&jpghdr, packet->data + RTP_HDR_SZ, sizeof(jpghdr));
   u32 offset = HTON32(jpghdr.tspec_off & 0xFFFFFF00);
   if (offset == 0){
+    rtpData->frameArrival = packet->timestamp;
     rtpData->quality = jpghdr.q;
     rtpData->high = jpghdr.height;
     rtpData->wide = jpghdr.width;
@@ -1520,6 +1529,7 @@ static int demuxRTPMJpeg(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_C
       frame->quality = rtpData->quality;
       frame->type = rtpData->type;
       frame->missedPacket = rtpData->failed;
+      frame->arrivalTime = rtpData->frameArrival;
     }
     rtpData->maxFailCount += rtpData->failed;
     rtpData->failed = 0;
@@ -1543,12 +1553,14 @@ static int demuxRTPH264(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_CO
     SLAMemcpy(frame->buffer, NAL_HEADER_BYTES, 4);
     SLAMemcpy(frame->buffer+4, d, packet->len - RTP_HDR_SZ);
     frame->len = packet->len - RTP_HDR_SZ + 4;
+    frame->arrivalTime = packet->timestamp;
   }
   else if (type == 24) {
     // Aggregate single-time NALU
     SLAMemcpy(frame->buffer, NAL_HEADER_BYTES, 4);
     SLAMemcpy(frame->buffer+4, d, packet->len - RTP_HDR_SZ);
     frame->len = packet->len - RTP_HDR_SZ + 4;
+    frame->arrivalTime = packet->timestamp;
   }
   else if (type == 28) {
     // NALU fragment
@@ -1564,6 +1576,7 @@ static int demuxRTPH264(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_CO
       SLAMemcpy(frame->buffer, NAL_HEADER_BYTES, 4);
       frame->buffer[4] = (d[0] & 0xE0) | (d[1] & 0x1F);
       rtpData->dataLen = 5;
+      rtpData->frameArrival = packet->timestamp;
     }
     SLAMemcpy(frame->buffer + rtpData->dataLen, d + 2, packet->len - RTP_HDR_SZ - 2);
     rtpData->dataLen += packet->len - RTP_HDR_SZ - 2;
@@ -1572,6 +1585,7 @@ static int demuxRTPH264(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_CO
       cnt++;
       frame->len = rtpData->dataLen;
       frame->PID = 0x44;
+      frame->arrivalTime = rtpData->frameArrival;
     }
 
     return e;
@@ -1590,6 +1604,7 @@ static int demuxRTPMP2TS(UDPReceiveStruct *rtpData, SL_UDP_PACKET *packet, SLA_C
 {
   tsPkt->data = packet->data + RTP_HDR_SZ;
   tsPkt->len = packet->len - RTP_HDR_SZ;
+  tsPkt->timestamp = packet->timestamp;
   return finalFragment;
 }
 
@@ -1691,6 +1706,7 @@ static SLStatus _demuxNextFrame(void *UDPReceiveData, SLA_COMPRESSED_FRAME *fram
       SLATrace("%d bytes read\n", data->pkt.len);
 #endif
       data->bytesProcessed = 0;
+      SLAGetMHzTime(&data->pkt.timestamp);
   
       // Dump raw input if requested (before demuxing, decoding, etc)
       if(data->pkt.len>0){
@@ -1740,6 +1756,7 @@ static SLStatus _demuxNextFrame(void *UDPReceiveData, SLA_COMPRESSED_FRAME *fram
           if (data->isRTPts){
             tsPkt.len = data->pkt.len - data->bytesProcessed;
             tsPkt.data = data->pkt.data + data->bytesProcessed;
+            tsPkt.timestamp = data->pkt.timestamp;
             s32 bytes = 0;
             haveFrame = demuxTSPacket(data, &tsPkt, frame, &bytes, 1);
             data->bytesProcessed += bytes;
@@ -1786,8 +1803,11 @@ static int udpReceiveTask(void *_data)
     if(!data->done){
       if(rv==SLA_TIMEOUT)
         SLAMbxPost(data->emptyMbx, &frame, SL_FOREVER);
-      if(rv==SLA_SUCCESS)
-        SLAMbxPost(data->fullMbx, &frame, SL_FOREVER);
+      if(rv==SLA_SUCCESS) {
+        SLAGetMHzTime(&frame.demuxTime);
+        SLAMbxPost(data->fullMbx, &frame, SL_FOREVER,
+                   SLAIsMetaDataProtocol(frame.streamType) ? FRAME_CLASS_META : FRAME_CLASS_VIDEO);
+      }
     }
   }
 
@@ -1812,6 +1832,10 @@ SLStatus SLADemuxNextFrame(void *UDPReceiveData, SLA_COMPRESSED_FRAME *frame, u3
     if(frame->buffer == 0) {
       rv = SLA_TERMINATE;
     } 
+    else if(frame->buffer == (u8*)data) {
+      // Posted by SLADemuxWake, not a real frame
+      rv = SLA_NOP;
+    }
     else {
       s32 cpyLen = SLMIN(frame->len, frame->maxBufferLen);
       if (mbl >= cpyLen){
@@ -1830,6 +1854,19 @@ SLStatus SLADemuxNextFrame(void *UDPReceiveData, SLA_COMPRESSED_FRAME *frame, u3
   return rv;
 }
 
+SLStatus SLADemuxWake(void *UDPReceiveData)
+{
+  UDPReceiveStruct *data = (UDPReceiveStruct *)UDPReceiveData;
+  SLA_COMPRESSED_FRAME frame;
+  SLAMemset(&frame, 0, sizeof(frame));
+  frame.buffer = (u8*)data;  // marker recognized by SLADemuxNextFrame
+
+  // Queue full means the reader is not blocked anyway
+  if(!SLAMbxPost(data->fullMbx, &frame, 0))
+    return SLA_NOP;
+  return SLA_SUCCESS;
+}
+
 SLStatus SLAUDPStatus(void *UDPReceiveData, SLA_UDP_STATUS *status)
 {
   UDPReceiveStruct *data = (UDPReceiveStruct *)UDPReceiveData;
@@ -1837,5 +1874,6 @@ SLStatus SLAUDPStatus(void *UDPReceiveData, SLA_UDP_STATUS *status)
   status->backedUp = data->busy;
   data->busy = 0;
   SLASemPost(data->lockSem);
+  status->framesQueued = SLAMbxCount(data->fullMbx, FRAME_CLASS_VIDEO);
   return SLA_SUCCESS;
 }
@@ -0,0 +1,19 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// The part of SLAHal the KLV modules use, for building them without SLAHalpc.cpp
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "SLAHal.h"
+
+void SLATrace (const char *fmt, ...)
+{
+  va_list Argp;
+  va_start (Argp, fmt);
+  vfprintf(stderr, fmt, Argp);
+  va_end(Argp);
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+#include "sltypes.h"
+
+// Print the failed condition and return 1 from the calling test
+#define SLA_CHECK(cond) do { \
+    if(!(cond)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      return 1; \
+    } \
+  } while(0)
+
+// Repeatable pseudo random numbers, so a failure can be reproduced
+static u32 slaTestSeed = 1;
+
+static SLINLINE u32 SLATestRand()
+{
+  slaTestSeed = slaTestSeed*1103515245 + 12345;
+  return slaTestSeed >> 8;
+}
+
+// Seconds of processor time, for the benchmarks
+static SLINLINE double SLATestSeconds()
+{
+  return (double)clock() / CLOCKS_PER_SEC;
+}
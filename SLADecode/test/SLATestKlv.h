@@ -0,0 +1,100 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLATest.h"
+
+static SLINLINE bool SLATestSameBytes(const KLVBytes *a, const KLVBytes *b)
+{
+  return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+static SLINLINE bool SLATestSameSecurity(const KLVSecurityLocalSet *a, const KLVSecurityLocalSet *b)
+{
+  return a->Classification == b->Classification
+    && a->ClassifyingCountryCodingMethod == b->ClassifyingCountryCodingMethod
+    && SLATestSameBytes(&a->ClassifyingCountry, &b->ClassifyingCountry)
+    && SLATestSameBytes(&a->SCISHIInformation, &b->SCISHIInformation)
+    && SLATestSameBytes(&a->Caveats, &b->Caveats)
+    && SLATestSameBytes(&a->ReleasingInstructions, &b->ReleasingInstructions)
+    && a->ObjectCountryCodingMethod == b->ObjectCountryCodingMethod
+    && SLATestSameBytes(&a->ObjectCountryCodes, &b->ObjectCountryCodes)
+    && a->SecurityMetadataVersion == b->SecurityMetadataVersion;
+}
+
+static SLINLINE bool SLATestSameVmti(const KLVVmtiLocalSet *a, const KLVVmtiLocalSet *b)
+{
+  if(a->nTargets != b->nTargets || a->nReported != b->nReported || a->Version != b->Version
+     || a->FrameWidth != b->FrameWidth || a->FrameHeight != b->FrameHeight)
+    return false;
+  for(u32 i = 0; i < a->nTargets; i++) {
+    const KLVVTargetPack *s = &a->Target[i], *t = &b->Target[i];
+    if(s->TargetIDNumber != t->TargetIDNumber
+       || s->TargetCentroidPixelNumber != t->TargetCentroidPixelNumber
+       || s->BoundingBoxTopLeftPixelNumber != t->BoundingBoxTopLeftPixelNumber
+       || s->BoundingBoxBottomRightPixelNumber != t->BoundingBoxBottomRightPixelNumber
+       || s->TargetConfidenceNumber != t->TargetConfidenceNumber)
+      return false;
+  }
+  return true;
+}
+
+// Same tags present with the same values, strings and targets compared by content
+// returns the first tag that differs, 0 if a and b are the same
+static SLINLINE u32 SLATestDiffKLV(const KLVData *a, const KLVData *b)
+{
+  for(u32 tag = 1; tag < KLV_PRESENT_TAGS; tag++) {
+    if(KLV_IS_PRESENT(a, tag) != KLV_IS_PRESENT(b, tag))
+      return tag;
+    const KLVTag *t = &klvTags[tag];
+    if(!KLV_IS_PRESENT(a, tag) || !t->size)
+      continue;
+    const u8 *fa = (const u8*)a + t->offset, *fb = (const u8*)b + t->offset;
+    bool same;
+    switch(t->type) {
+      case KLV_TYPE_BYTES:
+        same = SLATestSameBytes((const KLVBytes*)fa, (const KLVBytes*)fb);
+        break;
+      case KLV_TYPE_SECURITY:
+        same = SLATestSameSecurity((const KLVSecurityLocalSet*)fa, (const KLVSecurityLocalSet*)fb);
+        break;
+      case KLV_TYPE_VMTI:
+        same = SLATestSameVmti((const KLVVmtiLocalSet*)fa, (const KLVVmtiLocalSet*)fb);
+        break;
+      default:
+        same = !memcmp(fa, fb, t->size);
+        break;
+    }
+    if(!same)
+      return tag;
+  }
+  return 0;
+}
+
+// Wrap items (tag, BER length, value ...) in the universal key, a BER length
+// and the checksum
+// returns bytes in frame
+static SLINLINE u32 SLATestFrame(const u8 *items, u32 len, u8 *frame)
+{
+  u32 j = 0;
+  memcpy(frame, SLUniversalKey, sizeof(SLUniversalKey));
+  j += sizeof(SLUniversalKey);
+  u32 total = len + 4;
+  frame[j++] = 0x82;
+  frame[j++] = (u8)(total >> 8);
+  frame[j++] = (u8)total;
+  memcpy(frame + j, items, len);
+  j += len;
+  frame[j++] = SL_LDS_KEY_CHECKSUM;
+  frame[j++] = 2;
+  u16 sum = Checksum(frame, j);
+  frame[j++] = (u8)(sum >> 8);
+  frame[j++] = (u8)sum;
+  return j;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// ReadKeyLength against the byte at a time key search it replaced, on buffers with
+// the key at the end of noise: random bytes, bytes that are mostly the first key
+// byte, and runs of partial keys. Both must find the key at the same place.
+
+#include <stdio.h>
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLATest.h"
+
+#define BUF_LEN       0xFFFF
+#define BENCH_SECONDS 0.5
+
+static s32 ReadBerLength(const u8 *buffer, u16 *length)
+{
+  if(buffer[0]==0x82){
+    *length = (buffer[1]<<8) | (buffer[2]);
+    return 3;
+  }
+  if(buffer[0]==0x81){
+    *length = (buffer[1]);
+    return 2;
+  }
+  if(buffer[0] >= 128)
+    return -1;
+  *length = buffer[0];
+  return 1;
+}
+
+// The search before memchr: find the first key byte, then assemble and compare the
+// key as two 64-bit words
+static s32 ReadKeyLengthBytewise(const u8* buf, u16 len, u16 *bytesRead, u16 *klvLen, u16 *headerStart)
+{
+  static const u64 K0 = 0x060E2B34020B0101ull, K1 = 0x0E01030101000000ull;
+  if(len<19) {
+    *bytesRead = *klvLen = 0;
+    return 0;
+  }
+
+  int j=0;
+  u64 k0,k1;
+  do {
+    k0 = k1 = 0;
+    for(;j<len && buf[j]!= SLUniversalKey[0]; j++);
+
+    if(len < j+19) {
+      *headerStart = j;
+      *bytesRead = j;
+      *klvLen = 0;
+      return 0;
+    }
+    for(int b=0;b<8;b++)
+      k0 |= (u64)buf[j+b]<<((7-b)*8);
+    for(int b=0;b<8;b++)
+      k1 |= (u64)buf[j+b+8]<<((7-b)*8);
+    j++;
+  } while ((k0 != K0) || (k1 != K1));
+  j += 15;
+
+  s32 rv = ReadBerLength(buf+j, klvLen);
+  if(rv<0){
+    *headerStart = j;
+    *bytesRead = j;
+    *klvLen = 0;
+    return 0;
+  }
+  *headerStart = j-16;
+  j += rv;
+  *bytesRead = j;
+  return 1;
+}
+
+typedef s32 (*KeySearch)(const u8*, u16, u16*, u16*, u16*);
+
+// MB/s of search over buf
+static double Rate(KeySearch search, const u8 *buf)
+{
+  u16 bytesRead, klvLen, headerStart;
+  u32 calls = 0;
+  double start = SLATestSeconds(), t;
+  do {
+    for(u32 i = 0; i < 100; i++)
+      search(buf, BUF_LEN, &bytesRead, &klvLen, &headerStart);
+    calls += 100;
+    t = SLATestSeconds() - start;
+  } while(t < BENCH_SECONDS);
+  return (double)calls * BUF_LEN / t / 1e6;
+}
+
+static int Bench(const char *name, u8 *buf)
+{
+  // A local set of 100 bytes at the end
+  u32 at = BUF_LEN - 120;
+  memcpy(buf + at, SLUniversalKey, sizeof(SLUniversalKey));
+  buf[at+16] = 100;
+
+  u16 r0, l0, h0, r1, l1, h1;
+  s32 rv0 = ReadKeyLength(buf, BUF_LEN, &r0, &l0, &h0);
+  s32 rv1 = ReadKeyLengthBytewise(buf, BUF_LEN, &r1, &l1, &h1);
+  SLA_CHECK(rv0 == 1 && h0 == at && r0 == at+17 && l0 == 100);
+  SLA_CHECK(rv0 == rv1 && r0 == r1 && l0 == l1 && h0 == h1);
+
+  double bytewise = Rate(ReadKeyLengthBytewise, buf);
+  double memchrRate = Rate(ReadKeyLength, buf);
+  printf("%-14s bytewise %8.0f MB/s, ReadKeyLength %8.0f MB/s, %5.1fx\n",
+    name, bytewise, memchrRate, memchrRate / bytewise);
+  return 0;
+}
+
+int main()
+{
+  static u8 buf[BUF_LEN];
+
+  for(u32 i = 0; i < BUF_LEN; i++)
+    buf[i] = (u8)SLATestRand();
+  if(Bench("random", buf))
+    return 1;
+
+  for(u32 i = 0; i < BUF_LEN; i++)
+    buf[i] = SLATestRand() % 2 ? SLUniversalKey[0] : (u8)SLATestRand();
+  if(Bench("key byte", buf))
+    return 1;
+
+  // The key with its last byte wrong, over and over
+  for(u32 i = 0; i < BUF_LEN; i++)
+    buf[i] = i % 16 == 15 ? 0xFF : SLUniversalKey[i % 16];
+  return Bench("partial keys", buf);
+}
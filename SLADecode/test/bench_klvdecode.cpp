@@ -0,0 +1,94 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// Packets per second of ReadKlvFrame and SLCopyChangedKLV, the per packet work of
+// the decoder thread, for a full sensor packet like SightLine boards send and a
+// short one with only the time stamp and platform angles.
+
+#include <stdio.h>
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLATest.h"
+
+#define BENCH_SECONDS 1.0
+
+static KLVStore store, recentStore;
+static KLVData klv, recent;
+
+static void MakeFull()
+{
+  SLResetKLV(&klv);
+  static const u8 tags[] = {2, 5, 6, 7, 13, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25,
+                            26, 27, 28, 29, 30, 31, 32, 33, 40, 41, 42, 65, 90, 91};
+  for(u32 i = 0; i < sizeof tags; i++) {
+    const KLVTag *t = &klvTags[tags[i]];
+    u8 *f = (u8*)&klv + t->offset;
+    for(u32 b = 0; b < t->size; b++)
+      f[b] = (u8)SLATestRand();
+    KLV_SET_PRESENT(&klv, tags[i]);
+  }
+  klv.Missionid.len = 12;
+  memcpy(klv.Missionid.data, "MISSION 0042", 12);
+  KLV_SET_PRESENT(&klv, 3);
+  klv.ImageSourceSensor.len = 3;
+  memcpy(klv.ImageSourceSensor.data, "EO1", 3);
+  KLV_SET_PRESENT(&klv, 11);
+  klv.VMti.nTargets = 4;
+  klv.VMti.FrameWidth = 1280;
+  klv.VMti.FrameHeight = 720;
+  for(u32 i = 0; i < klv.VMti.nTargets; i++) {
+    klv.VMti.Target[i].TargetIDNumber = i + 1;
+    klv.VMti.Target[i].TargetCentroidPixelNumber = SLATestRand() % (1280*720);
+    klv.VMti.Target[i].TargetConfidenceNumber = 80;
+  }
+  KLV_SET_PRESENT(&klv, 74);
+}
+
+static void MakeShort()
+{
+  SLResetKLV(&klv);
+  klv.Utctime = 1459000000000000ull;
+  klv.PlatformHeadingAngle = 1234;
+  klv.PlatformPitchAngle = -56;
+  klv.PlatformRollAngle = 78;
+  KLV_SET_PRESENT(&klv, 2);
+  KLV_SET_PRESENT(&klv, 5);
+  KLV_SET_PRESENT(&klv, 6);
+  KLV_SET_PRESENT(&klv, 7);
+}
+
+static int Bench(const char *name)
+{
+  u8 packet[4096];
+  u32 n = WriteKlvFrame(&klv, NULL, packet, sizeof packet);
+  SLA_CHECK(n > 0);
+
+  u32 packets = 0;
+  double start = SLATestSeconds(), t;
+  do {
+    for(u32 i = 0; i < 1000; i++) {
+      SLResetKLV(&klv);
+      SLA_CHECK(ReadKlvFrame(&klv, packet, (u16)n, 0) == 1);
+      SLCopyChangedKLV(&recent, &klv);
+    }
+    packets += 1000;
+    t = SLATestSeconds() - start;
+  } while(t < BENCH_SECONDS);
+  printf("%-6s %4u bytes: %10.0f packets/s\n", name, n, packets / t);
+  return 0;
+}
+
+int main()
+{
+  SLInitKLV(&klv, &store);
+  SLInitKLV(&recent, &recentStore);
+  MakeFull();
+  if(Bench("full"))
+    return 1;
+  MakeShort();
+  return Bench("short");
+}
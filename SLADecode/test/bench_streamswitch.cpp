@@ -0,0 +1,166 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// Camera switching through SLADecode: a sender thread loops a recorded TS file
+// to two local UDP ports and the decoder is destroyed and created again on the
+// other port, with the decoder pool off and on. Reported are the times of
+// Create, of Destroy and from Create to the first decoded frame, which includes
+// the wait for a key frame of the clip.
+//
+// It needs ffmpeg and SLAHalpc.cpp, so it is built with the Windows SLADecode
+// library rather than the Makefile:
+//   bench_streamswitch <file.ts> [switches] [kbit/s]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SLADecode.h"
+#include "SLAHal.h"
+
+#define PORT_A        15104
+#define PORT_B        15106
+#define TS_DATAGRAM   (7*188)
+#define FRAME_WAIT_MS 5000
+
+typedef struct {
+  u8 *ts;
+  u32 len;
+  u32 bytesPerSec;
+  volatile u32 stop;
+  SLA_Sem doneSem;
+} Sender;
+
+static SLA_Sem frameSem;
+static volatile u32 waitingForFrame;
+
+static void __cdecl onFrame(void *context, SLAImage *image, KLVData *klv, KLVData *klvRecent)
+{
+  if(image && waitingForFrame) {
+    waitingForFrame = 0;
+    SLASemPost(frameSem);
+  }
+}
+
+static u64 usNow()
+{
+  u64 t;
+  SLAGetMHzTime(&t);
+  return t;
+}
+
+// The same datagrams to both ports at about bytesPerSec
+static int senderTask(void *context)
+{
+  Sender *s = (Sender*)context;
+  SLASocket a, b;
+  SLASockStartup();
+  SLASockUDPInit(&a, "127.0.0.1", PORT_A);
+  SLASockUDPInit(&b, "127.0.0.1", PORT_B);
+
+  u64 start = usNow(), sent = 0;
+  u32 at = 0;
+  while(!s->stop) {
+    u64 due = (usNow() - start) * s->bytesPerSec / 1000000;
+    while(sent < due) {
+      u32 n = SLMIN(TS_DATAGRAM, s->len - at);
+      SLASockSendTo(&a, (char*)s->ts + at, n);
+      SLASockSendTo(&b, (char*)s->ts + at, n);
+      sent += n;
+      at = at + n < s->len ? at + n : 0;
+    }
+    SLASleep(1);
+  }
+  SLASockClose(&a);
+  SLASockClose(&b);
+  SLASemPost(s->doneSem);
+  return 0;
+}
+
+static int Bench(int poolSize, u32 switches)
+{
+  SLADecode::SetPoolSize(poolSize);
+
+  SLADecode dec;
+  u64 createUs = 0, destroyUs = 0, firstUs = 0, firstMax = 0;
+  u32 missed = 0;
+  for(u32 i = 0; i < switches; i++) {
+    char addr[64];
+    sprintf(addr, "udp://@127.0.0.1:%u", i%2 ? PORT_B : PORT_A);
+
+    waitingForFrame = 1;
+    u64 t0 = usNow();
+    if(dec.Create(addr, onFrame, NULL, NULL) != 0) {
+      printf("Create(%s) failed\n", addr);
+      return 1;
+    }
+    u64 t1 = usNow();
+    bool got = SLASemPend(frameSem, FRAME_WAIT_MS);
+    u64 t2 = usNow();
+    waitingForFrame = 0;
+    dec.Destroy();
+    u64 t3 = usNow();
+
+    createUs += t1 - t0;
+    destroyUs += t3 - t2;
+    if(got) {
+      firstUs += t2 - t0;
+      firstMax = SLMAX(firstMax, t2 - t0);
+    } else {
+      missed++;
+    }
+  }
+  SLADecode::SetPoolSize(0);
+
+  u32 shown = switches - missed;
+  printf("pool %d: Create %7.2f ms, Destroy %7.2f ms, first frame %7.1f ms (max %7.1f), %u of %u without a frame\n",
+    poolSize, createUs / 1000.0 / switches, destroyUs / 1000.0 / switches,
+    shown ? firstUs / 1000.0 / shown : 0.0, firstMax / 1000.0, missed, switches);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc < 2) {
+    printf("usage: bench_streamswitch <file.ts> [switches] [kbit/s]\n");
+    return 2;
+  }
+  u32 switches = argc > 2 ? atoi(argv[2]) : 50;
+  u32 kbps = argc > 3 ? atoi(argv[3]) : 4000;
+
+  Sender sender;
+  SLAMemset(&sender, 0, sizeof(sender));
+  FILE *f = fopen(argv[1], "rb");
+  if(!f) {
+    printf("cannot open %s\n", argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  sender.len = (u32)ftell(f) / 188 * 188;
+  fseek(f, 0, SEEK_SET);
+  sender.ts = (u8*)malloc(sender.len);
+  bool read = sender.ts && sender.len && fread(sender.ts, 1, sender.len, f) == sender.len;
+  fclose(f);
+  if(!read) {
+    printf("cannot read %s\n", argv[1]);
+    return 1;
+  }
+  sender.bytesPerSec = kbps * 1000 / 8;
+  sender.doneSem = SLASemCreate(0);
+  frameSem = SLASemCreate(0);
+
+  if(!SLACreateThread(senderTask, SL_DEFAULT_STACK_SIZE, "bench sender", &sender, SL_PRI_4)) {
+    printf("cannot start the sender\n");
+    return 1;
+  }
+
+  int fail = Bench(0, switches) || Bench(2, switches);
+
+  sender.stop = 1;
+  SLASemPend(sender.doneSem, SEM_FOREVER);
+  SLASemDestroy(sender.doneSem);
+  SLASemDestroy(frameSem);
+  free(sender.ts);
+  return fail;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// Command line front end of SLAKlvExtract:
+//   klvextract [-json] [-pid <pid>] <file.ts> [<out>]
+// Writes CSV (JSON with -json) to out, or stdout, and the stats to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SLAKlvExtract.h"
+
+static int Usage()
+{
+  fprintf(stderr, "usage: klvextract [-json] [-pid <pid>] <file.ts> [<out>]\n");
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  s32 format = SLA_KLV_TEXT_CSV;
+  u16 pid = 0;
+  const char *tsName = NULL, *outName = NULL;
+
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-json"))
+      format = SLA_KLV_TEXT_JSON;
+    else if(!strcmp(argv[i], "-pid") && i+1 < argc)
+      pid = (u16)strtoul(argv[++i], NULL, 0);
+    else if(argv[i][0] == '-')
+      return Usage();
+    else if(!tsName)
+      tsName = argv[i];
+    else if(!outName)
+      outName = argv[i];
+    else
+      return Usage();
+  }
+  if(!tsName)
+    return Usage();
+
+  FILE *out = outName ? fopen(outName, "wb") : stdout;
+  if(!out) {
+    fprintf(stderr, "klvextract: can't write %s\n", outName);
+    return 1;
+  }
+  SLAKlvExtractStats stats;
+  SLStatus rv = SLAKlvExtract(tsName, out, format, pid, &stats);
+  if(outName)
+    fclose(out);
+  if(rv != SLA_SUCCESS) {
+    fprintf(stderr, "klvextract: no KLV stream in %s\n", tsName);
+    return 1;
+  }
+  fprintf(stderr, "pid 0x%x: %u sets, %u bad, %u packets lost, %llu bytes\n",
+    stats.pid, stats.sets, stats.badSets, stats.ccErrors, (unsigned long long)stats.bytes);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// Checksum against the byte at a time running sum of ST 0601, for odd and even
+// lengths, buffers at every alignment within a cache line, and long buffers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "SLAKlvDecode.h"
+#include "SLATest.h"
+
+#define MAX_LEN 4000
+
+// ST 0601 reference: each byte shifted into the high or low half of a running 16-bit sum
+static u16 ChecksumBytes(const u8 *src, u32 len)
+{
+  u16 bcc = 0;
+  for(u32 i = 0; i < len; i++)
+    bcc += src[i] << (8 * ((i + 1) % 2));
+  return bcc;
+}
+
+static int TestAlignments(const u8 *buf)
+{
+  for(u32 offset = 0; offset < 64; offset++) {
+    for(u32 len = 0; len <= MAX_LEN; len++) {
+      if(Checksum(buf + offset, len) != ChecksumBytes(buf + offset, len)) {
+        printf("offset %u len %u: %04x, expected %04x\n", offset, len,
+          Checksum(buf + offset, len), ChecksumBytes(buf + offset, len));
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main()
+{
+  static u8 buf[64 + MAX_LEN];
+  int fail = 0;
+
+  // Random bytes, then all 0xFF for the largest sums
+  for(u32 i = 0; i < sizeof buf; i++)
+    buf[i] = (u8)SLATestRand();
+  fail |= TestAlignments(buf);
+  for(u32 i = 0; i < sizeof buf; i++)
+    buf[i] = 0xFF;
+  fail |= TestAlignments(buf);
+
+  // Longer than any local set, the byte sums go well past 16 bits
+  const u32 longLen = 1 << 20;
+  u8 *big = (u8*)malloc(longLen + 1);
+  for(u32 i = 0; i < longLen + 1; i++)
+    big[i] = (u8)(SLATestRand() | 0x80);
+  for(u32 offset = 0; offset < 2 && !fail; offset++)
+    for(u32 len = longLen - 1; len <= longLen && !fail; len++)
+      fail |= Checksum(big + offset, len) != ChecksumBytes(big + offset, len);
+  free(big);
+
+  printf("test_checksum: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// File playback delivers every frame of a clip with B-frames, the ones the
+// decoder still holds at the end of the file included (FFStartDrain, TASK_drain).
+// The count is checked against the frames of the video stream twice: played to
+// the end, and after Initialize has rebound the decoder to the file again half
+// way through, when nothing of the first pass may show up any more.
+//
+// It needs ffmpeg and SLAHalpc.cpp, so it is built with the Windows SLADecode
+// library rather than the Makefile:
+//   test_drain <file with B-frames>
+
+#include <stdio.h>
+#include "SLADecodeFFMpeg.h"
+#include "SLAHal.h"
+#include "SLATest.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#define EOF_WAIT_MS 60000
+
+typedef struct {
+  SLADecodeFFMPEG *dec;
+  volatile s32 frames;      // delivered since the last restart of the pts
+  volatile s32 total;       // delivered in all
+  volatile s32 restarts;    // times the pts went back, one per rebind
+  volatile s32 outOfOrder;  // pts going back other than at a rebind
+  s32 rebindAt;             // frames of the first pass before the rebind
+  s64 lastPts;
+  SLA_Sem rebindSem;        // posted by the callback at rebindAt
+  SLA_Sem reboundSem;       // posted once Initialize has queued the rebind
+  SLA_Sem eofSem;
+} DrainCount;
+
+// Frames of the video stream and whether it has B-frames, from the container
+static s32 VideoFrames(const char *fName, bool *bFrames)
+{
+  AVFormatContext *ctx = NULL;
+  if(avformat_open_input(&ctx, fName, NULL, NULL)!=0)
+    return -1;
+  if(avformat_find_stream_info(ctx, NULL)<0) {
+    avformat_close_input(&ctx);
+    return -1;
+  }
+  s32 video = av_find_best_stream(ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if(video<0) {
+    avformat_close_input(&ctx);
+    return -1;
+  }
+  *bFrames = ctx->streams[video]->codec->has_b_frames > 0;
+
+  // TS does not record nb_frames, then every video packet is a frame
+  s32 frames = (s32)ctx->streams[video]->nb_frames;
+  if(frames<=0) {
+    AVPacket packet;
+    frames = 0;
+    while(av_read_frame(ctx, &packet)>=0) {
+      if(packet.stream_index==video)
+        frames++;
+      av_free_packet(&packet);
+    }
+  }
+  avformat_close_input(&ctx);
+  return frames;
+}
+
+static bool onFrame(SLAImage *image, void *context, u32 capFlags)
+{
+  DrainCount *c = (DrainCount*)context;
+  if(capFlags & SLA_CAP_FLAG_EOF) {
+    SLASemPost(c->eofSem);
+    return true;
+  }
+  if(!image)
+    return true;
+
+  s64 pts;
+  if(c->dec->GetPts(image, &pts)==SLA_SUCCESS) {
+    // Frames come out in presentation order, pts only goes back when the file starts over
+    if(c->total>0 && pts<=c->lastPts) {
+      if(c->rebindAt && !c->restarts)
+        c->restarts++;
+      else
+        c->outOfOrder++;
+      c->frames = 0;
+    }
+    c->lastPts = pts;
+  }
+  c->frames++;
+  c->total++;
+  // The decoder waits here, so the rebind is taken before its next packet and
+  // not after the end of the file
+  if(c->rebindAt && c->total==c->rebindAt) {
+    SLASemPost(c->rebindSem);
+    SLASemPend(c->reboundSem, EOF_WAIT_MS);
+  }
+  return true;
+}
+
+// Play fName once, rebinding to it after rebindAt frames if that is not 0
+static int Play(const char *fName, s32 expected, s32 rebindAt)
+{
+  SLADecodeFFMPEG dec;
+  DrainCount c;
+  SLAMemset(&c, 0, sizeof(c));
+  c.dec = &dec;
+  c.rebindAt = rebindAt;
+  c.rebindSem = SLASemCreate(0);
+  c.reboundSem = SLASemCreate(0);
+  c.eofSem = SLASemCreate(0);
+
+  SLA_CHECK(dec.Initialize(fName, SLA_IMAGE_YUV_420, onFrame, &c)==SLA_SUCCESS);
+  dec.SetPlaybackSpeed(0);
+  if(rebindAt) {
+    SLA_CHECK(SLASemPend(c.rebindSem, EOF_WAIT_MS));
+    SLStatus rv = dec.Initialize(fName, SLA_IMAGE_YUV_420, onFrame, &c);
+    SLASemPost(c.reboundSem);
+    SLA_CHECK(rv==SLA_SUCCESS);
+  }
+  bool eof = SLASemPend(c.eofSem, EOF_WAIT_MS);
+  dec.Cleanup();
+  SLASemDestroy(c.rebindSem);
+  SLASemDestroy(c.reboundSem);
+  SLASemDestroy(c.eofSem);
+
+  printf("%s: %d of %d frames after %d rebinds\n", rebindAt ? "rebind" : "eof",
+    c.frames, expected, c.restarts);
+  SLA_CHECK(eof);
+  SLA_CHECK(c.outOfOrder==0);
+  SLA_CHECK(c.restarts==(rebindAt ? 1 : 0));
+  SLA_CHECK(c.frames==expected);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc<2) {
+    printf("usage: test_drain <file with B-frames>\n");
+    return 2;
+  }
+  av_register_all();
+
+  bool bFrames = false;
+  s32 expected = VideoFrames(argv[1], &bFrames);
+  if(expected<=0) {
+    printf("%s: no video frames\n", argv[1]);
+    return 1;
+  }
+  if(!bFrames) {
+    printf("%s has no B-frames, nothing is held back for the drain\n", argv[1]);
+    return 1;
+  }
+
+  int fail = Play(argv[1], expected, 0) || Play(argv[1], expected, expected/2);
+  printf("test_drain: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// The table driven UAS Datalink LS decoder: item lengths each tag accepts, zero
+// and sign extension, and random packets, which decode again to the same
+// KLVData after WriteKlvFrame.
+
+#include <stdio.h>
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLATestKlv.h"
+
+#define FUZZ_PACKETS 200000
+
+static KLVStore storeA, storeB;
+static KLVData a, b;
+
+static bool IsInteger(const KLVTag *t)
+{
+  return t->type >= KLV_TYPE_U8 && t->type <= KLV_TYPE_INT;
+}
+
+static u64 FieldValue(const KLVData *k, const KLVTag *t)
+{
+  const u8 *f = (const u8*)k + t->offset;
+  switch(t->size) {
+    case 1: return *f;
+    case 2: return *(const u16*)f;
+    case 4: return *(const u32*)f;
+  }
+  return *(const u64*)f;
+}
+
+// Every length from 0 to 9 of every integer tag, with the top bit of the value set
+static int TestItemLengths()
+{
+  for(u32 tag = 2; tag < KLV_PRESENT_TAGS; tag++) {
+    const KLVTag *t = &klvTags[tag];
+    if(!IsInteger(t))
+      continue;
+    for(u32 len = 0; len <= 9; len++) {
+      u8 items[16], frame[64];
+      items[0] = (u8)tag;
+      items[1] = (u8)len;
+      u64 v = 0;
+      for(u32 i = 0; i < len; i++) {
+        items[2+i] = (u8)(i == 0 ? 0x80 | i : 0x10 + i);
+        v = (v << 8) | items[2+i];
+      }
+      u32 n = SLATestFrame(items, 2+len, frame);
+      SLInitKLV(&a, &storeA);
+      s32 rv = ReadKlvFrame(&a, frame, (u16)n, 0);
+      bool valid = len <= 8 && (t->lenMask & (1 << len));
+      SLA_CHECK(rv == (valid ? 1 : 0));
+      if(!valid)
+        continue;
+      SLA_CHECK(KLV_IS_PRESENT(&a, tag));
+      if(t->type == KLV_TYPE_INT && len < 8)
+        v |= ~0ull << (8*len);        // the top bit is set, so sign extended
+      u64 mask = t->size == 8 ? ~0ull : (1ull << (8*t->size)) - 1;
+      SLA_CHECK(FieldValue(&a, t) == (v & mask));
+    }
+  }
+  return 0;
+}
+
+// #39 is one byte signed in ST 0601, and two and four byte values are taken too
+static int TestOutsideAirTemp()
+{
+  static const struct { u8 len; u8 v[4]; s32 value; } cases[] = {
+    {1, {0x05}, 5},
+    {1, {0xFF}, -1},
+    {1, {0x80}, -128},
+    {2, {0xFF, 0x38}, -200},
+    {2, {0x01, 0x2C}, 300},
+    {4, {0xFF, 0xFE, 0x79, 0x60}, -100000},
+    {4, {0x7F, 0xFF, 0xFF, 0xFF}, 0x7FFFFFFF},
+  };
+  for(u32 c = 0; c < sizeof cases / sizeof cases[0]; c++) {
+    u8 items[8], frame[64], again[256];
+    items[0] = SL_LDS_KEY_OUTSIDEAIRTEMP;
+    items[1] = cases[c].len;
+    memcpy(items+2, cases[c].v, cases[c].len);
+    u32 n = SLATestFrame(items, 2+cases[c].len, frame);
+    SLInitKLV(&a, &storeA);
+    SLA_CHECK(ReadKlvFrame(&a, frame, (u16)n, 0) == 1);
+    SLA_CHECK(a.OutsideAirTemp == cases[c].value);
+
+    // Written back in the fewest of 1, 2 or 4 bytes that hold it
+    n = WriteKlvFrame(&a, NULL, again, sizeof again);
+    SLA_CHECK(n > 0);
+    u32 len = cases[c].value >= -128 && cases[c].value < 128 ? 1
+      : cases[c].value >= -32768 && cases[c].value < 32768 ? 2 : 4;
+    SLA_CHECK(again[17] == SL_LDS_KEY_OUTSIDEAIRTEMP && again[18] == len);
+    SLInitKLV(&b, &storeB);
+    SLA_CHECK(ReadKlvFrame(&b, again, (u16)n, 0) == 1);
+    SLA_CHECK(b.OutsideAirTemp == cases[c].value);
+  }
+  return 0;
+}
+
+// Random items, mostly of a length the tag takes; whatever decodes must come
+// back the same through WriteKlvFrame
+static int TestFuzzRoundTrip()
+{
+  u32 decoded = 0;
+  for(u32 it = 0; it < FUZZ_PACKETS; it++) {
+    u8 items[1024], frame[1100], again[4096];
+    u32 j = 0;
+    u32 nItems = SLATestRand() % 16;
+    for(u32 e = 0; e < nItems; e++) {
+      u32 tag;
+      do
+        tag = 2 + SLATestRand() % (SLATestRand() % 8 ? 99 : 126);
+      while(klvTags[tag].type == KLV_TYPE_SECURITY || klvTags[tag].type == KLV_TYPE_VMTI);
+      const KLVTag *t = &klvTags[tag];
+      u32 len;
+      if(t->lenMask && SLATestRand() % 8) {
+        do
+          len = 1 << (SLATestRand() % 4);
+        while(!(t->lenMask & (1 << len)));
+      } else {
+        len = SLATestRand() % (SLATestRand() % 4 ? 10 : 200);
+      }
+      items[j++] = (u8)tag;
+      if(len < 128) {
+        items[j++] = (u8)len;
+      } else {
+        items[j++] = 0x81;
+        items[j++] = (u8)len;
+      }
+      for(u32 i = 0; i < len; i++)
+        items[j++] = (u8)SLATestRand();
+    }
+    u32 n = SLATestFrame(items, j, frame);
+    if(SLATestRand() % 16 == 0)
+      frame[SLATestRand() % n] ^= (u8)(1 + SLATestRand() % 255);
+
+    SLInitKLV(&a, &storeA);
+    if(ReadKlvFrame(&a, frame, (u16)n, 0) != 1)
+      continue;
+    decoded++;
+    n = WriteKlvFrame(&a, NULL, again, sizeof again);
+    SLA_CHECK(n > 0);
+    SLInitKLV(&b, &storeB);
+    SLA_CHECK(ReadKlvFrame(&b, again, (u16)n, 0) == 1);
+    u32 tag = SLATestDiffKLV(&a, &b);
+    if(tag)
+      printf("packet %u: tag %u differs\n", it, tag);
+    SLA_CHECK(tag == 0);
+  }
+  // The lengths are chosen so that a good share of the packets is valid
+  SLA_CHECK(decoded > FUZZ_PACKETS/10);
+  return 0;
+}
+
+// A copy made with SLCopyKLV keeps its strings and targets when the original's
+// store is reused; a zeroed KLVData decodes into once bound to a store
+static int TestCopy()
+{
+  static KLVStore storeC;
+  KLVData c;
+  u8 frame[1024];
+  SLInitKLV(&a, &storeA);
+  a.Missionid.len = 4;
+  memcpy(a.Missionid.data, "ABCD", 4);
+  KLV_SET_PRESENT(&a, 3);
+  a.VMti.nTargets = a.VMti.nReported = 1;
+  a.VMti.Target[0].TargetIDNumber = 7;
+  KLV_SET_PRESENT(&a, 74);
+  u32 n = WriteKlvFrame(&a, NULL, frame, sizeof frame);
+  SLA_CHECK(n > 0);
+
+  SLCopyKLV(&c, &storeC, &a);
+  SLA_CHECK(SLATestDiffKLV(&a, &c) == 0);
+  SLA_CHECK(c.Missionid.data != a.Missionid.data && c.VMti.Target != a.VMti.Target);
+  memset(&storeA, 0, sizeof storeA);
+  SLA_CHECK(!memcmp(c.Missionid.data, "ABCD", 4) && c.VMti.Target[0].TargetIDNumber == 7);
+
+  memset(&b, 0, sizeof b);
+  SLBindKLV(&b, &storeB);
+  SLA_CHECK(ReadKlvFrame(&b, frame, (u16)n, 0) == 1);
+  SLA_CHECK(SLATestDiffKLV(&b, &c) == 0);
+  return 0;
+}
+
+int main()
+{
+  int fail = TestItemLengths() || TestOutsideAirTemp() || TestCopy() || TestFuzzRoundTrip();
+  printf("test_klvdecode: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+}
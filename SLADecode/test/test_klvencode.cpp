@@ -0,0 +1,205 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// WriteKlvFrame and SLAKlvTsWrite: random KLVData, security and VMTI sets
+// included, read back with ReadKlvFrame from the local set and from the
+// payload of the TS packets it was split into.
+
+#include <stdio.h>
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLATestKlv.h"
+
+#define TEST_FRAMES 20000
+#define KLV_PID     0x1F1
+
+static KLVStore storeIn, storeOut;
+static KLVData in, out;
+
+// Random value of up to size bytes, mostly short ones
+static u64 RandomValue(u32 size)
+{
+  u32 bytes = SLATestRand() % 2 ? size : 1 + SLATestRand() % size;
+  u64 v = 0;
+  for(u32 b = 0; b < bytes; b++)
+    v = (v << 8) | (u8)SLATestRand();
+  return v;
+}
+
+static void RandomBytes(KLVBytes *b)
+{
+  b->len = (u8)(SLATestRand() % 4 ? SLATestRand() % 16 : SLATestRand() % (KLV_MAX_BYTE_ARRAY+1));
+  for(u32 i = 0; i < b->len; i++)
+    b->data[i] = (u8)SLATestRand();
+}
+
+static void RandomSecurity(KLVSecurityLocalSet *s)
+{
+  s->Classification = (u8)SLATestRand();
+  s->ClassifyingCountryCodingMethod = (u8)SLATestRand();
+  RandomBytes(&s->ClassifyingCountry);
+  RandomBytes(&s->SCISHIInformation);
+  RandomBytes(&s->Caveats);
+  RandomBytes(&s->ReleasingInstructions);
+  s->ObjectCountryCodingMethod = (u8)SLATestRand();
+  RandomBytes(&s->ObjectCountryCodes);
+  s->SecurityMetadataVersion = (u16)SLATestRand();
+}
+
+static void RandomVmti(KLVVmtiLocalSet *v)
+{
+  v->nTargets = (u16)(SLATestRand() % 8 ? SLATestRand() % 6 : SLATestRand() % (KLV_MAX_NUMBER_OF_TARGETS+1));
+  v->nReported = (u16)(v->nTargets + SLATestRand() % 3);
+  v->Version = (u16)RandomValue(2);
+  v->FrameWidth = (u16)RandomValue(2);
+  v->FrameHeight = (u16)RandomValue(2);
+  for(u32 i = 0; i < v->nTargets; i++) {
+    KLVVTargetPack *t = &v->Target[i];
+    t->TargetIDNumber = (u32)RandomValue(4) & 0x0FFFFFFF;   // 4 byte BER-OID at most
+    t->TargetCentroidPixelNumber = (u32)RandomValue(4);
+    t->BoundingBoxTopLeftPixelNumber = SLATestRand() % 2 ? (u32)RandomValue(4) : 0;
+    t->BoundingBoxBottomRightPixelNumber = SLATestRand() % 2 ? (u32)RandomValue(4) : 0;
+    t->TargetConfidenceNumber = (u8)SLATestRand();
+  }
+}
+
+// About a third of the tags, any value their field holds
+static void RandomKLV(KLVData *k)
+{
+  SLResetKLV(k);
+  for(u32 tag = 2; tag < KLV_PRESENT_TAGS; tag++) {
+    const KLVTag *t = &klvTags[tag];
+    if(!t->size || SLATestRand() % 3)
+      continue;
+    u8 *f = (u8*)k + t->offset;
+    u64 v;
+    switch(t->type) {
+      case KLV_TYPE_U8:
+      case KLV_TYPE_U16:
+      case KLV_TYPE_U32:
+      case KLV_TYPE_U64:
+        v = RandomValue(t->size);
+        memcpy(f, &v, t->size);     // little-endian, the low bytes
+        break;
+      case KLV_TYPE_INT: {
+        u32 shift = 64 - 8*(1 + SLATestRand() % t->size);
+        v = (u64)((s64)(RandomValue(t->size) << shift) >> shift);
+        memcpy(f, &v, t->size);
+        break;
+      }
+      case KLV_TYPE_BYTES:
+        RandomBytes((KLVBytes*)f);
+        break;
+      case KLV_TYPE_SECURITY:
+        RandomSecurity((KLVSecurityLocalSet*)f);
+        break;
+      case KLV_TYPE_VMTI:
+        RandomVmti((KLVVmtiLocalSet*)f);
+        break;
+    }
+    KLV_SET_PRESENT(k, tag);
+  }
+}
+
+static s64 ReadPts(const u8 *p)
+{
+  return ((s64)(p[0] & 0x0E) << 29) | (p[1] << 22) | ((p[2] & 0xFE) << 14) | (p[3] << 7) | (p[4] >> 1);
+}
+
+// Check the TS packets and PES header SLAKlvTsWrite made and put the local set
+// back together in klv
+// returns the set length, 0 if anything is wrong
+static u32 Demux(const u8 *ts, u32 len, u8 *cc, s64 pts, u8 *sequence, u8 *klv)
+{
+  static u8 pes[0x10000];
+  u32 pesLen = 0;
+  for(u32 i = 0; i < len; i += 188) {
+    const u8 *p = ts + i;
+    if(p[0] != 0x47 || (p[1] & 0x1F) != (KLV_PID >> 8) || p[2] != (KLV_PID & 0xFF))
+      return 0;
+    if(!!(p[1] & 0x40) != (i == 0) || (p[3] & 0x0F) != *cc)
+      return 0;
+    *cc = (*cc + 1) & 0x0F;
+    u32 start = 4;
+    if(p[3] & 0x20)
+      start += 1 + p[4];
+    if(!(p[3] & 0x10) || start > 188)
+      return 0;
+    memcpy(pes + pesLen, p + start, 188 - start);
+    pesLen += 188 - start;
+  }
+
+  if(pes[0] != 0 || pes[1] != 0 || pes[2] != 1)
+    return 0;
+  bool sync = pts != SLA_KLV_NO_PTS;
+  if(pes[3] != (sync ? 0xFC : 0xBD))
+    return 0;
+  u32 length = (pes[4] << 8) | pes[5];
+  if(6 + length != pesLen)
+    return 0;
+  u32 at = 9 + pes[8];
+  if(sync) {
+    if(pes[7] != 0x80 || pes[8] != 5 || (pes[9] >> 4) != 2 || ReadPts(pes + 9) != (pts & 0x1FFFFFFFFll))
+      return 0;
+    // metadata AU cell: service id, sequence number, flags, cell length
+    if(pes[at+1] != (*sequence)++)
+      return 0;
+    u32 cell = (pes[at+3] << 8) | pes[at+4];
+    at += 5;
+    if(at + cell != pesLen)
+      return 0;
+  }
+  memcpy(klv, pes + at, pesLen - at);
+  return pesLen - at;
+}
+
+int main()
+{
+  static u8 frame[0x10000], ts[400*188], back[0x10000];
+  SLAKlvTsMux mux;
+  u8 cc = 0, sequence = 0;
+  SLInitKLV(&in, &storeIn);
+  SLInitKLV(&out, &storeOut);
+  SLAKlvTsInit(&mux, KLV_PID);
+
+  int fail = 0;
+  for(u32 i = 0; i < TEST_FRAMES && !fail; i++) {
+    RandomKLV(&in);
+    u32 n = WriteKlvFrame(&in, NULL, frame, sizeof frame);
+    if(!n) {
+      printf("frame %u: not written\n", i);
+      fail = 1;
+      break;
+    }
+
+    SLResetKLV(&out);
+    u32 tag = ReadKlvFrame(&out, frame, (u16)n, 0) == 1 ? SLATestDiffKLV(&in, &out) : 1;
+    if(tag) {
+      printf("frame %u: tag %u differs\n", i, tag);
+      fail = 1;
+      break;
+    }
+
+    // A buffer too small for it writes nothing
+    if(WriteKlvFrame(&in, NULL, back, n-1) != 0) {
+      printf("frame %u: written to a short buffer\n", i);
+      fail = 1;
+      break;
+    }
+
+    s64 pts = SLATestRand() % 4 ? (s64)i*3003 + ((s64)1 << 32) : SLA_KLV_NO_PTS;
+    u32 tsLen = SLAKlvTsWrite(&mux, frame, n, pts, ts, sizeof ts);
+    u32 m = tsLen ? Demux(ts, tsLen, &cc, pts, &sequence, back) : 0;
+    SLResetKLV(&out);
+    if(m != n || memcmp(back, frame, n) || ReadKlvFrame(&out, back, (u16)m, 0) != 1 || SLATestDiffKLV(&in, &out)) {
+      printf("frame %u: TS packets of %u bytes don't hold the set\n", i, n);
+      fail = 1;
+    }
+  }
+  printf("test_klvencode: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+// SLAKlvExtract against synthetic transport streams made with WriteKlvFrame and
+// SLAKlvTsWrite: every set comes back as SLAKlvFormat prints it, whether sets
+// get a PES of their own or are split across PES packets between video packets.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SLAKlvDecode.h"
+#include "SLAKlvEncode.h"
+#include "SLAKlvExtract.h"
+#include "SLATest.h"
+
+#define TEST_TS     "test_klvextract.ts"
+#define TEST_SETS   500
+#define KLV_PID     0x102
+#define VIDEO_PID   0x101
+#define MAX_LINE    8192
+#define MAX_SET     2048
+
+static u8 sets[TEST_SETS][MAX_SET];
+static u32 setLen[TEST_SETS];
+static KLVStore store;
+static KLVData klv;
+
+static void WritePsi(FILE *f, u16 pid, const u8 *section, u32 len)
+{
+  u8 p[188];
+  memset(p, 0xFF, sizeof p);
+  p[0] = 0x47;
+  p[1] = 0x40 | (u8)(pid >> 8);
+  p[2] = (u8)pid;
+  p[3] = 0x10;
+  p[4] = 0;         // pointer field
+  memcpy(p+5, section, len);
+  fwrite(p, 1, sizeof p, f);
+}
+
+static void WriteTables(FILE *f)
+{
+  static const u8 pat[] = {0x00, 0xB0, 13, 0, 1, 0xC1, 0, 0,  0, 1, 0xE1, 0x00,  0, 0, 0, 0};
+  static const u8 pmt[] = {0x02, 0xB0, 29, 0, 1, 0xC1, 0, 0,  0xE1, 0x01, 0xF0, 0,
+                           0x1B, 0xE1, 0x01, 0xF0, 0,
+                           0x06, 0xE1, 0x02, 0xF0, 6,  0x05, 4, 'K', 'L', 'V', 'A',
+                           0, 0, 0, 0};
+  WritePsi(f, 0, pat, sizeof pat);
+  WritePsi(f, 0x100, pmt, sizeof pmt);
+}
+
+static void WriteVideo(FILE *f, u32 n)
+{
+  u8 p[188];
+  memset(p, 0x55, sizeof p);
+  p[0] = 0x47;
+  p[1] = VIDEO_PID >> 8;
+  p[2] = VIDEO_PID & 0xFF;
+  p[3] = 0x10;
+  for(u32 i = 0; i < n; i++)
+    fwrite(p, 1, sizeof p, f);
+}
+
+// Set i with strings that need escaping, negative values and VMTI and security sets
+static void MakeSet(u32 i)
+{
+  SLResetKLV(&klv);
+  klv.Utctime = 1459000000000000ull + i*33366;
+  KLV_SET_PRESENT(&klv, 2);
+  klv.PlatformPitchAngle = (s16)(-(s32)(i % 300));
+  KLV_SET_PRESENT(&klv, 6);
+  klv.SensorLatitude = (s32)(SLATestRand() << 1);
+  KLV_SET_PRESENT(&klv, 13);
+  if(i % 3 == 0) {
+    static const char mission[] = "M\"1,\\\x01";
+    klv.Missionid.len = sizeof mission - 1;
+    memcpy(klv.Missionid.data, mission, klv.Missionid.len);
+    KLV_SET_PRESENT(&klv, 3);
+  }
+  if(i % 7 == 0) {
+    klv.VMti.nTargets = 2;
+    klv.VMti.nReported = 3;
+    klv.VMti.FrameWidth = 640;
+    klv.VMti.Target[0].TargetIDNumber = 5;
+    klv.VMti.Target[0].TargetCentroidPixelNumber = 1234 + i;
+    klv.VMti.Target[1].TargetIDNumber = 6;
+    KLV_SET_PRESENT(&klv, 74);
+  }
+  if(i % 11 == 0) {
+    klv.SecurityLDS.Classification = 1;
+    klv.SecurityLDS.ClassifyingCountryCodingMethod = 1;
+    klv.SecurityLDS.ClassifyingCountry.len = 4;
+    memcpy(klv.SecurityLDS.ClassifyingCountry.data, "//US", 4);
+    klv.SecurityLDS.SecurityMetadataVersion = SECURITY_METADATA_VERSION;
+    KLV_SET_PRESENT(&klv, 48);
+  }
+  setLen[i] = WriteKlvFrame(&klv, NULL, sets[i], MAX_SET);
+}
+
+// Line of set i as SLAKlvExtract should print it
+static u32 Expected(u32 i, s64 pts, s32 format, char *line)
+{
+  KLVData k;
+  static KLVStore s;
+  SLInitKLV(&k, &s);
+  if(ReadKlvFrame(&k, sets[i], (u16)setLen[i], 0) != 1)
+    return 0;
+  return SLAKlvFormat(&k, pts, format, line, MAX_LINE);
+}
+
+// Compare a line from the extractor with the expected one, from the first comma on
+// when the pts is not known
+static int SameLine(const char *got, const char *want, bool withPts)
+{
+  if(!withPts) {
+    got = strchr(got, ',');
+    want = strchr(want, ',');
+    if(!got || !want)
+      return 0;
+  }
+  return !strcmp(got, want);
+}
+
+static SLStatus Extract(s32 format, u16 pid, FILE **out, SLAKlvExtractStats *stats)
+{
+  *out = tmpfile();
+  SLStatus rv = SLAKlvExtract(TEST_TS, *out, format, pid, stats);
+  rewind(*out);
+  return rv;
+}
+
+// One synchronous PES per set with its own pts
+static int TestSetPerPes(s32 format)
+{
+  static u8 ts[16*MAX_SET];
+  SLAKlvTsMux mux;
+  SLAKlvTsInit(&mux, KLV_PID);
+  FILE *f = fopen(TEST_TS, "wb");
+  SLA_CHECK(f);
+  WriteTables(f);
+  for(u32 i = 0; i < TEST_SETS; i++) {
+    u32 n = SLAKlvTsWrite(&mux, sets[i], setLen[i], (s64)i*3003, ts, sizeof ts);
+    SLA_CHECK(n > 0 && n % 188 == 0);
+    fwrite(ts, 1, n, f);
+    WriteVideo(f, i % 5);
+  }
+  fclose(f);
+
+  FILE *out;
+  SLAKlvExtractStats stats;
+  SLA_CHECK(Extract(format, 0, &out, &stats) == SLA_SUCCESS);
+  SLA_CHECK(stats.pid == KLV_PID);
+  SLA_CHECK(stats.sets == TEST_SETS);
+  SLA_CHECK(stats.badSets == 0);
+  SLA_CHECK(stats.ccErrors == 0);
+
+  static char got[MAX_LINE], want[MAX_LINE];
+  if(SLAKlvFormatHeader(format, want, MAX_LINE)) {
+    SLA_CHECK(fgets(got, MAX_LINE, out));
+    SLA_CHECK(!strcmp(got, want));
+  }
+  for(u32 i = 0; i < TEST_SETS; i++) {
+    SLA_CHECK(Expected(i, (s64)i*3003, format, want));
+    SLA_CHECK(fgets(got, MAX_LINE, out));
+    SLA_CHECK(SameLine(got, want, true));
+  }
+  SLA_CHECK(!fgets(got, MAX_LINE, out));
+  fclose(out);
+  return 0;
+}
+
+// The sets as one byte stream cut into random pieces, one PES each, found again
+// with the PID given and without the tables; drop is a KLV packet left out, -1 for none
+static int TestSplitSets(s32 format, s32 drop)
+{
+  static u8 stream[TEST_SETS*MAX_SET];
+  static u8 ts[512*188];
+  u32 len = 0;
+  for(u32 i = 0; i < TEST_SETS; i++) {
+    memcpy(stream + len, sets[i], setLen[i]);
+    len += setLen[i];
+  }
+
+  SLAKlvTsMux mux;
+  SLAKlvTsInit(&mux, KLV_PID);
+  FILE *f = fopen(TEST_TS, "wb");
+  SLA_CHECK(f);
+  s32 packet = 0;
+  for(u32 pos = 0; pos < len; ) {
+    u32 piece = SLATestRand() % 4 == 0 ? 1 + SLATestRand() % 20 : 30 + SLATestRand() % 600;
+    piece = SLMIN(piece, len - pos);
+    u32 n = SLAKlvTsWrite(&mux, stream + pos, piece, (s64)pos, ts, sizeof ts);
+    SLA_CHECK(n > 0);
+    for(u32 j = 0; j < n; j += 188, packet++)
+      if(packet != drop)
+        fwrite(ts + j, 1, 188, f);
+    WriteVideo(f, SLATestRand() % 3);
+    pos += piece;
+  }
+  fclose(f);
+
+  FILE *out;
+  SLAKlvExtractStats stats;
+  SLA_CHECK(Extract(format, KLV_PID, &out, &stats) == SLA_SUCCESS);
+  SLA_CHECK(stats.pid == KLV_PID);
+
+  static char got[MAX_LINE], want[MAX_LINE];
+  if(SLAKlvFormatHeader(format, want, MAX_LINE))
+    SLA_CHECK(fgets(got, MAX_LINE, out));
+  if(drop < 0) {
+    SLA_CHECK(stats.sets == TEST_SETS);
+    SLA_CHECK(stats.badSets == 0);
+    SLA_CHECK(stats.ccErrors == 0);
+    for(u32 i = 0; i < TEST_SETS; i++) {
+      SLA_CHECK(Expected(i, 0, format, want));
+      SLA_CHECK(fgets(got, MAX_LINE, out));
+      SLA_CHECK(SameLine(got, want, false));
+    }
+  } else {
+    // The loss is counted and costs no more than the sets of the PES it was in
+    SLA_CHECK(stats.ccErrors == 1);
+    SLA_CHECK(stats.sets >= TEST_SETS - 10);
+    SLA_CHECK(stats.sets < TEST_SETS);
+    u32 lines = 0;
+    while(fgets(got, MAX_LINE, out))
+      lines++;
+    SLA_CHECK(lines == stats.sets);
+  }
+  fclose(out);
+  return 0;
+}
+
+// A stream with video only has nothing to extract
+static int TestNoKlv()
+{
+  FILE *f = fopen(TEST_TS, "wb");
+  SLA_CHECK(f);
+  WriteVideo(f, 100);
+  fclose(f);
+
+  FILE *out;
+  SLAKlvExtractStats stats;
+  SLA_CHECK(Extract(SLA_KLV_TEXT_JSON, 0, &out, &stats) != SLA_SUCCESS);
+  fclose(out);
+  SLA_CHECK(SLAKlvExtract("no such file.ts", stdout, SLA_KLV_TEXT_JSON, 0, &stats) != SLA_SUCCESS);
+  return 0;
+}
+
+int main()
+{
+  SLInitKLV(&klv, &store);
+  for(u32 i = 0; i < TEST_SETS; i++)
+    MakeSet(i);
+
+  int fail = TestSetPerPes(SLA_KLV_TEXT_JSON) || TestSetPerPes(SLA_KLV_TEXT_CSV)
+    || TestSplitSets(SLA_KLV_TEXT_JSON, -1) || TestSplitSets(SLA_KLV_TEXT_CSV, -1)
+    || TestSplitSets(SLA_KLV_TEXT_JSON, 20) || TestNoKlv();
+  remove(TEST_TS);
+  printf("test_klvextract: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+}
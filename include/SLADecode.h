@@ -18,6 +18,54 @@ enum SLA_PROFILE {
   HIGH
 };
 
+/// Frames to decode, see SLADecode::SetDecodeMode
+enum SLA_DECODE_MODE {
+  DECODE_ALL = 0,             // Every frame
+  DECODE_REFERENCE_ONLY,      // Skip non-reference (B) frames
+  DECODE_KEYFRAMES_ONLY       // Key/intra frames only, e.g. for thumbnails
+};
+
+/// Handling of frames damaged by packet loss, see SLADecode::SetCorruptPolicy
+enum SLA_CORRUPT_POLICY {
+  CORRUPT_DELIVER = 0,        // Show every frame
+  CORRUPT_FREEZE,             // Keep showing the last good frame while frames have decode errors
+  CORRUPT_WAIT_KEYFRAME       // Keep showing the last good frame until the next clean key frame
+};
+
+/// Deinterlacing of analog-sourced video, see SLADecode::SetDeinterlace
+enum SLA_DEINTERLACE_MODE {
+  DEINTERLACE_OFF = 0,
+  DEINTERLACE_BOB,            // one field scaled to full height, cheapest
+  DEINTERLACE_MOTION          // motion-adaptive, keeps full resolution where the picture is still
+};
+
+/// Scaling quality of the output conversion, see SLADecode::SetConvertQuality
+enum SLA_CONVERT_QUALITY {
+  CONVERT_FAST = 0,           // fast bilinear (default)
+  CONVERT_POINT,              // nearest neighbour
+  CONVERT_BILINEAR,
+  CONVERT_BICUBIC,
+  CONVERT_ADAPTIVE            // trade quality for speed as the load changes
+};
+
+/// Frame latency stages, see SLADecode::GetLatency
+enum SLA_LATENCY_STAGE {
+  LATENCY_RECEIVE = 0,        // first packet received to frame demuxed
+  LATENCY_QUEUE,              // frame demuxed to decode start
+  LATENCY_DECODE,             // decoding the compressed frame
+  LATENCY_CONVERT,            // decode end to color conversion end
+  LATENCY_CALLBACK,           // conversion end to frame callback return
+  LATENCY_TOTAL               // first packet received to frame callback return
+};
+
+typedef struct {
+  u32 Count;		// frames measured
+  float P50;		// msec, median
+  float P99;		// msec
+  float P999;		// msec
+  float Max;		// msec
+} SLLatencyStats;
+
 #define CAP_STATS_NAME_LENGTH 10
 typedef struct {
   float TotalBitRate;	// average total kilobits per second
@@ -34,16 +82,34 @@ typedef struct {
 
   u32 KeyFrames;
   u32 IFrames, PFrames, BFrames, OtherFrames;
+
+  u32 DispatchOverwrites;	// frames the async capture callback skipped
+  u32 DiscardedFrames;		// frames dropped before decoding by SetDecodeMode
+
+  float DecodeLoad;		// percent of one core used to decode and convert frames
+  u32 DecodeScale;		// decoded resolution divisor in preview mode (1 = full size)
+
+  float LatenessAvg;	// file playback: average msec frames are shown late
+  float LatenessMax;	// file playback: worst msec late
+  u32 LateDrops;		// file playback: frames dropped for lateness
+
+  u32 CCErrors;			// compressed frames with lost packets
+  u32 DecodeErrors;		// compressed frames the decoder rejected
+  u32 CorruptFrames;	// decoded frames damaged by errors or losses
+  u32 CorruptDrops;		// damaged frames not shown, see SetCorruptPolicy
+
+  u32 ConvertSkips;		// frames not converted because newer ones were waiting, see SetConvertQuality
 } SLCapStats;
 
 /*!
-*  Function type called back when a decoded frame is available
+*  Function type called back when a decoded frame is available.  klv and klvRecent
+*  are only valid during the call, see SLADecode::CopyKLVData to keep them.
 */
 typedef  void(__cdecl *SLADecodeCB) (
   void *context,      //!< User-defined context
   SLAImage *image,    //!< Pointer to image description.  Could be NULL
   KLVData *klv,       //!< Most current (including values unchanged on this cycle) data values
-  KLVData *klvRecent  //!< Pointer to only recently-changed data values
+  KLVData *klvRecent  //!< Pointer to only recently-changed data values, KLV_IS_PRESENT() gives the tags in this packet
   );
 
 
@@ -86,6 +152,17 @@ public:
   */
   int Destroy();
 
+  /*!
+  *  Keep up to size udp:// decoders alive after Destroy, parked, so the next Create
+  *  rebinds one to its address instead of starting a new decoder.  Switching
+  *  cameras then skips thread creation, buffer allocation and, for the same
+  *  codec, the codec open.  Call with 0 before exit to free parked decoders.
+  *  @return 0 for success, -1 if the pool lock could not be created
+  */
+  static int SetPoolSize(
+    int size     //!< Maximum parked decoders, 0 (default) disables pooling
+    );
+
   /*!
   *  Change the stream that the decoder is listenting to
   *  @return 0 for success, -1 for failure
@@ -103,6 +180,15 @@ public:
     bool resample   //!< true to resample, false to not
     );
 
+  /*!
+  *  Remove combing from interlaced PAL/NTSC sources.  Done in the same pass
+  *  as the PAL resampling.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetDeinterlace(
+    SLA_DEINTERLACE_MODE mode   //!< Deinterlacer to use
+    );
+
   /*!
   *  Set special upsampling factor to compensate for a downsampled compressed image sent
   *  @return 0 for success, -1 for failure
@@ -112,6 +198,84 @@ public:
     );
   int GetUpSample( );
 
+  /*!
+  *  Open addresses that go through the ffmpeg demuxer as MPEG-TS without
+  *  probing the stream first.  udp:// addresses never probe.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetFastOpen(
+    bool enable   //!< true if the stream is known to be MPEG-TS
+    );
+
+  /*!
+  *  Decode all frames, reference frames only or key frames only.  Can be changed
+  *  at any time, e.g. to bring a thumbnail to full rate when it is selected.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetDecodeMode(
+    SLA_DECODE_MODE mode   //!< Frames to decode
+    );
+  SLA_DECODE_MODE GetDecodeMode( );
+
+  /*!
+  *  Choose whether frames damaged by packet loss are shown.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetCorruptPolicy(
+    SLA_CORRUPT_POLICY policy   //!< What to do with damaged frames
+    );
+
+  /*!
+  *  Scaling quality of the output frames.  CONVERT_ADAPTIVE scales more cheaply
+  *  and skips frames that are about to be replaced when decoding falls behind.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetConvertQuality(
+    SLA_CONVERT_QUALITY quality   //!< Scaling quality, CONVERT_ADAPTIVE to follow the load
+    );
+
+  /*!
+  *  Latency percentiles of one stage of the frame path since the stream
+  *  started or ResetLatency was called.  Can be called at any time.
+  *  @return 0 for success, -1 for failure
+  */
+  int GetLatency(
+    SLA_LATENCY_STAGE stage,  //!< Stage to report
+    SLLatencyStats *stats     //!< Filled in with the percentiles
+    );
+  void ResetLatency( );
+
+  /*!
+  *  Presentation time in usec of a frame handed to the decode callback.
+  *  @return 0 for success, -1 if the frame is not from this decoder or has no time
+  */
+  int GetPts(
+    const SLAImage *image,  //!< Frame from the decode callback
+    s64 *pts                //!< Filled in with the presentation time
+    );
+
+  /*!
+  *  Metadata valid at a frame time: the KLV samples before and after it, and
+  *  the angles, positions and frame corners interpolated between them.
+  *  Corners and center not sent are computed from the sensor pose and field of view.
+  *  Lock free, can be called at any time.
+  *  @return 0 for success, -1 if no metadata was received at or before pts
+  */
+  int GetKlvAt(
+    s64 pts,        //!< usec presentation time, see GetPts
+    KLVGeoAt *at    //!< Filled in with the samples and interpolated values
+    );
+
+  /*!
+  *  Deliver frames at a thumbnail size, decoding at reduced resolution where
+  *  the codec allows.  Pass 0,0 to go back to full resolution.
+  *  @return 0 for success, -1 for failure
+  */
+  int SetPreviewSize(
+    int high,   //!< Tile height
+    int wide    //!< Tile width
+    );
+
 
   /*!
   *  Begin saving decoded video/metadata stream to specified filename
@@ -145,18 +309,69 @@ public:
   */
   int Seek(double timeStamp);
 
+  /*!
+  *	Seek a file to a frame number, counted from the start of the file
+  *	@return 0 for success, -1 for failure.
+  */
+  int SeekFrame(int frame);
+
+  /*!
+  *	@return number of the frame shown last
+  */
+  int GetFrameNumber();
+
+  /*!
+  *	Set file playback speed from 0.25 to 16 times real time, 0 to play as fast as possible.
+  *	@return 0 for success, -1 for failure.
+  */
+  int SetPlaybackSpeed(double speed);
+
+  /*!
+  *	Show the next frame while paused.
+  *	@return 0 for success, -1 for failure.
+  */
+  int StepFrame();
+
   /*!
   * Returns the duration of the recording in seconds
   * what does it do for the network
   */
   double GetDuration();
 
+  /*!
+  *  Static helper function to set klv to all-unknown values, with its strings and
+  *  VMTI targets kept in store.
+  */
+  static void InitKLVData(KLVData *klv, KLVStore *store);
+
   /*!
   *  Static helper function to take a raw block of data, and decode the KLV elements
-  *  into a KLVData element.
+  *  into klv, its strings and VMTI targets into store.  Tags not in buf keep their
+  *  values, so klv should be set up with InitKLVData once.
   *  @return 0 for success, -1 for failure
   */
-  static s32 BufferToKLVData(KLVData *klv, const u8* buf, u16 len, s32 bufStartOffset = 0);
+  static s32 BufferToKLVData(KLVData *klv, KLVStore *store, const u8* buf, u16 len, s32 bufStartOffset = 0);
+
+  /*!
+  *  Static helper function to copy src to dst with dst's strings and VMTI targets
+  *  in store.  The KLVData passed to SLADecodeCB refer to the decoder's storage,
+  *  which the next packet overwrites; copy them this way to keep them.
+  */
+  static void CopyKLVData(KLVData *dst, KLVStore *store, const KLVData *src);
+
+  /*!
+  *  Static helper function to encode the tags set in klv->Present as a UAS Datalink
+  *  local set (universal key, BER length, items and checksum).
+  *  @return bytes written, -1 if buf is too small
+  */
+  static s32 KLVDataToBuffer(const KLVData *klv, u8* buf, u16 maxLen);
+
+  /*!
+  *  Static helper function to write the KLV metadata of a transport stream file
+  *  to a CSV or JSON lines text file, one line per local set, without decoding video.
+  *  @return local sets written, -1 if a file can't be opened or there is no KLV stream
+  */
+  static s32 ExtractKLV(const char *tsFile, const char *outFile, bool json = false);
 private:
   void *Data;
 };
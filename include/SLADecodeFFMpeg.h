@@ -7,6 +7,7 @@
 #pragma once
 
 #include "SLAImage.h"
+#include "SLALatencyHist.h"
 
 enum {
   SLA_PROFILE_NONE = 0,
@@ -17,6 +18,51 @@ enum {
   SLA_PROFILE_HIGH
 };
 
+/// Which frames are decoded, see SLADecodeFFMPEG::SetDecodeMode
+enum {
+  SLA_DECODE_ALL = 0,           // Decode every frame
+  SLA_DECODE_REFERENCE_ONLY,    // Drop non-reference (B) frames
+  SLA_DECODE_KEYFRAMES_ONLY     // Drop everything except key/intra frames
+};
+
+/// What to do with damaged frames, see SLADecodeFFMPEG::SetCorruptPolicy
+enum {
+  SLA_CORRUPT_DELIVER = 0,      // Deliver every frame, damaged ones with SLA_CAP_FLAG_CORRUPT
+  SLA_CORRUPT_FREEZE,           // Keep the last good frame while frames have decode errors
+  SLA_CORRUPT_WAIT_KEYFRAME     // Keep the last good frame until the next clean key frame
+};
+
+/// Output conversion (scaling) quality, see SLADecodeFFMPEG::SetConvertQuality
+enum {
+  SLA_CONVERT_FAST = 0,         // Fast bilinear
+  SLA_CONVERT_POINT,            // Nearest neighbour, cheapest
+  SLA_CONVERT_BILINEAR,
+  SLA_CONVERT_BICUBIC,          // Best quality, most expensive
+  SLA_CONVERT_ADAPTIVE          // Pick from the above by decode backlog and frame deadlines
+};
+
+/// Deinterlacing of the decoded frame, see SLADecodeFFMPEG::SetDeinterlace
+enum {
+  SLA_DEINTERLACE_OFF = 0,
+  SLA_DEINTERLACE_BOB,          // Keep the top field and scale it to full height
+  SLA_DEINTERLACE_MOTION        // Weave where the picture is still, interpolate where it moves
+};
+
+// SLCaptureCallback capFlags
+#define SLA_CAP_FLAG_EOF      0x1   // End of file, image is the last frame again
+#define SLA_CAP_FLAG_CORRUPT  0x2   // Frame has decode errors or references a damaged frame
+
+/// Latency stages of a frame, see SLADecodeFFMPEG::GetLatency
+enum {
+  SLA_LATENCY_RECEIVE = 0,  // First packet received to frame demuxed (SL demux only)
+  SLA_LATENCY_QUEUE,        // Frame demuxed to decode start
+  SLA_LATENCY_DECODE,       // Decode call for the compressed frame
+  SLA_LATENCY_CONVERT,      // Decode end to output conversion end, includes reordering and pacing
+  SLA_LATENCY_CALLBACK,     // Conversion end to capture callback return
+  SLA_LATENCY_TOTAL,        // First packet received to capture callback return
+  SLA_LATENCY_STAGES
+};
+
 #define STATS_NAME_LENGTH 10
 
 typedef struct {
@@ -34,6 +80,26 @@ typedef struct {
 
   u32 KeyFrames;
   u32 IFrames, PFrames, BFrames, OtherFrames;
+
+  u32 DispatchOverwrites;   // Frames replaced in the async callback mailbox before the callback saw them
+  u32 DiscardedFrames;      // Frames dropped before decode by the decode mode
+
+  f32 DecodeLoad;           // Percent of one core spent decoding and converting frames
+  u32 DecodeScale;          // Decoded resolution divisor (lowres) in preview mode, 1 for full size
+
+  f32 LatenessAvg;          // File playback: average msec frames were shown after their due time
+  f32 LatenessMax;          // File playback: worst lateness in msec
+  u32 LateDrops;            // File playback: frames dropped for being too late
+
+  u32 CCErrors;             // Compressed frames with lost packets (continuity counter errors)
+  u32 DecodeErrors;         // Compressed frames the decoder rejected
+  u32 CorruptFrames;        // Decoded frames that are damaged, see SLA_CAP_FLAG_CORRUPT
+  u32 CorruptDrops;         // Damaged frames not shown because of the corrupt policy
+
+  SLALatencySummary Latency[SLA_LATENCY_STAGES];  // usec percentiles since ResetLatency
+
+  s32 ConvertQuality;       // SLA_CONVERT_ quality in use, follows the load in SLA_CONVERT_ADAPTIVE
+  u32 ConvertSkips;         // Adaptive: frames not converted because newer ones were waiting
 } CapStats;
 
 /// Callback function type to be called when a frame is captured 
@@ -72,6 +138,30 @@ public:
 
   void SetPALResample(bool flag);
 
+  /*!
+   *  Deinterlace decoded frames from analog (PAL/NTSC) sources before they are
+   *  converted.  Bob costs nothing extra: the conversion reads one field and
+   *  scales it to full height in the same pass as the PAL/upsample resize.
+   *  Motion-adaptive works on bands of lines that are fed to the conversion
+   *  while still in cache; it needs planar 8-bit YUV and uses bob otherwise.
+   *  Output frame rate is the input frame rate.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for unknown mode
+   */
+  SLStatus SetDeinterlace(
+    s32 mode    //!< SLA_DEINTERLACE_OFF, SLA_DEINTERLACE_BOB or SLA_DEINTERLACE_MOTION
+    );
+
+  /*!
+   *  Open ffmpeg-demuxed inputs (files, non-udp:// URLs) as MPEG-TS without
+   *  probing: the codec comes from the PMT stream type and the frame size from
+   *  the in-band SPS/PPS, so the first frame appears after the first key frame.
+   *  Takes effect the next time the input is opened; call right after
+   *  Initialize for the first open.  udp:// streams never probe.
+   */
+  void SetFastOpen(
+    bool enable   //!< true if the input is known to be MPEG-TS
+    );
+
   /*!
    *  Clean up / destroy camera.
    *  @return none
@@ -82,6 +172,8 @@ public:
 
   /*!
    *  Capture an image frame.
+   *  Returns the most recently decoded frame.  Unless noRelease was set, the
+   *  frame is held for the caller and is not reused until it is passed to Release.
    *  @param image Pointer to a pre-allocated image buffer to capture into
    *  @return SLA_SUCCES if capture was successful, SLA_FAIL if no image was captured.
    *  @see Release
@@ -89,12 +181,22 @@ public:
   virtual SLStatus Get(
     SLAImage *image  //!< Image to capture into
     );
+
+  /*!
+   *  Hold a frame beyond the capture callback or an extra time after Get.
+   *  Every AddRef must be balanced by a Release.
+   *  @return SLA_SUCCESS for success, SLA_ERROR if image did not come from this decoder
+   *  @see Release
+   */
+  virtual SLStatus AddRef(
+    SLAImage *image  //!< Image from Get or the capture callback
+    );
     
   /*!
    *  Release a captured image frame.
    *  @param image Pointer to a pre-allocated image buffer to capture into
-   *  @return SLA_SUCCESS for success, SLA_FAIL for failure
-   *  @see Get
+   *  @return SLA_SUCCESS for success, SLA_ERROR if image did not come from this decoder
+   *  @see Get, AddRef
    */
   virtual SLStatus Release(
     SLAImage *image  //!< Image to release
@@ -109,8 +211,58 @@ public:
     );
 
   virtual void SetKLVCallBack(SLKLVCallback callBack);
+
+  /*!
+   *  Run the capture callback on its own thread so a slow callback does not
+   *  stall decoding.  Only the newest frame is kept for the callback; frames
+   *  it had no time for are counted in CapStats::DispatchOverwrites.
+   *  KLV and stats callbacks stay on the decode thread.
+   *  Disabling waits for a callback in progress to return and ends the
+   *  dispatch thread; a frame still waiting for it is dropped.
+   *  @return SLA_SUCCESS for success, SLA_FAIL if the thread could not be started
+   */
+  virtual SLStatus SetAsyncCallBack(
+    bool enable   //!< true to call back from the dispatch thread, false to call back from the decode thread
+    );
+
   virtual void SetStatsCallBack(SLStatsCallback callback, void *context);
 
+  /*!
+   *  Latency percentiles of one stage since the start or the last ResetLatency.
+   *  Safe to call from any thread while decoding.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for an unknown stage
+   */
+  SLStatus GetLatency(
+    s32 stage,                    //!< SLA_LATENCY_RECEIVE ... SLA_LATENCY_TOTAL
+    SLALatencySummary *summary    //!< Filled in with usec percentiles
+    );
+
+  /*!
+   *  Start the latency histograms over, e.g. when the load under test changes.
+   */
+  void ResetLatency();
+
+  /*!
+   *  Presentation time of a frame from Get or the capture callback, usec on the
+   *  stream clock.
+   *  @return SLA_SUCCESS for success, SLA_ERROR if image did not come from this decoder or has no time
+   */
+  SLStatus GetPts(
+    const SLAImage *image,  //!< Frame from Get or the capture callback
+    s64 *pts                //!< Filled in with the usec presentation time
+    );
+
+  /*!
+   *  Metadata at a presentation time, interpolated between the KLV packets around it.
+   *  Safe to call from any thread while decoding, e.g. from the capture callback
+   *  with the time from GetPts.
+   *  @return SLA_SUCCESS for success, SLA_FAIL if no metadata was received at or before pts
+   */
+  SLStatus GetKlvAt(
+    s64 pts,                //!< usec presentation time
+    struct KLVGeoAt *at     //!< Filled in with the samples around pts and the interpolated values
+    );
+
   virtual void GetImageInfo(
        s16 *high,                  //!< Requested image height, NULL or *wide==0 for default, valid pointer returns high
        s16 *wide                  //!< Requested image width, NULL or *wide==0 for default, valid pointer returns wide
@@ -121,11 +273,100 @@ public:
   SLStatus StopSaving();
   SLStatus Start();
   SLStatus Pause(bool pause);
+
+  /*!
+   *  Put the decoder to sleep without tearing it down, so it can be rebound to
+   *  another address with Initialize and woken up quickly.  Threads, frame
+   *  buffers and the codec context are kept.  Returns once no more callbacks
+   *  will be made.
+   *  @return SLA_SUCCESS for success, SLA_TIMEOUT if the decoder did not stop in time
+   */
+  SLStatus Park(
+    bool park   //!< true to park, false to resume
+    );
   SLStatus Seek(double timeStamp);
+
+  /*!
+   *  Seek a file to a frame number.  Like Seek, this jumps to the preceding key
+   *  frame from the file's key frame index (built in the background on open, or
+   *  read from the .kidx sidecar) and decodes forward to the frame.
+   *  @return SLA_SUCCESS if the seek was queued, SLA_ERROR if not a file
+   */
+  SLStatus SeekFrame(
+    s32 frame   //!< Frame number from the start of the file
+    );
+
+  /*!
+   *  @return number of the frame shown last, counted from the start of the file
+   */
+  s32 GetFrameNumber();
+
+  /*!
+   *  File playback speed.  Frames are shown at their timestamps scaled by speed;
+   *  frames that are too late are dropped (CapStats LateDrops).
+   *  @return SLA_SUCCESS for success, SLA_FAIL for an invalid speed
+   */
+  SLStatus SetPlaybackSpeed(
+    double speed  //!< 0.25 to 16 times real time, or 0 for as fast as possible
+    );
+
+  /*!
+   *  Show the next frame of a paused file.
+   *  @return SLA_SUCCESS for success, SLA_FAIL if not a paused file
+   */
+  SLStatus StepFrame();
   double GetDuration();
   void SetUpSample(int upsample);
   int GetUpSample();
 
+  /*!
+   *  Select which frames are decoded.  Takes effect on the next compressed frame,
+   *  so it can be changed while running (e.g. full rate for a selected tile).
+   *  After switching back to SLA_DECODE_ALL, frames may show artifacts until the next key frame.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for unknown mode
+   */
+  SLStatus SetDecodeMode(
+    s32 mode    //!< SLA_DECODE_ALL, SLA_DECODE_REFERENCE_ONLY or SLA_DECODE_KEYFRAMES_ONLY
+    );
+  s32 GetDecodeMode();
+
+  /*!
+   *  Select what happens to damaged frames.  A frame is damaged when the decoder
+   *  reports errors in it, or when packets or frames were lost since the last
+   *  clean key frame so it references bad data.  Damaged frames that are
+   *  delivered carry SLA_CAP_FLAG_CORRUPT in capFlags.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for unknown policy
+   */
+  SLStatus SetCorruptPolicy(
+    s32 policy  //!< SLA_CORRUPT_DELIVER, SLA_CORRUPT_FREEZE or SLA_CORRUPT_WAIT_KEYFRAME
+    );
+  s32 GetCorruptPolicy();
+
+  /*!
+   *  Select the scaling quality of the output conversion.  SLA_CONVERT_ADAPTIVE
+   *  drops to cheaper scaling when frames queue up in front of the decoder or
+   *  miss their deadline, skips converting frames that newer ones will replace,
+   *  and moves back up to bicubic while there is headroom.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for unknown quality
+   */
+  SLStatus SetConvertQuality(
+    s32 quality   //!< SLA_CONVERT_FAST (default), _POINT, _BILINEAR, _BICUBIC or _ADAPTIVE
+    );
+  s32 GetConvertQuality();
+
+  /*!
+   *  Preview mode: output frames at the given tile size, decoding at reduced
+   *  resolution where the codec supports it (lowres for MJPEG/MPEG-4) and
+   *  skipping deblocking and B frame IDCT otherwise (H.264).  Output is lower
+   *  quality than a full decode followed by a downsample.
+   *  Use CapStats DecodeLoad/DecodeScale to see the cost at each size.
+   *  @return SLA_SUCCESS for success, SLA_FAIL for an invalid size
+   */
+  SLStatus SetPreviewSize(
+    s16 high,   //!< Tile height, 0 to turn preview off
+    s16 wide    //!< Tile width, 0 to turn preview off
+    );
+
 private:
   void *Data;
 };
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "sltypes.h"
+
+/*!
+ *  Rebuild one line of the missing field.  Where the picture is still (the
+ *  field line and the line above changed by at most threshold since the
+ *  previous frame) the field line is woven in, elsewhere it is interpolated
+ *  from the lines above and below.
+ *  Pass prevAbove=prevCur=NULL to always interpolate (no previous frame yet).
+ */
+void SLADeinterlaceLine(
+  u8 *dst,                //!< Output line
+  const u8 *above,        //!< Line above from the kept field
+  const u8 *cur,          //!< Line of the missing field
+  const u8 *below,        //!< Line below from the kept field, or above at the bottom edge
+  const u8 *prevAbove,    //!< above in the previous frame, or NULL
+  const u8 *prevCur,      //!< cur in the previous frame, or NULL
+  s32 wide,               //!< Pixels in the line
+  s32 threshold           //!< Largest change treated as still, 0..255
+  );
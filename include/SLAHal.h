@@ -12,6 +12,12 @@
 #if defined(linux)
 #include <unistd.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+typedef int SOCKET;
 #endif
 
 typedef void* SLA_Sem;
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "sltypes.h"
+
+// Sidecar file written next to the recording: <file name><SLA_KEY_INDEX_EXT>
+#define SLA_KEY_INDEX_EXT ".kidx"
+
+/// One key frame of the video stream in a recorded file
+typedef struct {
+  s64 pos;    //!< Byte offset of the packet in the file
+  s64 pts;    //!< Presentation time in usec (AV_TIME_BASE), same clock as the stream
+  s32 frame;  //!< Number of video frames shown before this one (presentation order)
+} SLAKeyFrame;
+
+/// Key frame index of a recorded file, sorted by file position
+typedef struct {
+  char fName[1024];     //!< File the index belongs to
+  s64 fileSize;         //!< Size of the file when indexed, used to detect stale sidecars
+  s32 count;
+  SLAKeyFrame *frames;
+} SLAKeyIndex;
+
+/*!
+ *  Read the sidecar index for fName.
+ *  @return index, or NULL if there is none or it does not match the file size
+ */
+SLAKeyIndex *SLAKeyIndexLoad(const char *fName, s64 fileSize);
+
+/*!
+ *  Demux fName (no decoding) and record every video key frame, then save the sidecar.
+ *  @return index, or NULL on error or when *abort becomes non-zero
+ */
+SLAKeyIndex *SLAKeyIndexBuild(const char *fName, volatile u32 *abort);
+
+/*!
+ *  Write the sidecar index next to the file.
+ *  @return SLA_SUCCESS for success, SLA_FAIL if the file could not be written
+ */
+SLStatus SLAKeyIndexSave(const SLAKeyIndex *index);
+
+void SLAKeyIndexFree(SLAKeyIndex *index);
+
+/*!
+ *  Last key frame at or before pts (usec)
+ *  @return key frame, or NULL if the index is empty
+ */
+const SLAKeyFrame *SLAKeyIndexFindPts(const SLAKeyIndex *index, s64 pts);
+
+/*!
+ *  Last key frame at or before frame number
+ *  @return key frame, or NULL if the index is empty
+ */
+const SLAKeyFrame *SLAKeyIndexFindFrame(const SLAKeyIndex *index, s32 frame);
@@ -13,6 +13,13 @@
 
 #define KLV_MAX_BYTE_ARRAY 127
 #define KLV_MAX_NUMBER_OF_TARGETS 110
+#define KLV_STORE_STRINGS 17  // KLVBytes fields in KLVData, SecurityLDS included
+#define KLV_PRESENT_WORDS 4   // presence bits for tags 0..127
+#define KLV_PRESENT_TAGS (KLV_PRESENT_WORDS*32)
+
+// Test or set the presence bit of an ST 0601 tag in KLVData::Present
+#define KLV_IS_PRESENT(k, tag)  (((k)->Present[(tag)>>5] >> ((tag)&31)) & 1)
+#define KLV_SET_PRESENT(k, tag) ((k)->Present[(tag)>>5] |= 1u << ((tag)&31))
 
 #ifdef __cplusplus
 extern "C" {
@@ -150,7 +157,7 @@ enum {
 
 typedef struct KLVBytes {
   u8 len;
-  u8 data[KLV_MAX_BYTE_ARRAY];
+  u8 *data;       // KLV_MAX_BYTE_ARRAY bytes in the KLVStore the KLVData was set up with
 } KLVBytes;
 
 typedef struct KLVVTargetPack {
@@ -162,11 +169,12 @@ typedef struct KLVVTargetPack {
 } KLVVTargetPack;
 
 typedef struct KLVVmtiLocalSet {
-  u16 nTargets;   // number of targets received up to KLV_MAX_NUMBER_OF_TARGETS
+  u16 nTargets;   // target packs decoded from this set, up to KLV_MAX_NUMBER_OF_TARGETS
+  u16 nReported;  // #6 number of reported targets, may be more than the packs sent
   u16 Version;
   u16 FrameWidth;
   u16 FrameHeight;
-  KLVVTargetPack Target[KLV_MAX_NUMBER_OF_TARGETS];
+  KLVVTargetPack *Target;  // KLV_MAX_NUMBER_OF_TARGETS entries in the KLVStore
 } KLVVmti;
 
 typedef struct KLVSecurityLocalSet {
@@ -186,6 +194,8 @@ typedef struct KLVSecurityLocalSet {
 /// ext := ST 0601.9 When UAS Datalink LS decoding systems understand the
 /// distance-representation of certain metadata items the decoder shall use the distance extended
 /// representation
+/// Strings and VMTI targets are held in a KLVStore, see SLInitKLV. A struct
+/// copy shares them with the original, SLCopyKLV makes one with its own.
 typedef struct KLVData {
                                         // #1 checksum.
   u64 Utctime;                          // #2
@@ -283,8 +293,64 @@ typedef struct KLVData {
   KLVBytes MotionImageryCoreIdentifier; // #94
   KLVBytes SARMotionImageryMetadata;    // #95  Not parsed in this version
   KLVBytes ASMAappend;                  // #100 App Specific Metadata Append tag. Not yet official (ad 6.22.2016)
+  u32 Present[KLV_PRESENT_WORDS];       // Bit per tag decoded into this structure, see KLV_IS_PRESENT
 } KLVData;
 
+/// Storage for the strings and VMTI targets a KLVData refers to, so KLVData itself
+/// stays small. One per KLVData, bound with SLInitKLV.
+typedef struct KLVStore {
+  u8 bytes[KLV_STORE_STRINGS][KLV_MAX_BYTE_ARRAY];
+  KLVVTargetPack targets[KLV_MAX_NUMBER_OF_TARGETS];
+} KLVStore;
+
+// KLVGeo::valid bits
+enum {
+  KLV_GEO_PLATFORM_HEADING  = 0x0001,
+  KLV_GEO_PLATFORM_PITCH    = 0x0002,
+  KLV_GEO_PLATFORM_ROLL     = 0x0004,
+  KLV_GEO_SENSOR_POSITION   = 0x0008,  // sensorLat, sensorLon
+  KLV_GEO_SENSOR_ALTITUDE   = 0x0010,
+  KLV_GEO_SENSOR_AZIMUTH    = 0x0020,
+  KLV_GEO_SENSOR_ELEVATION  = 0x0040,
+  KLV_GEO_SENSOR_ROLL       = 0x0080,
+  KLV_GEO_FIELD_OF_VIEW     = 0x0100,  // hfov, vfov
+  KLV_GEO_SLANT_RANGE       = 0x0200,
+  KLV_GEO_CENTER            = 0x0400,  // centerLat, centerLon
+  KLV_GEO_CENTER_ELEVATION  = 0x0800,
+  KLV_GEO_CORNERS           = 0x1000,  // cornerLat, cornerLon
+  KLV_GEO_FROM_POSE         = 0x2000,  // center or corners not sent, computed from the sensor pose
+};
+
+/// Geo-registration items of a KLVData in degrees and meters, see SLKlvToGeo
+typedef struct KLVGeo {
+  s64 pts;                  // usec, stream clock of the metadata
+  u32 valid;                // KLV_GEO_ bits of the values that were received
+  double platformHeading;   // #5   0..360
+  double platformPitch;     // #6, #90
+  double platformRoll;      // #7, #91
+  double sensorLat;         // #13
+  double sensorLon;         // #14
+  double sensorAlt;         // #15  MSL
+  double sensorAzimuth;     // #18  0..360, relative to the platform
+  double sensorElevation;   // #19
+  double sensorRoll;        // #20  0..360
+  double hfov, vfov;        // #16, #17
+  double slantRange;        // #21
+  double centerLat;         // #23
+  double centerLon;         // #24
+  double centerElevation;   // #25  MSL
+  double cornerLat[4];      // #82.. full corners, or the #26.. offsets added to the center,
+                            // upper left first, clockwise
+  double cornerLon[4];
+} KLVGeo;
+
+/// Metadata at a frame time, see SLAKlvHistoryAt
+typedef struct KLVGeoAt {
+  KLVGeo before;            // newest sample at or before the time
+  KLVGeo after;             // next sample, same as before past the newest sample
+  KLVGeo at;                // interpolated between before and after
+} KLVGeoAt;
+
 // Values to indicate data elements are "Unknown" per MISB 0601
 const KLVData KLVUnknown = {
   0,                    // #2
@@ -298,18 +364,18 @@ const KLVData KLVUnknown = {
   {0},                  // #10
   {0},                  // #11
   {0},                  // #12
-  0x80000000,           // #13
-  0x80000000,           // #14
+  (s32)0x80000000,     // #13
+  (s32)0x80000000,     // #14
   0xFFFFFFFF,           // #15
   0xFFFFFFFF,           // #16
   0xFFFFFFFF,           // #17
   0xFFFFFFFFFFFFFFFFull,// #18    NOTE: 'ull' to indicate unsigned long long
-  0x80000000,           // #19 
+  (s32)0x80000000,     // #19 
   0xFFFFFFFFFFFFFFFFull,// #20
   0xFFFFFFFFFFFFFFFFull,// #21
   0xFFFFFFFF,           // #22
-  0x80000000,           // #23
-  0x80000000,           // #24
+  (s32)0x80000000,     // #23
+  (s32)0x80000000,     // #24
   0xFFFFFFFF,           // #25
   (s16)0x8000,          // #26
   (s16)0x8000,          // #27
@@ -324,9 +390,9 @@ const KLVData KLVUnknown = {
   0xFFFFFFFF,           // #36
   0xFFFFFFFF,           // #37
   0xFFFFFFFF,           // #38
-  0x80000000,           // #39
-  0x80000000,           // #40
-  0x80000000,           // #41
+  (s32)0x80000000,     // #39
+  (s32)0x80000000,     // #40
+  (s32)0x80000000,     // #41
   0xFFFFFFFF,           // #42
   0xFFFF,               // #43
   0xFFFF,               // #44
@@ -362,8 +428,8 @@ const KLVData KLVUnknown = {
   0xFFFFFFFF,           // #64
   0xFFFF,               // #65
                         // #66
-  0x80000000,           // #67
-  0x80000000,           // #68
+  (s32)0x80000000,     // #67
+  (s32)0x80000000,     // #68
   0xFFFFFFFF,           // #69
   {0},                  // #70
   0xFFFFFFFF,           // #71
@@ -377,21 +443,22 @@ const KLVData KLVUnknown = {
   (s16)0x8000,          // #79
   (s16)0x8000,          // #80
   {0},                  // #81
-  0x80000000,           // #82
-  0x80000000,           // #83
-  0x80000000,           // #84
-  0x80000000,           // #85
-  0x80000000,           // #86
-  0x80000000,           // #87
-  0x80000000,           // #88
-  0x80000000,           // #89
-  0x80000000,           // #90
-  0x80000000,           // #91
-  0x80000000,           // #92
-  0x80000000,           // #93
+  (s32)0x80000000,     // #82
+  (s32)0x80000000,     // #83
+  (s32)0x80000000,     // #84
+  (s32)0x80000000,     // #85
+  (s32)0x80000000,     // #86
+  (s32)0x80000000,     // #87
+  (s32)0x80000000,     // #88
+  (s32)0x80000000,     // #89
+  (s32)0x80000000,     // #90
+  (s32)0x80000000,     // #91
+  (s32)0x80000000,     // #92
+  (s32)0x80000000,     // #93
   {0},                  // #94
   {0},                  // #95
-  {0}                   // #100 // do we need to fill in 96..99?
+  {0},                  // #100 // do we need to fill in 96..99?
+  {0}                   // Present
 };
 
 #ifdef __cplusplus
@@ -19,6 +19,9 @@
 // Implements Video Moving Target Indicator and Track Local Set MISB ST 0903.3
 #define VMTI_VERSION 3
 
+// UAS Datalink LS universal key, MISB EG 0601.1
+static const u8 SLUniversalKey[] = {0x06, 0x0E, 0x2B, 0x34,  0x02, 0x0B, 0x01, 0x01,   0x0E, 0x01, 0x03, 0x01,  0x01, 0x00, 0x00, 0x00};
+
 #define MISSION_ID_LENGTH 127
 #define PLATFORM_TAIL_NUMBER_LENGTH 127
 #define IMAGE_COORDINATE_SYSTEM_LENGTH 127
@@ -33,10 +36,41 @@
 #define MIIS_CORE_IDENTIFIER_LENGTH 127
 
 
+// Wire encodings of the UAS Datalink LS items
+enum {
+  KLV_TYPE_NONE,      // not decoded, skipped
+  KLV_TYPE_CHECKSUM,
+  KLV_TYPE_U8,        // big-endian, zero extended to the field size
+  KLV_TYPE_U16,
+  KLV_TYPE_U32,
+  KLV_TYPE_U64,
+  KLV_TYPE_INT,       // big-endian, sign extended to the field size
+  KLV_TYPE_BYTES,     // KLVBytes, truncated to KLV_MAX_BYTE_ARRAY
+  KLV_TYPE_SECURITY,  // ST 0102 local set
+  KLV_TYPE_VMTI,      // ST 0903 local set
+};
+
+// Decoding and encoding of one tag. Merge and reset also use offset and size, so
+// they only touch the tags a packet carried.
+typedef struct {
+  u16 offset;   // field in KLVData
+  u16 size;     // 0 for tags without a field
+  u16 lenMask;  // bit n set if n is a valid length, 0 for any length
+  u8  type;
+  u8  wireLen;  // ST 0601 length, the encoder widens it only for extended values
+} KLVTag;
+
+// Indexed by tag number
+extern const KLVTag klvTags[KLV_PRESENT_TAGS];
+
 u16 Checksum(const u8 *src, u32 len);
 
 //u32 ReadBer(const u8 *buffer, u16 *length);
-s32 ReadElement(const u8 *buffer, KLVData *dest, const u8 *csSrc, u32 len);
+
+// Decode the UAS Datalink LS item at buf+ldsOffset into dest, buf is the start of the 16-byte key.
+// Items not in the tag table are skipped.
+// returns bytes consumed, -1 on a malformed item or checksum mismatch
+s32 ReadElement(const u8 *buf, u32 ldsOffset, KLVData *dest);
 
 // Scan buffer for 16-byte universal key.
 // buf points to the encoded bytestream, len indicates that stream's size in bytes
@@ -49,5 +83,73 @@ s32 ReadKeyLength(const u8* buf, u16 len, u16 *bytesRead, u16 *klvLen, u16 *head
 s32 ReadKlvElements(KLVData *klv, const u8* buf, u16 ldsOffset, u16 klvLen);
 
 s32 ReadKlvFrame(KLVData *klv, const u8* buf, u16 len, s32 bufStartOffset = 5);
+
+// Set k to KLVUnknown with its strings and VMTI targets kept in store.
+// A KLVData must be set up this way before anything is decoded into it.
+void SLInitKLV(KLVData *k, KLVStore *store);
+
+// Point the strings and VMTI targets of k into store, leaving its values alone.
+void SLBindKLV(KLVData *k, KLVStore *store);
+
+// Copy s to d with d's strings and targets in store. A plain struct copy
+// shares the strings and targets of s, which change with the next packet.
+void SLCopyKLV(KLVData *d, KLVStore *store, const KLVData *s);
+
+// Merge the tags present in s into d, d->Present accumulates s->Present.
+// Strings and targets are copied into d's store.
 void SLCopyChangedKLV(KLVData *d, KLVData *s);
 
+// Return the tags present in k to their KLVUnknown values and clear k->Present.
+// k must have been set up with SLInitKLV.
+void SLResetKLV(KLVData *k);
+
+
+// Convert the geo-registration items present in k to degrees and meters.
+// geo->pts is set to 0, geo->valid tells which items were present and in range.
+// Without a frame center or corners in k, they are computed from the sensor
+// position and altitude, platform and sensor angles and field of view, and
+// KLV_GEO_FROM_POSE is set.
+void SLKlvToGeo(const KLVData *k, KLVGeo *geo);
+
+// Doubles of KLVGeo, platformHeading to cornerLon[3]
+#define KLV_GEO_VALUES 23
+
+// The integers SLKlvToGeo reads from a KLVData, in KLVGeo order
+typedef struct {
+  u32 valid;                        // KLV_GEO_ bits
+  u32 forms;                        // which items came in their short form
+  double raw[KLV_GEO_VALUES];
+} KLVGeoInput;
+
+// SLKlvToGeo result, kept until the items it was computed from change
+typedef struct {
+  KLVGeoInput in;
+  KLVGeo geo;
+} KLVGeoCache;
+
+void SLInitKLVGeoCache(KLVGeoCache *c);
+
+// SLKlvToGeo of k, converted again only when its geo items differ from the last call.
+// The result stays in c until the next call.
+const KLVGeo *SLKlvToGeoCached(KLVGeoCache *c, const KLVData *k);
+
+// Longest local set (key, BER length and value) KLVParser puts together
+#define KLV_MAX_SET_LENGTH 0xFFFF
+
+// Resumable search for UAS Datalink local sets in a byte stream, see SLParseKLV
+typedef struct {
+  u8 buf[KLV_MAX_SET_LENGTH];  // the current set while it arrives in pieces
+  u32 have;     // bytes of the current set in buf
+  u32 total;    // length of the current set, 0 until its key and BER length are complete
+  u32 skip;     // bytes still to pass over of a set longer than KLV_MAX_SET_LENGTH
+} KLVParser;
+
+void SLInitKLVParser(KLVParser *p);
+
+// Take up data from the stream until a local set is complete, which is returned in
+// set/setLen starting at its key. Sets that arrive whole point into data, the others
+// into p and stay valid until the next call. Bytes between sets are skipped.
+// Call again with the rest of data until it is used up; a set split across calls
+// is returned by the call that delivers its last byte.
+// returns bytes of data used
+u32 SLParseKLV(KLVParser *p, const u8 *data, u32 len, const u8 **set, u32 *setLen);
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "sltypes.h"
+#include "SLAKlv.h"
+
+// Asynchronous metadata, the PES carries no PTS
+#define SLA_KLV_NO_PTS (-1)
+
+// Encode the tags set in present (klv->Present when NULL) as a UAS Datalink LS:
+// 16-byte universal key, BER length, the items in tag order and the checksum.
+// Security (#48) and VMTI (#74) are written as nested local sets, leaving out
+// items that hold their KLVUnknown value.
+// returns bytes written, 0 if buf is too small
+u32 WriteKlvFrame(const KLVData *klv, const u32 *present, u8 *buf, u32 maxLen);
+
+// State of the KLV elementary stream in a transport stream
+typedef struct {
+  u16 pid;
+  u8 cc;          // continuity counter of the next TS packet
+  u8 sequence;    // metadata AU cell sequence number
+} SLAKlvTsMux;
+
+void SLAKlvTsInit(SLAKlvTsMux *mux, u16 pid);
+
+// Wrap one local set in a PES packet and split it into 188-byte TS packets on mux->pid.
+// pts (90 kHz) should be the PTS of the video frame the metadata belongs to. It makes
+// the PES synchronous metadata (stream_id 0xFC with the 5-byte metadata AU cell header).
+// With SLA_KLV_NO_PTS it is asynchronous (stream_id 0xBD).
+// returns bytes written, a multiple of 188, 0 if ts is too small
+u32 SLAKlvTsWrite(SLAKlvTsMux *mux, const u8 *klv, u32 klvLen, s64 pts, u8 *ts, u32 maxLen);
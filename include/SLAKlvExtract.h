@@ -0,0 +1,44 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdio.h>
+#include "sltypes.h"
+#include "SLAKlv.h"
+
+// Text formats of SLAKlvFormat and SLAKlvExtract
+enum {
+  SLA_KLV_TEXT_CSV = 0,   // pts and a column per tag, after a header line
+  SLA_KLV_TEXT_JSON,      // one object per line, tag numbers as keys
+};
+
+typedef struct {
+  u64 bytes;      // transport stream bytes read
+  u32 sets;       // local sets written
+  u32 badSets;    // local sets that failed to decode, e.g. checksum errors
+  u32 ccErrors;   // KLV packets lost
+  u16 pid;        // KLV PID read
+} SLAKlvExtractStats;
+
+// Header line of the CSV format, nothing for JSON
+// returns characters written including the newline, 0 if line is too small
+u32 SLAKlvFormatHeader(s32 format, char *line, u32 maxLen);
+
+// One line with pts and the tags present in klv, integers as they were sent.
+// Strings are JSON strings and Security (#48) and VMTI (#74) nested JSON
+// objects, in CSV as a quoted cell holding the JSON value.
+// pts is the 90 kHz PES PTS, -1 if there was none.
+// returns characters written including the newline, 0 if line is too small
+u32 SLAKlvFormat(const KLVData *klv, s64 pts, s32 format, char *line, u32 maxLen);
+
+// Write the KLV metadata of a transport stream file to out without decoding video.
+// Only TS packets of the KLV PID are looked at, pid 0 finds it from the PMT
+// (stream type 0x15, or 0x06 registered as "KLVA"). Local sets may be split
+// across PES packets or several to a packet, synchronous metadata AU cells
+// are unwrapped.
+// returns SLA_SUCCESS, SLA_FAIL if the file can't be read or has no KLV stream
+SLStatus SLAKlvExtract(const char *tsName, FILE *out, s32 format, u16 pid, SLAKlvExtractStats *stats);
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "sltypes.h"
+#include "SLAKlv.h"
+
+// Samples kept, a power of two.  About 8 sec of metadata at 30 Hz.
+#define SLA_KLV_HISTORY_SIZE  256
+
+// usec forward jump treated as a discontinuity, the history starts over
+#define SLA_KLV_HISTORY_MAX_GAP  5000000
+
+typedef struct {
+  volatile u32 seq;   //!< Odd while the writer is filling the slot
+  u32 number;         //!< Sample number held, count-1 for the newest
+  KLVGeo geo;
+} SLAKlvSlot;
+
+/// Timestamped metadata samples with a single writer.  Readers search it
+/// without locking and retry if the writer overtakes them.
+typedef struct {
+  SLAKlvSlot slots[SLA_KLV_HISTORY_SIZE];
+  volatile u32 first;   //!< Sample number of the oldest sample since the history started over
+  volatile u32 count;   //!< Samples recorded
+} SLAKlvHistory;
+
+void SLAKlvHistoryInit(SLAKlvHistory *hist);
+
+/*!
+ *  Forget the samples, e.g. after a reconnect.  Writer thread only.
+ */
+void SLAKlvHistoryReset(SLAKlvHistory *hist);
+
+/*!
+ *  Add the sample for geo->pts.  Only one thread may record into a history.
+ *  A sample with the time of the newest one replaces it; going back in time or
+ *  jumping ahead by more than SLA_KLV_HISTORY_MAX_GAP starts the history over.
+ */
+void SLAKlvHistoryRecord(SLAKlvHistory *hist, const KLVGeo *geo);
+
+/*!
+ *  Find the samples around pts with a binary search and interpolate between them.
+ *  Angles and longitudes are interpolated the short way round.  Past the newest
+ *  sample it is held.  Safe while the writer records.
+ *  @return SLA_SUCCESS for success, SLA_FAIL if no sample is at or before pts
+ */
+SLStatus SLAKlvHistoryAt(const SLAKlvHistory *hist, s64 pts, KLVGeoAt *at);
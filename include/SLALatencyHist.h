@@ -0,0 +1,48 @@
+/*
+ * Copyright (C)2007-2016 SightLine Applications Inc
+ * SightLine Applications Library of signal, vision, and speech processing
+ * http://www.sightlineapplications.com
+ *------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "sltypes.h"
+
+// Log-linear buckets: exact below 2^SUB_BITS usec, then 2^SUB_BITS buckets per
+// power of two (about 6% resolution) up to 2^(MAX_BITS+1) usec (134 sec).
+#define SLA_LATENCY_SUB_BITS  4
+#define SLA_LATENCY_MAX_BITS  26
+#define SLA_LATENCY_BUCKETS   ((SLA_LATENCY_MAX_BITS - SLA_LATENCY_SUB_BITS + 2) << SLA_LATENCY_SUB_BITS)
+
+/// Latency histogram with a single writer.  Readers take a consistent enough
+/// snapshot without locking; counts are only ever incremented by the writer.
+typedef struct {
+  volatile u32 counts[SLA_LATENCY_BUCKETS];
+  volatile u32 total;
+  volatile u32 max;             //!< Largest value recorded, usec
+  volatile u32 clearRequest;    //!< Set by a reader, the writer clears before the next record
+} SLALatencyHist;
+
+/// Percentiles of a histogram in usec, each the upper edge of its bucket
+typedef struct {
+  u32 count;
+  u32 p50;
+  u32 p99;
+  u32 p999;
+  u32 max;
+} SLALatencySummary;
+
+/*!
+ *  Add one sample.  Only one thread may record into a histogram.
+ */
+void SLALatencyHistRecord(SLALatencyHist *hist, u64 usec);
+
+/*!
+ *  Ask the writer to start over.  Takes effect with the next recorded sample.
+ */
+void SLALatencyHistClear(SLALatencyHist *hist);
+
+/*!
+ *  Compute percentiles from a snapshot of the histogram.  Safe while the writer records.
+ */
+void SLALatencyHistSummary(const SLALatencyHist *hist, SLALatencySummary *summary);
@@ -61,10 +61,13 @@ typedef struct {
   SLAUdpVideoProtocol streamType;
   // Set to 1 if UDP receiver determines that video+klv+sla_metadata at single PTS has been received
   int frameDataComplete;         
+  u64 arrivalTime;  // SLAGetMHzTime usec the first packet of the frame was received
+  u64 demuxTime;    // SLAGetMHzTime usec the frame was complete
 } SLA_COMPRESSED_FRAME;
 
 typedef struct {
   s32 backedUp;  // Is receive buffer getting backed up?
+  s32 framesQueued;  // Demuxed video frames waiting for SLADemuxNextFrame
 } SLA_UDP_STATUS;
 
 // Return opaque state structure
@@ -82,6 +85,10 @@ SLStatus SLAStopSavingUDP(void *_data);
 // returns result of blocking call (SLA_ERROR implies shutdown request)
 SLStatus SLADemuxNextFrame(void *UDPReceiveData, SLA_COMPRESSED_FRAME *frame, u32 timeout);
 
+// Make a blocked (or the next) SLADemuxNextFrame return SLA_NOP without a frame,
+// e.g. to let the caller handle a control command
+SLStatus SLADemuxWake(void *UDPReceiveData);
+
 SLStatus SLAUDPStatus(void *UDPReceiveData, SLA_UDP_STATUS *status);
 
 SLINLINE static bool SLAIsMetaDataProtocol(SLAUdpVideoProtocol prt) {